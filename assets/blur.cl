@@ -7,6 +7,8 @@ __kernel void blurKernel(__read_only  image2d_t  srcImage,
 
      int x = get_global_id(0);
      int y = get_global_id(1);
+     if(x >= get_image_width(dstImage) || y >= get_image_height(dstImage))
+         return; // padding of the global size
      int2 coords = (int2) (x,y);       
 	 int2 curCoords = (int2) (x,y);	
 
@@ -43,3 +45,30 @@ __kernel void blurKernel(__read_only  image2d_t  srcImage,
 	write_imagef(dstImage,curCoords,currentPixel);	
 }
 
+__kernel void blurU8Kernel(__read_only  image2d_t  srcImage,
+                          __write_only image2d_t  dstImage)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                               CLK_ADDRESS_CLAMP_TO_EDGE  |
+                               CLK_FILTER_NEAREST;
+     int x = get_global_id(0);
+     int y = get_global_id(1);
+     if(x >= get_image_width(dstImage) || y >= get_image_height(dstImage))
+         return; // padding of the global size
+     int2 coords = (int2) (x,y);
+
+    // Integer variant for CL_UNSIGNED_INT8 images, the division by 9 is a 16 bit fixed-point multiply
+    uint4 currentPixel = read_imageui(srcImage,sampler,coords);
+    uint4 sum = (uint4)(0);
+    for(int i=-1;i<=1;i++)
+    {
+        for(int j=-1;j<=1;j++)
+        {
+            sum += read_imageui(srcImage,sampler,(int2)(x+i,y+j));
+        }
+    }
+    sum = (sum * 7282u + 32768u) >> 16;
+    currentPixel.xyz = sum.xyz;
+
+    write_imageui(dstImage,coords,currentPixel);
+}
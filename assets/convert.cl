@@ -0,0 +1,37 @@
+__kernel void unpackBGRKernel(__global const uchar* src,
+                              const uint srcStride,
+                              __write_only image2d_t dstImage)
+{ 
+     int x = get_global_id(0);
+     int y = get_global_id(1);
+     if(x >= get_image_width(dstImage) || y >= get_image_height(dstImage))
+         return; // padding of the global size
+     int2 coords = (int2) (x,y);
+
+    // One pixel is 3 bytes in blue, green, red order, like the frames of FFmpeg and OpenCV
+    __global const uchar* pixel = src + y*srcStride + x*3;
+    float4 currentPixel = (float4)(pixel[2], pixel[1], pixel[0], 255.0f) / 255.0f;
+
+    write_imagef(dstImage,coords,currentPixel);
+}
+
+__kernel void packBGRKernel(__read_only  image2d_t  srcImage,
+                            __global uchar* dst,
+                            const uint dstStride)
+{ 
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                               CLK_ADDRESS_CLAMP_TO_EDGE  |
+                               CLK_FILTER_NEAREST;
+     int x = get_global_id(0);
+     int y = get_global_id(1);
+     if(x >= get_image_width(srcImage) || y >= get_image_height(srcImage))
+         return; // padding of the global size
+     int2 coords = (int2) (x,y);
+
+    uint4 currentPixel = convert_uint4_sat_rte(read_imagef(srcImage,sampler,coords) * 255.0f);
+
+    __global uchar* pixel = dst + y*dstStride + x*3;
+    pixel[0] = currentPixel.z;
+    pixel[1] = currentPixel.y;
+    pixel[2] = currentPixel.x;
+}
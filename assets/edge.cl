@@ -6,6 +6,8 @@ __kernel void edgeKernel(__read_only  image2d_t  srcImage,
                                CLK_FILTER_NEAREST;
     int x = get_global_id(0);
     int y = get_global_id(1);
+    if(x >= get_image_width(dstImage) || y >= get_image_height(dstImage))
+        return; // padding of the global size
 	int2 coords = (int2) (x,y);
 	int2 curCoords = (int2) (x,y);
 	int i = 0;
@@ -30,4 +32,31 @@ __kernel void edgeKernel(__read_only  image2d_t  srcImage,
 	currentPixel.z=sum;
 	
 	write_imagef(dstImage,curCoords,currentPixel);	                          
-}
\ No newline at end of file
+}
+
+__kernel void edgeU8Kernel(__read_only  image2d_t  srcImage,
+                          __write_only image2d_t  dstImage)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                               CLK_ADDRESS_CLAMP_TO_EDGE  |
+                               CLK_FILTER_NEAREST;
+     int x = get_global_id(0);
+     int y = get_global_id(1);
+     if(x >= get_image_width(dstImage) || y >= get_image_height(dstImage))
+         return; // padding of the global size
+     int2 coords = (int2) (x,y);
+
+    // Integer variant for CL_UNSIGNED_INT8 images, the Laplacian of the green channel
+    uint4 currentPixel = read_imageui(srcImage,sampler,coords);
+    int sum = (int)read_imageui(srcImage,sampler,(int2)(x-1,y)).y
+            + (int)read_imageui(srcImage,sampler,(int2)(x+1,y)).y
+            + (int)read_imageui(srcImage,sampler,(int2)(x,y-1)).y
+            + (int)read_imageui(srcImage,sampler,(int2)(x,y+1)).y
+            - 4 * (int)currentPixel.y;
+    uint value = (uint)clamp(sum, 0, 255);
+    currentPixel.x = value;
+    currentPixel.y = value;
+    currentPixel.z = value;
+
+    write_imageui(dstImage,coords,currentPixel);
+}
@@ -6,6 +6,8 @@ __kernel void inverseKernel(__read_only  image2d_t  srcImage,
                                CLK_FILTER_NEAREST;
      int x = get_global_id(0);
      int y = get_global_id(1);
+     if(x >= get_image_width(dstImage) || y >= get_image_height(dstImage))
+         return; // padding of the global size
      int2 coords = (int2) (x,y);
 
     float4 centerPixel = read_imagef(srcImage,sampler,coords);
@@ -13,4 +15,24 @@ __kernel void inverseKernel(__read_only  image2d_t  srcImage,
     centerPixel.y = 1.0f-centerPixel.y;
     centerPixel.z = 1.0f-centerPixel.z;
     write_imagef(dstImage,coords,centerPixel);	
-}
\ No newline at end of file
+}
+
+__kernel void inverseU8Kernel(__read_only  image2d_t  srcImage,
+                          __write_only image2d_t  dstImage)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                               CLK_ADDRESS_CLAMP_TO_EDGE  |
+                               CLK_FILTER_NEAREST;
+     int x = get_global_id(0);
+     int y = get_global_id(1);
+     if(x >= get_image_width(dstImage) || y >= get_image_height(dstImage))
+         return; // padding of the global size
+     int2 coords = (int2) (x,y);
+
+    // Integer variant for CL_UNSIGNED_INT8 images
+    uint4 centerPixel = read_imageui(srcImage,sampler,coords);
+    centerPixel.x = 255u-centerPixel.x;
+    centerPixel.y = 255u-centerPixel.y;
+    centerPixel.z = 255u-centerPixel.z;
+    write_imageui(dstImage,coords,centerPixel);
+}
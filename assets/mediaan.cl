@@ -1,67 +1,221 @@
-void bubble_sort(float list[], float n)
+// Puts the smaller of two pixels in a and the larger in b, for all channels at once
+#define MEDIAN_SORT(a,b) { t = min(a,b); b = max(a,b); a = t; }
+
+/*
+ * Median of the 3x3 neighbourhood with the 19 exchanges of the median-of-9 sorting
+ * network. The median ends up in p4.
+ */
+#define MEDIAN_3X3(type, READ) \
+    type p0 = READ(srcImage,sampler,(int2)(x-1,y-1)); \
+    type p1 = READ(srcImage,sampler,(int2)(x,  y-1)); \
+    type p2 = READ(srcImage,sampler,(int2)(x+1,y-1)); \
+    type p3 = READ(srcImage,sampler,(int2)(x-1,y  )); \
+    type p4 = READ(srcImage,sampler,(int2)(x,  y  )); \
+    type p5 = READ(srcImage,sampler,(int2)(x+1,y  )); \
+    type p6 = READ(srcImage,sampler,(int2)(x-1,y+1)); \
+    type p7 = READ(srcImage,sampler,(int2)(x,  y+1)); \
+    type p8 = READ(srcImage,sampler,(int2)(x+1,y+1)); \
+    type t; \
+    MEDIAN_SORT(p1,p2) MEDIAN_SORT(p4,p5) MEDIAN_SORT(p7,p8) \
+    MEDIAN_SORT(p0,p1) MEDIAN_SORT(p3,p4) MEDIAN_SORT(p6,p7) \
+    MEDIAN_SORT(p1,p2) MEDIAN_SORT(p4,p5) MEDIAN_SORT(p7,p8) \
+    MEDIAN_SORT(p0,p3) MEDIAN_SORT(p5,p8) MEDIAN_SORT(p4,p7) \
+    MEDIAN_SORT(p3,p6) MEDIAN_SORT(p1,p4) MEDIAN_SORT(p2,p5) \
+    MEDIAN_SORT(p4,p7) MEDIAN_SORT(p4,p2) MEDIAN_SORT(p6,p4) \
+    MEDIAN_SORT(p4,p2)
+
+/*
+ * Median of the 5x5 neighbourhood by forgetful selection. Only 14 pixels are kept:
+ * every round moves the smallest and the largest of them to the ends, forgets both,
+ * because neither can be the median, and loads the next pixel in place of the largest.
+ * After the last pixel the median is the middle one of the 3 that are left, in v[12].
+ * The loops have constant bounds, so the compilers unroll them and keep v in registers.
+ */
+#define MEDIAN_5X5(type, READ) \
+    type v[14]; \
+    type t; \
+    for(int k = 0; k < 14; k++) \
+        v[k] = READ(srcImage,sampler,(int2)(x + k % 5 - 2, y + k / 5 - 2)); \
+    for(int lo = 0; lo < 11; lo++) \
+    { \
+        for(int i = lo + 1; i < 14; i++) \
+            MEDIAN_SORT(v[lo],v[i]) \
+        for(int i = lo + 1; i < 13; i++) \
+            MEDIAN_SORT(v[i],v[13]) \
+        int k = 14 + lo; \
+        v[13] = READ(srcImage,sampler,(int2)(x + k % 5 - 2, y + k / 5 - 2)); \
+    } \
+    MEDIAN_SORT(v[11],v[12]) \
+    MEDIAN_SORT(v[12],v[13]) \
+    MEDIAN_SORT(v[11],v[12])
+
+__kernel void mediaanKernel(__read_only  image2d_t  srcImage,
+                          __write_only image2d_t  dstImage)
 {
-  int c, d;
-  float t;
-  
-  for (c = 1 ; c <= n - 1; c++) {
-    d = c;
- 	
-    while ( d > 0 && list[d] < list[d-1]) {
-      t          = list[d];
-      list[d]   = list[d-1];
-      list[d-1] = t;
- 
-      d--;
-    }
-  }  
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                               CLK_ADDRESS_CLAMP_TO_EDGE  |
+                               CLK_FILTER_NEAREST;
+
+     int x = get_global_id(0);
+     int y = get_global_id(1);
+     if(x >= get_image_width(dstImage) || y >= get_image_height(dstImage))
+         return; // padding of the global size
+     int2 coords = (int2) (x,y);
+
+    MEDIAN_5X5(float4, read_imagef)
+
+    float4 result = v[12];
+    result.w = 1.0f;
+    write_imagef(dstImage,coords,result);
 }
 
-__kernel void mediaanKernel(__read_only  image2d_t  srcImage,
+__kernel void mediaanU8Kernel(__read_only  image2d_t  srcImage,
                           __write_only image2d_t  dstImage)
-{    
-    const sampler_t sampler = CLK_NORMALIZED_COORDS_TRUE |
-                               CLK_ADDRESS_REPEAT         |
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                               CLK_ADDRESS_CLAMP_TO_EDGE  |
                                CLK_FILTER_NEAREST;
+     int x = get_global_id(0);
+     int y = get_global_id(1);
+     if(x >= get_image_width(dstImage) || y >= get_image_height(dstImage))
+         return; // padding of the global size
+     int2 coords = (int2) (x,y);
+
+    // Integer variant for CL_UNSIGNED_INT8 images
+    MEDIAN_5X5(uint4, read_imageui)
 
+    uint4 result = v[12];
+    result.w = 255u;
+    write_imageui(dstImage,coords,result);
+}
+
+__kernel void mediaan3Kernel(__read_only  image2d_t  srcImage,
+                          __write_only image2d_t  dstImage)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                               CLK_ADDRESS_CLAMP_TO_EDGE  |
+                               CLK_FILTER_NEAREST;
      int x = get_global_id(0);
      int y = get_global_id(1);
-     int2 coords = (int2) (x,y);       
-
-	int counter = 0;
-	float pixelListR[25];
-	float pixelListG[25];
-	float pixelListB[25];
-
-
-	int i = 0;
-	int j = 0;
-	
-	float4 bufferPixel;
-	
-	for(i=-2;i<=2;i++)
-	{
-		for(j=-2;j<=2;j++)
-		{
-		coords = (int2)((x+i),(y+j));
-	    bufferPixel = read_imagef(srcImage,sampler,coords);
-	    
-		pixelListR[counter] = bufferPixel.x;
-		pixelListG[counter] = bufferPixel.y;
-		pixelListB[counter] = bufferPixel.z;	
-
-	    counter++;
-		}
-	}
-	
-	bubble_sort(pixelListR, 25);
-	bubble_sort(pixelListG, 25);
-	bubble_sort(pixelListB, 25);
-		
-	float4 result = { 0, 0, 0, 255 };
-	result.x = pixelListR[12] ;	
-	result.y = pixelListG[12] ;
-	result.z = pixelListB[12] ;
-	coords = (int2) (x,y);
-	write_imagef(dstImage,coords,result);	
+     if(x >= get_image_width(dstImage) || y >= get_image_height(dstImage))
+         return; // padding of the global size
+     int2 coords = (int2) (x,y);
+
+    MEDIAN_3X3(float4, read_imagef)
+
+    p4.w = 1.0f;
+    write_imagef(dstImage,coords,p4);
 }
 
+__kernel void mediaan3U8Kernel(__read_only  image2d_t  srcImage,
+                          __write_only image2d_t  dstImage)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                               CLK_ADDRESS_CLAMP_TO_EDGE  |
+                               CLK_FILTER_NEAREST;
+     int x = get_global_id(0);
+     int y = get_global_id(1);
+     if(x >= get_image_width(dstImage) || y >= get_image_height(dstImage))
+         return; // padding of the global size
+     int2 coords = (int2) (x,y);
+
+    // Integer variant for CL_UNSIGNED_INT8 images
+    MEDIAN_3X3(uint4, read_imageui)
+
+    p4.w = 255u;
+    write_imageui(dstImage,coords,p4);
+}
+
+// Adds (step 1) or removes (step -1) a pixel from the histograms of the three channels
+void medianHistogramUpdate(ushort* hist, int* median, int* below, uint4 pixel, int step)
+{
+    uint value[3] = {pixel.x, pixel.y, pixel.z};
+    for(int c = 0; c < 3; c++)
+    {
+        hist[c * 256 + value[c]] += step;
+        if((int)value[c] < median[c])
+            below[c] += step;
+    }
+}
+
+/*
+ * Moves the median of one channel to its new place after pixels were added and
+ * removed. below counts the pixels under the median, rank is the place of the
+ * median in the sorted window.
+ */
+void medianHistogramAdjust(ushort* hist, int* median, int* below, int rank)
+{
+    int m = *median;
+    int b = *below;
+    if(b > rank)
+    {
+        do
+        {
+            m--;
+            b -= hist[m];
+        } while(b > rank);
+    }
+    else
+    {
+        while(b + hist[m] <= rank)
+        {
+            b += hist[m];
+            m++;
+        }
+    }
+    *median = m;
+    *below = b;
+}
+
+/*
+ * Median of any radius for CL_UNSIGNED_INT8 images. Every work-item slides a window
+ * down a strip of one column: per row it only adds the row that enters the window
+ * and removes the row that leaves it, which costs O(radius) instead of O(radius^2).
+ * The median follows the histogram in small steps, so it is not searched again.
+ * The strips split the rows evenly over the second dimension of the global size.
+ */
+__kernel void mediaanHistogramKernel(__read_only  image2d_t  srcImage,
+                          __write_only image2d_t  dstImage,
+                          const int radius)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                               CLK_ADDRESS_CLAMP_TO_EDGE  |
+                               CLK_FILTER_NEAREST;
+    int height = get_image_height(dstImage);
+    int strips = get_global_size(1);
+    int stripRows = (height + strips - 1) / strips;
+    int x = get_global_id(0);
+    int firstRow = get_global_id(1) * stripRows;
+    if(x >= get_image_width(dstImage) || firstRow >= height)
+        return; // padding of the global size
+    int lastRow = min(firstRow + stripRows, height);
+
+    ushort hist[3 * 256];
+    for(int i = 0; i < 3 * 256; i++)
+        hist[i] = 0;
+    int median[3] = {0, 0, 0};
+    int below[3] = {0, 0, 0};
+    int rank = (2 * radius + 1) * (2 * radius + 1) / 2;
+
+    for(int j = -radius; j <= radius; j++)
+    {
+        for(int i = -radius; i <= radius; i++)
+            medianHistogramUpdate(hist, median, below, read_imageui(srcImage,sampler,(int2)(x+i,firstRow+j)), 1);
+    }
+
+    for(int y = firstRow; y < lastRow; y++)
+    {
+        if(y > firstRow)
+        {
+            for(int i = -radius; i <= radius; i++)
+            {
+                medianHistogramUpdate(hist, median, below, read_imageui(srcImage,sampler,(int2)(x+i,y-radius-1)), -1);
+                medianHistogramUpdate(hist, median, below, read_imageui(srcImage,sampler,(int2)(x+i,y+radius)), 1);
+            }
+        }
+        for(int c = 0; c < 3; c++)
+            medianHistogramAdjust(hist + c * 256, median + c, below + c, rank);
+
+        write_imageui(dstImage,(int2)(x,y),(uint4)((uint)median[0], (uint)median[1], (uint)median[2], 255u));
+    }
+}
@@ -7,6 +7,8 @@ __kernel void saturatieKernel(__read_only  image2d_t  srcImage,
                                CLK_FILTER_NEAREST;
      int x = get_global_id(0);
      int y = get_global_id(1);
+     if(x >= get_image_width(dstImage) || y >= get_image_height(dstImage))
+         return; // padding of the global size
      int2 coords = (int2) (x,y);
 
     float4  currentPixel = (float4)0.0f;
@@ -27,4 +29,32 @@ __kernel void saturatieKernel(__read_only  image2d_t  srcImage,
 	currentPixel.z=P+((currentPixel.z)-P)*saturatie;
     
 	write_imagef(dstImage,coords,currentPixel);
-}
\ No newline at end of file
+}
+
+__kernel void saturatieU8Kernel(__read_only  image2d_t  srcImage,
+                          __write_only image2d_t  dstImage,
+                          const float saturatie)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                               CLK_ADDRESS_CLAMP_TO_EDGE  |
+                               CLK_FILTER_NEAREST;
+     int x = get_global_id(0);
+     int y = get_global_id(1);
+     if(x >= get_image_width(dstImage) || y >= get_image_height(dstImage))
+         return; // padding of the global size
+     int2 coords = (int2) (x,y);
+
+    // Integer variant for CL_UNSIGNED_INT8 images, the saturation is applied in 8.8 fixed point
+    int4 currentPixel = convert_int4(read_imageui(srcImage,sampler,coords));
+
+    // 0.299, 0.587 and 0.114 in thousandths
+    int comp = currentPixel.x*currentPixel.x*299+currentPixel.y*currentPixel.y*587+currentPixel.z*currentPixel.z*114;
+    int P = convert_int_rte(sqrt((float)comp * 0.001f));
+    int s = convert_int_rte(saturatie * 256.0f);
+
+    currentPixel.x = P+(((currentPixel.x-P)*s+128)>>8);
+    currentPixel.y = P+(((currentPixel.y-P)*s+128)>>8);
+    currentPixel.z = P+(((currentPixel.z-P)*s+128)>>8);
+
+    write_imageui(dstImage,coords,convert_uint4(clamp(currentPixel, 0, 255)));
+}
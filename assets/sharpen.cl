@@ -6,6 +6,8 @@ __kernel void sharpenKernel(__read_only  image2d_t  srcImage,
                                CLK_FILTER_NEAREST;   
     int x = get_global_id(0);
     int y = get_global_id(1);
+    if(x >= get_image_width(dstImage) || y >= get_image_height(dstImage))
+        return; // padding of the global size
 	int2 coords = (int2) (x,y);
 	int2 curCoords = (int2) (x,y);
 	int i = 0;
@@ -31,4 +33,29 @@ __kernel void sharpenKernel(__read_only  image2d_t  srcImage,
 			
 	write_imagef(dstImage,curCoords,curPix);
 
-}
\ No newline at end of file
+}
+
+__kernel void sharpenU8Kernel(__read_only  image2d_t  srcImage,
+                          __write_only image2d_t  dstImage)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                               CLK_ADDRESS_CLAMP_TO_EDGE  |
+                               CLK_FILTER_NEAREST;
+     int x = get_global_id(0);
+     int y = get_global_id(1);
+     if(x >= get_image_width(dstImage) || y >= get_image_height(dstImage))
+         return; // padding of the global size
+     int2 coords = (int2) (x,y);
+
+    // Integer variant for CL_UNSIGNED_INT8 images
+    int4 center = convert_int4(read_imageui(srcImage,sampler,coords));
+    int4 sum = 5 * center
+             - convert_int4(read_imageui(srcImage,sampler,(int2)(x-1,y)))
+             - convert_int4(read_imageui(srcImage,sampler,(int2)(x+1,y)))
+             - convert_int4(read_imageui(srcImage,sampler,(int2)(x,y-1)))
+             - convert_int4(read_imageui(srcImage,sampler,(int2)(x,y+1)));
+    uint4 curPix = convert_uint4(clamp(sum, 0, 255));
+    curPix.w = 255u;
+
+    write_imageui(dstImage,coords,curPix);
+}
@@ -12,7 +12,7 @@ LOCAL_CFLAGS    += -O3 -ffast-math
 
 LOCAL_C_INCLUDES := $(LOCAL_PATH)/../include
 
-LOCAL_SRC_FILES := OVSR.cpp
+LOCAL_SRC_FILES := OVSR.cpp ProgramCache.cpp MemoryPool.cpp HostTransfer.cpp VideoStream.cpp Profiling.cpp Tuner.cpp Devices.cpp Split.cpp Pipeline.cpp Batch.cpp Region.cpp Tiling.cpp Preview.cpp Resident.cpp KernelArgs.cpp IntegerPath.cpp Median.cpp
 
 LOCAL_LDLIBS 	:= -llog -ljnigraphics
 
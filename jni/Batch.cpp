@@ -0,0 +1,206 @@
+#include "OVSR.h"
+
+/*
+ * Runs one kernel, or one pipeline, over a list of images in a single call.
+ *
+ * The images are enqueued back to back with BATCH_SLOTS of them in flight. Like in
+ * the video stream, uploads and downloads go to their own queues and the kernels to
+ * the queue of the session, so the upload of the next image and the read back of
+ * the previous one overlap with the kernels of the current one. The host only waits
+ * when all slots are busy, for the oldest image. The images may differ in size, the
+ * device images come from the memory pool of the session.
+ */
+#define BATCH_SLOTS 3
+
+/*! The device images and completion event of one image in flight.
+ */
+struct BatchSlot
+{
+	BatchSlot() : inputImage(0), outputImage(0), tempImage(0), readEvent(0), item(0) {}
+
+	cl_mem inputImage;
+	cl_mem outputImage;
+	cl_mem tempImage;
+	cl_event readEvent; // completes when the result is in host memory
+	timeval submitted;
+	size_t item;        // index of the image in the batch
+};
+
+/*! \brief Returns the seconds between two gettimeofday timestamps.
+ */
+static double secondsBetween(const timeval& start, const timeval& end)
+{
+	return (end.tv_sec + end.tv_usec * 1e-6) - (start.tv_sec + start.tv_usec * 1e-6);
+}
+
+/*! \brief Returns the images of a slot to the memory pool and releases its event.
+ */
+static void clearBatchSlot(OpenCLSession& openCLSession, BatchSlot& slot)
+{
+	if(slot.readEvent)
+		clReleaseEvent(slot.readEvent);
+	slot.readEvent = 0;
+	returnToPool(openCLSession, slot.inputImage);
+	returnToPool(openCLSession, slot.outputImage);
+	returnToPool(openCLSession, slot.tempImage);
+	slot.inputImage = 0;
+	slot.outputImage = 0;
+	slot.tempImage = 0;
+}
+
+/*! \brief Waits for the image of a slot and records how long it took since it was submitted.
+ */
+static cl_int finishBatchSlot(OpenCLSession& openCLSession, BatchSlot& slot, std::vector<double>& itemSeconds)
+{
+	cl_int err = clWaitForEvents(1, &slot.readEvent);
+	timeval end;
+	gettimeofday(&end, NULL);
+	itemSeconds[slot.item] = secondsBetween(slot.submitted, end);
+	clearBatchSlot(openCLSession, slot);
+	return err;
+}
+
+/*! \brief Enqueues the upload, pipeline and read back of one image in a slot.
+ *
+ * @return The OpenCL error code.
+ */
+static cl_int enqueueBatchItem
+(
+		OpenCLSession& openCLSession,
+		std::vector<PipelineStage>& stages,
+		cl_command_queue uploadQueue,
+		cl_command_queue downloadQueue,
+		const HostImage& input,
+		const HostImage& output,
+		BatchSlot& slot
+)
+{
+	cl_int err = CL_SUCCESS;
+
+	cl_image_format image_format;
+	image_format.image_channel_data_type=CL_UNORM_INT8;
+	image_format.image_channel_order=CL_RGBA;
+
+	slot.inputImage = acquireImage2D(openCLSession, CL_MEM_READ_ONLY, image_format, input.width, input.height, 0, 0, &err);
+	if(err != CL_SUCCESS)
+		return err;
+	slot.outputImage = acquireImage2D(openCLSession, CL_MEM_READ_WRITE, image_format, input.width, input.height, 0, 0, &err);
+	if(err != CL_SUCCESS)
+		return err;
+	if(stages.size() > 1)
+	{
+		slot.tempImage = acquireImage2D(openCLSession, CL_MEM_READ_WRITE, image_format, input.width, input.height, 0, 0, &err);
+		if(err != CL_SUCCESS)
+			return err;
+	}
+
+	const size_t origin[3] = {0, 0, 0};
+	const size_t region[3] = {input.width, input.height, 1};
+	ScopedEvent writeEvent;
+	ScopedEvent kernelEvent;
+	err = clEnqueueWriteImage(uploadQueue, slot.inputImage, CL_FALSE,
+			origin, region, input.stride, 0, input.pixels, 0, 0, &writeEvent.event);
+	if(err != CL_SUCCESS)
+		return err;
+	// The kernels wait for the upload from another queue, which only starts once flushed.
+	clFlush(uploadQueue);
+
+	err = enqueuePipeline(openCLSession, stages, slot.inputImage, slot.outputImage, slot.tempImage,
+			input.width, input.height, writeEvent.event, true, 0, &kernelEvent.event);
+	if(err != CL_SUCCESS)
+		return err;
+	clFlush(openCLSession.queue);
+
+	err = clEnqueueReadImage(downloadQueue, slot.outputImage, CL_FALSE,
+			origin, region, output.stride, 0, output.pixels, 1, &kernelEvent.event, &slot.readEvent);
+	if(err != CL_SUCCESS)
+		return err;
+	return clFlush(downloadQueue);
+}
+
+	/*! \brief Runs a pipeline over a list of images, with several images in flight.
+	 *
+	 * All host images have to stay valid until the call returns. Every output has the
+	 * size of its input.
+	 *
+	 * @param openCLSession is the session that holds the kernels
+	 * @param stages are the stages, one stage for a single kernel
+	 * @param inputs describe the RGBA pixels that have to be processed
+	 * @param outputs describe the RGBA pixels that receive the results
+	 * @param itemSeconds receives for every image the seconds from its submission until its result was in host memory
+	 * @return The OpenCL error code.
+	 */
+cl_int executeBatch
+(
+		OpenCLSession& openCLSession,
+		std::vector<PipelineStage>& stages,
+		const std::vector<HostImage>& inputs,
+		const std::vector<HostImage>& outputs,
+		std::vector<double>& itemSeconds
+)
+{
+	itemSeconds.assign(inputs.size(), 0);
+	if(stages.empty() || inputs.size() != outputs.size())
+		return CL_INVALID_VALUE;
+
+	cl_int err = CL_SUCCESS;
+	cl_command_queue uploadQueue = clCreateCommandQueue(openCLSession.context, openCLSession.device, 0, &err);
+	if(err != CL_SUCCESS)
+		return err;
+	cl_command_queue downloadQueue = clCreateCommandQueue(openCLSession.context, openCLSession.device, 0, &err);
+	if(err != CL_SUCCESS)
+	{
+		clReleaseCommandQueue(uploadQueue);
+		return err;
+	}
+
+	BatchSlot slots[BATCH_SLOTS];
+	size_t inFlight = 0;
+	size_t next = 0; // slot of the next image
+	for(size_t i = 0; i < inputs.size() && err == CL_SUCCESS; i++)
+	{
+		if(inFlight == BATCH_SLOTS)
+		{
+			err = finishBatchSlot(openCLSession, slots[next], itemSeconds);
+			inFlight--;
+			if(err != CL_SUCCESS)
+				break;
+		}
+
+		BatchSlot& slot = slots[next];
+		slot.item = i;
+		gettimeofday(&slot.submitted, NULL);
+		err = enqueueBatchItem(openCLSession, stages, uploadQueue, downloadQueue, inputs[i], outputs[i], slot);
+		if(err != CL_SUCCESS)
+		{
+			LOGE("Cannot enqueue batch image %u: %s", (unsigned)i, opencl_error_to_str(err));
+			break;
+		}
+		next = (next + 1) % BATCH_SLOTS;
+		inFlight++;
+	}
+
+	// After an error the queues are finished before the host memory is given back.
+	if(err != CL_SUCCESS)
+	{
+		clFinish(uploadQueue);
+		clFinish(openCLSession.queue);
+		clFinish(downloadQueue);
+	}
+	// Starting at the next slot, the remaining images are waited for oldest first.
+	for(size_t n = 0; n < BATCH_SLOTS; n++)
+	{
+		BatchSlot& slot = slots[(next + n) % BATCH_SLOTS];
+		if(slot.readEvent)
+		{
+			cl_int finished = finishBatchSlot(openCLSession, slot, itemSeconds);
+			if(err == CL_SUCCESS)
+				err = finished;
+		}
+		clearBatchSlot(openCLSession, slot);
+	}
+
+	clReleaseCommandQueue(uploadQueue);
+	clReleaseCommandQueue(downloadQueue);
+	return err;
+}
@@ -0,0 +1,213 @@
+#include "OVSR.h"
+
+/*
+ * Device enumeration and device selection.
+ *
+ * All devices of all platforms are listed once with the properties that matter
+ * for the filters. For a fixed device type the device with the most compute
+ * units times clock frequency is used, instead of the first device of the first
+ * platform. In auto mode every device runs a kernel at least twice, the first run
+ * pays for building and tuning and is not counted. After that the kernel stays on
+ * the device with the highest measured throughput in pixels per second, which keeps
+ * being updated with every run.
+ */
+#define THROUGHPUT_WEIGHT 0.25 // weight of a new run in the running average
+
+struct DeviceThroughput
+{
+	DeviceThroughput() : runs(0), pixelsPerSecond(0) {}
+
+	int runs;
+	double pixelsPerSecond;
+};
+
+// kernel table key -> device index -> throughput, shared by all engines
+static std::map<std::string, std::map<int, DeviceThroughput> > kernelThroughput;
+static pthread_mutex_t kernelThroughputMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*! \brief Reads a string property of a platform or device.
+ */
+static std::string platformString(cl_platform_id platform, cl_platform_info param)
+{
+	char value[256] = "";
+	clGetPlatformInfo(platform, param, sizeof(value) - 1, value, 0);
+	return value;
+}
+
+static std::string deviceString(cl_device_id device, cl_device_info param)
+{
+	char value[256] = "";
+	clGetDeviceInfo(device, param, sizeof(value) - 1, value, 0);
+	return value;
+}
+
+	/*! \brief Lists every device of every OpenCL platform.
+	 *
+	 * Platforms or devices that can not be queried are skipped.
+	 *
+	 * @param devices receives the devices, in platform order
+	 */
+void enumerateOpenCLDevices(std::vector<OpenCLDeviceInfo>& devices)
+{
+	devices.clear();
+
+	cl_uint numPlatforms = 0;
+	cl_int err = clGetPlatformIDs(0, 0, &numPlatforms);
+	if(err != CL_SUCCESS || numPlatforms == 0)
+	{
+		LOGE("No OpenCL platforms found: %s", opencl_error_to_str(err));
+		return;
+	}
+	std::vector<cl_platform_id> platforms(numPlatforms);
+	err = clGetPlatformIDs(numPlatforms, &platforms[0], 0);
+	SAMPLE_CHECK_ERRORS(err);
+
+	for(cl_uint p = 0; p < numPlatforms; p++)
+	{
+		cl_uint numDevices = 0;
+		err = clGetDeviceIDs(platforms[p], CL_DEVICE_TYPE_ALL, 0, 0, &numDevices);
+		if(err != CL_SUCCESS || numDevices == 0)
+			continue;
+		std::vector<cl_device_id> ids(numDevices);
+		err = clGetDeviceIDs(platforms[p], CL_DEVICE_TYPE_ALL, numDevices, &ids[0], 0);
+		if(err != CL_SUCCESS)
+			continue;
+
+		std::string platformName = platformString(platforms[p], CL_PLATFORM_NAME);
+		for(cl_uint d = 0; d < numDevices; d++)
+		{
+			OpenCLDeviceInfo info;
+			cl_bool imageSupport = CL_FALSE;
+			info.platform = platforms[p];
+			info.device = ids[d];
+			info.platformName = platformName;
+			info.name = deviceString(ids[d], CL_DEVICE_NAME);
+			clGetDeviceInfo(ids[d], CL_DEVICE_TYPE, sizeof(info.type), &info.type, 0);
+			clGetDeviceInfo(ids[d], CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(info.computeUnits), &info.computeUnits, 0);
+			clGetDeviceInfo(ids[d], CL_DEVICE_MAX_CLOCK_FREQUENCY, sizeof(info.clockMHz), &info.clockMHz, 0);
+			clGetDeviceInfo(ids[d], CL_DEVICE_IMAGE_SUPPORT, sizeof(imageSupport), &imageSupport, 0);
+			clGetDeviceInfo(ids[d], CL_DEVICE_IMAGE2D_MAX_WIDTH, sizeof(info.image2DMaxWidth), &info.image2DMaxWidth, 0);
+			clGetDeviceInfo(ids[d], CL_DEVICE_IMAGE2D_MAX_HEIGHT, sizeof(info.image2DMaxHeight), &info.image2DMaxHeight, 0);
+			clGetDeviceInfo(ids[d], CL_DEVICE_LOCAL_MEM_SIZE, sizeof(info.localMemSize), &info.localMemSize, 0);
+			clGetDeviceInfo(ids[d], CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(info.globalMemSize), &info.globalMemSize, 0);
+			clGetDeviceInfo(ids[d], CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(info.maxMemAllocSize), &info.maxMemAllocSize, 0);
+			info.imageSupport = (imageSupport == CL_TRUE);
+			LOGD("OpenCL device %d: %s", (int)devices.size(), describeOpenCLDevice(info).c_str());
+			devices.push_back(info);
+		}
+	}
+}
+
+	/*! \brief Returns a one line description of a device for the console view.
+	 */
+std::string describeOpenCLDevice(const OpenCLDeviceInfo& info)
+{
+	std::ostringstream text;
+	if(info.type & CL_DEVICE_TYPE_GPU)
+		text << "GPU";
+	else if(info.type & CL_DEVICE_TYPE_CPU)
+		text << "CPU";
+	else
+		text << "Accelerator";
+	text << " " << info.name << " (" << info.platformName << "): "
+			<< info.computeUnits << " compute units at " << info.clockMHz << " MHz, ";
+	if(info.imageSupport)
+		text << "images up to " << info.image2DMaxWidth << "x" << info.image2DMaxHeight << ", ";
+	else
+		text << "no image support, ";
+	text << (info.localMemSize / 1024) << " KB local memory, "
+			<< (info.globalMemSize / (1024 * 1024)) << " MB global memory, "
+			<< (info.maxMemAllocSize / (1024 * 1024)) << " MB per allocation";
+	return text.str();
+}
+
+	/*! \brief Returns the most capable device of a type.
+	 *
+	 * Devices with image support go first, because the image2d_t filters need it.
+	 * Between those the product of compute units and clock frequency decides.
+	 *
+	 * @param devices is the device list of enumerateOpenCLDevices
+	 * @param type is CL_DEVICE_TYPE_GPU or CL_DEVICE_TYPE_CPU
+	 * @return The index of the device, or -1 when there is no usable device of the type.
+	 */
+int bestDeviceOfType(const std::vector<OpenCLDeviceInfo>& devices, cl_device_type type)
+{
+	int best = -1;
+	for(size_t i = 0; i < devices.size(); i++)
+	{
+		const OpenCLDeviceInfo& info = devices[i];
+		if(!(info.type & type) || info.failed)
+			continue;
+		if(best >= 0)
+		{
+			const OpenCLDeviceInfo& other = devices[best];
+			if(other.imageSupport && !info.imageSupport)
+				continue;
+			if(other.imageSupport == info.imageSupport &&
+					(cl_ulong)info.computeUnits * info.clockMHz <= (cl_ulong)other.computeUnits * other.clockMHz)
+				continue;
+		}
+		best = (int)i;
+	}
+	return best;
+}
+
+	/*! \brief Picks the device that runs a kernel in auto mode.
+	 *
+	 * @param kernelKey is the kernel table key of the kernel
+	 * @param candidates are the indices of the devices that can run it
+	 * @return A device without a counted run yet, otherwise the device with the
+	 * highest throughput, or -1 when there are no candidates.
+	 */
+int chooseAutoDevice(const std::string& kernelKey, const std::vector<int>& candidates)
+{
+	pthread_mutex_lock(&kernelThroughputMutex);
+	std::map<int, DeviceThroughput>& measured = kernelThroughput[kernelKey];
+
+	int best = -1;
+	double bestThroughput = 0;
+	for(size_t i = 0; i < candidates.size(); i++)
+	{
+		const DeviceThroughput& throughput = measured[candidates[i]];
+		if(throughput.runs < 2)
+		{
+			best = candidates[i];
+			break;
+		}
+		if(best < 0 || throughput.pixelsPerSecond > bestThroughput)
+		{
+			best = candidates[i];
+			bestThroughput = throughput.pixelsPerSecond;
+		}
+	}
+	pthread_mutex_unlock(&kernelThroughputMutex);
+	return best;
+}
+
+	/*! \brief Adds the time of one execution of the current kernel of a session to its throughput.
+	 *
+	 * @param openCLSession is the session that executed the kernel
+	 * @param pixels is the number of pixels the kernel processed
+	 * @param seconds is the wall-clock time of the execution, transfers included
+	 */
+void recordKernelThroughput(OpenCLSession& openCLSession, size_t pixels, double seconds)
+{
+	if(openCLSession.kernelKey.empty() || openCLSession.deviceIndex < 0 || seconds <= 0)
+		return;
+
+	pthread_mutex_lock(&kernelThroughputMutex);
+	DeviceThroughput& throughput = kernelThroughput[openCLSession.kernelKey][openCLSession.deviceIndex];
+	throughput.runs++;
+	// building and tuning of the first run are not counted
+	if(throughput.runs >= 2)
+	{
+		double pixelsPerSecond = pixels / seconds;
+		if(throughput.runs == 2)
+			throughput.pixelsPerSecond = pixelsPerSecond;
+		else
+			throughput.pixelsPerSecond += THROUGHPUT_WEIGHT * (pixelsPerSecond - throughput.pixelsPerSecond);
+		LOGD("%s on device %d: %.1f Mpixels/s", openCLSession.kernelKey.c_str(),
+				openCLSession.deviceIndex, throughput.pixelsPerSecond * 1e-6);
+	}
+	pthread_mutex_unlock(&kernelThroughputMutex);
+}
@@ -0,0 +1,440 @@
+#include "OVSR.h"
+
+/*
+ * Moves pixels between host memory and device images.
+ *
+ * In zero-copy mode the device works on host-visible memory. When the host pixels
+ * are aligned the way the device wants them, the image is created on top of them
+ * with CL_MEM_USE_HOST_PTR and results are exposed with clEnqueueMapImage, which
+ * costs no copy at all on unified-memory devices. Otherwise the image is allocated
+ * with CL_MEM_ALLOC_HOST_PTR and filled or read through a mapping.
+ *
+ * Buffers work the same way with clEnqueueMapBuffer.
+ *
+ * Without zero-copy, or when the driver can not share memory for a call, the images
+ * are plain device images and the pixels are copied with clEnqueueWriteImage/ReadImage.
+ *
+ * Transfers do not block the host. Each of them returns an event, uploads are waited
+ * for by the kernel and downloads wait for the kernel. The host only blocks where it
+ * has to copy through a mapping, or when it waits for the last event of a download.
+ */
+
+/*! \brief Returns the size of one pixel of an image format in bytes.
+ *
+ * @param format is the image format
+ * @return The pixel size, or 0 for formats that are not used by OVSR.
+ */
+static size_t pixelSize(const cl_image_format& format)
+{
+	size_t channels = 0;
+	switch(format.image_channel_order)
+	{
+	case CL_R:
+	case CL_A:
+		channels = 1;
+		break;
+	case CL_RG:
+		channels = 2;
+		break;
+	case CL_RGBA:
+	case CL_BGRA:
+		channels = 4;
+		break;
+	default:
+		return 0;
+	}
+
+	switch(format.image_channel_data_type)
+	{
+	case CL_UNORM_INT8:
+	case CL_UNSIGNED_INT8:
+	case CL_SIGNED_INT8:
+		return channels;
+	case CL_UNSIGNED_INT16:
+	case CL_HALF_FLOAT:
+		return channels * 2;
+	case CL_FLOAT:
+		return channels * 4;
+	default:
+		return 0;
+	}
+}
+
+/*! \brief Copies rows between two pitched pixel areas.
+ */
+void copyRows(void* dst, size_t dstPitch, const void* src, size_t srcPitch, size_t rowSize, size_t rows)
+{
+	unsigned char* d = (unsigned char*)dst;
+	const unsigned char* s = (const unsigned char*)src;
+	for(size_t y = 0; y < rows; y++)
+		memcpy(d + y * dstPitch, s + y * srcPitch, rowSize);
+}
+
+/*! \brief Tells if host memory can be wrapped with CL_MEM_USE_HOST_PTR without the driver copying it.
+ */
+static bool canUseHostPtr(OpenCLSession& openCLSession, const void* hostPtr)
+{
+	size_t alignment = openCLSession.hostPtrAlignment;
+	if(alignment == 0)
+		return false;
+	return ((size_t)hostPtr % alignment) == 0;
+}
+
+	/*! \brief Reads the zero-copy capabilities of the device of a session.
+	 *
+	 * Zero-copy is switched on by default when the device shares its memory with the host
+	 * (CL_DEVICE_HOST_UNIFIED_MEMORY).
+	 *
+	 * @param openCLSession is the session of the device
+	 */
+void initHostTransfer(OpenCLSession& openCLSession)
+{
+	cl_bool unifiedMemory = CL_FALSE;
+	cl_int err = clGetDeviceInfo(openCLSession.device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(unifiedMemory), &unifiedMemory, 0);
+	if(err != CL_SUCCESS)
+		unifiedMemory = CL_FALSE;
+
+	cl_uint alignBits = 0;
+	err = clGetDeviceInfo(openCLSession.device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(alignBits), &alignBits, 0);
+	if(err != CL_SUCCESS)
+		alignBits = 0;
+
+	openCLSession.zeroCopy = (unifiedMemory == CL_TRUE);
+	openCLSession.hostPtrAlignment = alignBits / 8;
+	LOGD("Unified memory: %d, host pointer alignment: %u bytes", unifiedMemory, (unsigned)openCLSession.hostPtrAlignment);
+}
+
+/*! \brief Unmaps a mapped memory object and returns the event of the unmap.
+ */
+static cl_int unmap(OpenCLSession& openCLSession, cl_mem memObject, void* mapped, cl_event mapEvent, cl_event* event_ret)
+{
+	return clEnqueueUnmapMemObject(openCLSession.queue, memObject, mapped, mapEvent ? 1 : 0, mapEvent ? &mapEvent : 0, event_ret);
+}
+
+/*! \brief Creates a zero-copy image for host pixels, or returns 0 when the driver can't share memory.
+ */
+static cl_mem acquireSharedImage
+(
+		OpenCLSession& openCLSession,
+		cl_mem_flags access,
+		const cl_image_format& format,
+		const HostImage& host,
+		bool upload,
+		cl_event* event_ret,
+		cl_int* errcode_ret
+)
+{
+	size_t rowSize = host.width * pixelSize(format);
+	const size_t origin[3] = {0, 0, 0};
+	const size_t region[3] = {host.width, host.height, 1};
+
+	if(canUseHostPtr(openCLSession, host.pixels) && host.stride >= rowSize)
+	{
+		cl_mem image = acquireImage2D(openCLSession, access | CL_MEM_USE_HOST_PTR, format,
+				host.width, host.height, host.pixels, host.stride, errcode_ret);
+		if(image)
+		{
+			// These images are never pooled, so this one is new and already holds the host pixels.
+			return image;
+		}
+	}
+
+	cl_mem image = acquireImage2D(openCLSession, access | CL_MEM_ALLOC_HOST_PTR, format,
+			host.width, host.height, 0, 0, errcode_ret);
+	if(!image)
+		return 0;
+	if(upload)
+	{
+		size_t rowPitch = 0;
+		void* mapped = clEnqueueMapImage(openCLSession.queue, image, CL_TRUE, CL_MAP_WRITE,
+				origin, region, &rowPitch, 0, 0, 0, 0, errcode_ret);
+		if(*errcode_ret != CL_SUCCESS)
+		{
+			returnToPool(openCLSession, image);
+			return 0;
+		}
+		copyRows(mapped, rowPitch, host.pixels, host.stride, rowSize, host.height);
+		*errcode_ret = unmap(openCLSession, image, mapped, 0, event_ret);
+		if(*errcode_ret != CL_SUCCESS)
+		{
+			returnToPool(openCLSession, image);
+			return 0;
+		}
+	}
+	return image;
+}
+
+	/*! \brief Checks out a device image for host pixels and optionally fills it with them.
+	 *
+	 * In zero-copy mode the image shares host-visible memory with the host, see the top of this file.
+	 * When the driver refuses, the pixels of this call are copied.
+	 * The host pixels have to stay valid until the upload event completed.
+	 *
+	 * @param openCLSession is the session that owns the memory pool
+	 * @param access is CL_MEM_READ_ONLY, CL_MEM_WRITE_ONLY or CL_MEM_READ_WRITE
+	 * @param format is the image format
+	 * @param host describes the host pixels
+	 * @param upload tells if the image has to hold the host pixels (true for inputs)
+	 * @param event_ret receives the event of the upload, or 0 when nothing was enqueued. May be 0 without upload.
+	 * @param errcode_ret receives the OpenCL error code
+	 * @return The image, or 0 on error. Return it with returnToPool.
+	 */
+cl_mem acquireHostImage
+(
+		OpenCLSession& openCLSession,
+		cl_mem_flags access,
+		const cl_image_format& format,
+		const HostImage& host,
+		bool upload,
+		cl_event* event_ret,
+		cl_int* errcode_ret
+)
+{
+	if(event_ret)
+		*event_ret = 0;
+	if(openCLSession.zeroCopy)
+	{
+		cl_mem image = acquireSharedImage(openCLSession, access, format, host, upload, event_ret, errcode_ret);
+		if(image)
+			return image;
+		LOGD("Zero-copy failed with %s, copying the pixels", opencl_error_to_str(*errcode_ret));
+	}
+
+	cl_mem image = acquireImage2D(openCLSession, access, format, host.width, host.height, 0, 0, errcode_ret);
+	if(!image || !upload)
+		return image;
+
+	const size_t origin[3] = {0, 0, 0};
+	const size_t region[3] = {host.width, host.height, 1};
+	*errcode_ret = clEnqueueWriteImage(
+			openCLSession.queue,
+			image,
+			false,
+			origin,
+			region,
+			host.stride,
+			0,
+			host.pixels,
+			0,
+			0,
+			event_ret);
+	if(*errcode_ret != CL_SUCCESS)
+	{
+		returnToPool(openCLSession, image);
+		return 0;
+	}
+	return image;
+}
+
+	/*! \brief Makes the content of a device image visible in host pixels.
+	 *
+	 * Shared images are mapped for reading. When the mapping is the host memory
+	 * itself nothing is copied, and the image stays mapped until it is returned to
+	 * the pool, because the pixels are only defined while it is mapped. Other images
+	 * are read with clEnqueueReadImage.
+	 * The host pixels are only valid after the returned event completed.
+	 *
+	 * @param openCLSession is the session that owns the image
+	 * @param image is an image checked out with acquireHostImage
+	 * @param host describes the host pixels, with the same size as the image
+	 * @param waitEvent is the event of the command that writes the image, or 0
+	 * @param event_ret receives the event that completes the download
+	 * @return The OpenCL error code.
+	 */
+cl_int downloadHostImage
+(
+		OpenCLSession& openCLSession,
+		cl_mem image,
+		const HostImage& host,
+		cl_event waitEvent,
+		cl_event* event_ret
+)
+{
+	const size_t origin[3] = {0, 0, 0};
+	const size_t region[3] = {host.width, host.height, 1};
+	cl_uint numWaitEvents = waitEvent ? 1 : 0;
+	cl_int err = CL_SUCCESS;
+	*event_ret = 0;
+
+	const MemoryPoolKey* key = findPoolKey(openCLSession, image);
+	if(key && (key->flags & (CL_MEM_USE_HOST_PTR | CL_MEM_ALLOC_HOST_PTR)))
+	{
+		cl_image_format format;
+		format.image_channel_order = key->order;
+		format.image_channel_data_type = key->type;
+
+		size_t rowPitch = 0;
+		ScopedEvent mapEvent;
+		void* mapped = clEnqueueMapImage(openCLSession.queue, image, CL_FALSE, CL_MAP_READ,
+				origin, region, &rowPitch, 0, numWaitEvents, numWaitEvents ? &waitEvent : 0, &mapEvent.event, &err);
+		if(err != CL_SUCCESS)
+			return err;
+		if(mapped == host.pixels)
+		{
+			openCLSession.memoryPool.hostMappings[image] = mapped;
+			*event_ret = mapEvent.event;
+			mapEvent.event = 0;
+			return CL_SUCCESS;
+		}
+		err = clWaitForEvents(1, &mapEvent.event);
+		if(err != CL_SUCCESS)
+			return err;
+		copyRows(host.pixels, host.stride, mapped, rowPitch, host.width * pixelSize(format), host.height);
+		return unmap(openCLSession, image, mapped, mapEvent.event, event_ret);
+	}
+
+	return clEnqueueReadImage(
+			openCLSession.queue,
+			image,
+			false,
+			origin,
+			region,
+			host.stride,
+			0,
+			host.pixels,
+			numWaitEvents,
+			numWaitEvents ? &waitEvent : 0,
+			event_ret);
+}
+
+/*! \brief Creates a zero-copy buffer for host bytes, or returns 0 when the driver can't share memory.
+ */
+static cl_mem acquireSharedBuffer
+(
+		OpenCLSession& openCLSession,
+		cl_mem_flags access,
+		void* hostPtr,
+		size_t size,
+		bool upload,
+		cl_event* event_ret,
+		cl_int* errcode_ret
+)
+{
+	if(canUseHostPtr(openCLSession, hostPtr))
+	{
+		// These buffers are never pooled, so this one is new and already holds the host bytes.
+		cl_mem buffer = acquireBuffer(openCLSession, access | CL_MEM_USE_HOST_PTR, size, hostPtr, errcode_ret);
+		if(buffer)
+			return buffer;
+	}
+
+	cl_mem buffer = acquireBuffer(openCLSession, access | CL_MEM_ALLOC_HOST_PTR, size, 0, errcode_ret);
+	if(!buffer || !upload)
+		return buffer;
+	void* mapped = clEnqueueMapBuffer(openCLSession.queue, buffer, CL_TRUE, CL_MAP_WRITE,
+			0, size, 0, 0, 0, errcode_ret);
+	if(*errcode_ret == CL_SUCCESS)
+	{
+		memcpy(mapped, hostPtr, size);
+		*errcode_ret = unmap(openCLSession, buffer, mapped, 0, event_ret);
+	}
+	if(*errcode_ret != CL_SUCCESS)
+	{
+		returnToPool(openCLSession, buffer);
+		return 0;
+	}
+	return buffer;
+}
+
+	/*! \brief Checks out a device buffer for host bytes and optionally fills it with them.
+	 *
+	 * Works like acquireHostImage. In zero-copy mode aligned host memory is wrapped with
+	 * CL_MEM_USE_HOST_PTR, other memory goes through a CL_MEM_ALLOC_HOST_PTR buffer.
+	 * The host bytes have to stay valid until the buffer is returned to the pool.
+	 *
+	 * @param openCLSession is the session that owns the memory pool
+	 * @param access is CL_MEM_READ_ONLY, CL_MEM_WRITE_ONLY or CL_MEM_READ_WRITE
+	 * @param hostPtr is the host memory
+	 * @param size is the size of the buffer in bytes
+	 * @param upload tells if the buffer has to hold the host bytes (true for inputs)
+	 * @param event_ret receives the event of the upload, or 0 when nothing was enqueued. May be 0 without upload.
+	 * @param errcode_ret receives the OpenCL error code
+	 * @return The buffer, or 0 on error. Return it with returnToPool.
+	 */
+cl_mem acquireHostBuffer
+(
+		OpenCLSession& openCLSession,
+		cl_mem_flags access,
+		void* hostPtr,
+		size_t size,
+		bool upload,
+		cl_event* event_ret,
+		cl_int* errcode_ret
+)
+{
+	if(event_ret)
+		*event_ret = 0;
+	if(openCLSession.zeroCopy)
+	{
+		cl_mem buffer = acquireSharedBuffer(openCLSession, access, hostPtr, size, upload, event_ret, errcode_ret);
+		if(buffer)
+			return buffer;
+		LOGD("Zero-copy failed with %s, copying the bytes", opencl_error_to_str(*errcode_ret));
+	}
+
+	cl_mem buffer = acquireBuffer(openCLSession, access, size, 0, errcode_ret);
+	if(!buffer || !upload)
+		return buffer;
+
+	*errcode_ret = clEnqueueWriteBuffer(openCLSession.queue, buffer, false, 0, size, hostPtr, 0, 0, event_ret);
+	if(*errcode_ret != CL_SUCCESS)
+	{
+		returnToPool(openCLSession, buffer);
+		return 0;
+	}
+	return buffer;
+}
+
+	/*! \brief Makes the content of a device buffer visible in host memory.
+	 *
+	 * Works like downloadHostImage: a buffer whose mapping is the host memory itself
+	 * stays mapped until it is returned to the pool, other shared buffers are copied
+	 * out of their mapping.
+	 *
+	 * @param openCLSession is the session that owns the buffer
+	 * @param buffer is a buffer checked out with acquireHostBuffer
+	 * @param hostPtr is the host memory
+	 * @param size is the size of the buffer in bytes
+	 * @param waitEvent is the event of the command that writes the buffer, or 0
+	 * @param event_ret receives the event that completes the download
+	 * @return The OpenCL error code.
+	 */
+cl_int downloadHostBuffer
+(
+		OpenCLSession& openCLSession,
+		cl_mem buffer,
+		void* hostPtr,
+		size_t size,
+		cl_event waitEvent,
+		cl_event* event_ret
+)
+{
+	cl_uint numWaitEvents = waitEvent ? 1 : 0;
+	*event_ret = 0;
+
+	const MemoryPoolKey* key = findPoolKey(openCLSession, buffer);
+	if(key && (key->flags & (CL_MEM_USE_HOST_PTR | CL_MEM_ALLOC_HOST_PTR)))
+	{
+		cl_int err = CL_SUCCESS;
+		ScopedEvent mapEvent;
+		void* mapped = clEnqueueMapBuffer(openCLSession.queue, buffer, CL_FALSE, CL_MAP_READ,
+				0, size, numWaitEvents, numWaitEvents ? &waitEvent : 0, &mapEvent.event, &err);
+		if(err != CL_SUCCESS)
+			return err;
+		if(mapped == hostPtr)
+		{
+			openCLSession.memoryPool.hostMappings[buffer] = mapped;
+			*event_ret = mapEvent.event;
+			mapEvent.event = 0;
+			return CL_SUCCESS;
+		}
+		err = clWaitForEvents(1, &mapEvent.event);
+		if(err != CL_SUCCESS)
+			return err;
+		memcpy(hostPtr, mapped, size);
+		return unmap(openCLSession, buffer, mapped, mapEvent.event, event_ret);
+	}
+
+	return clEnqueueReadBuffer(openCLSession.queue, buffer, false, 0, size, hostPtr,
+			numWaitEvents, numWaitEvents ? &waitEvent : 0, event_ret);
+}
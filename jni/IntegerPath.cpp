@@ -0,0 +1,131 @@
+#include "OVSR.h"
+
+/*
+ * uchar4 variants of the bundled filters.
+ *
+ * The bundled filters read CL_UNORM_INT8 images with read_imagef and compute in
+ * float4. Next to them the bundle holds integer variants, named with a "U8" suffix
+ * like blurU8Kernel, that read CL_UNSIGNED_INT8 images with read_imageui and use
+ * fixed-point arithmetic. They need fewer registers and no conversions to float,
+ * which is what limits the filters on Adreno and Mali. Both image formats have the
+ * same bytes, so a variant runs on the same host pixels as its filter and takes the
+ * same extra arguments. Whether it is faster depends on the device, so the first
+ * run of a filter on a session times both kernels on the input and the faster one
+ * is used for the rest of the session.
+ *
+ * Only executeImage2DKernel takes the integer path. The tiled, region, pipeline
+ * and video paths keep the float kernels.
+ */
+#define INTEGER_PATH_RUNS 3
+
+	/*! \brief Returns the uchar4 variant of the current kernel of a session, or 0 when it has none.
+	 *
+	 * Only the bundled filters have variants, code from the input field never has one.
+	 */
+cl_kernel integerVariant(OpenCLSession& openCLSession)
+{
+	if(!openCLSession.kernel || openCLSession.kernelKey.find(':') != std::string::npos)
+		return 0;
+	std::map<std::string, OpenCLKernelEntry>::iterator it = openCLSession.kernels.find(openCLSession.kernelKey);
+	if(it == openCLSession.kernels.end() || it->second.kernel != openCLSession.kernel)
+		return 0;
+	it = openCLSession.kernels.find(openCLSession.kernelKey + "U8");
+	return (it == openCLSession.kernels.end()) ? 0 : it->second.kernel;
+}
+
+/*! \brief Uploads an image in one format and returns the fastest of INTEGER_PATH_RUNS kernel runs on it.
+ *
+ * @return The time in seconds, or a negative value on an error.
+ */
+static double timeImageKernel
+(
+		OpenCLSession& openCLSession,
+		cl_kernel kernel,
+		cl_channel_type channelType,
+		const HostImage& input
+)
+{
+	cl_int err = CL_SUCCESS;
+	cl_image_format image_format;
+	image_format.image_channel_data_type=channelType;
+	image_format.image_channel_order=CL_RGBA;
+
+	PooledMemObject inputImage(openCLSession);
+	PooledMemObject outputImage(openCLSession);
+	inputImage.memObject =
+			acquireImage2D(openCLSession, CL_MEM_READ_ONLY, image_format, input.width, input.height, 0, 0, &err);
+	if(err != CL_SUCCESS)
+		return -1;
+	outputImage.memObject =
+			acquireImage2D(openCLSession, CL_MEM_WRITE_ONLY, image_format, input.width, input.height, 0, 0, &err);
+	if(err != CL_SUCCESS)
+		return -1;
+
+	const size_t origin[3] = {0, 0, 0};
+	const size_t region[3] = {input.width, input.height, 1};
+	err = clEnqueueWriteImage(openCLSession.queue, inputImage.memObject, CL_TRUE,
+			origin, region, input.stride, 0, input.pixels, 0, 0, 0);
+	if(err == CL_SUCCESS)
+		err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &inputImage.memObject);
+	if(err == CL_SUCCESS)
+		err = clSetKernelArg(kernel, 1, sizeof(cl_mem), &outputImage.memObject);
+	if(err != CL_SUCCESS)
+		return -1;
+
+	// Each kernel is timed with its own tuned local size.
+	size_t globalSize[2];
+	size_t localSize[2];
+	bool useLocalSize =
+			chooseWorkSize(openCLSession, kernel, input.width, input.height,
+					openCLSession.kernelBoundsChecked, globalSize, localSize);
+
+	double best = -1;
+	for(int run = 0; run <= INTEGER_PATH_RUNS; run++)
+	{
+		timeval start;
+		timeval end;
+		gettimeofday(&start, NULL);
+		err = clEnqueueNDRangeKernel(openCLSession.queue, kernel, 2, 0, globalSize,
+				useLocalSize ? localSize : 0, 0, 0, 0);
+		if(err == CL_SUCCESS)
+			err = clFinish(openCLSession.queue);
+		gettimeofday(&end, NULL);
+		if(err != CL_SUCCESS)
+			return -1;
+
+		// The first run warms up caches and lazy driver work and is not counted.
+		double seconds = (end.tv_sec + end.tv_usec * 1e-6) - (start.tv_sec + start.tv_usec * 1e-6);
+		if(run > 0 && (best < 0 || seconds < best))
+			best = seconds;
+	}
+	return best;
+}
+
+	/*! \brief Returns the uchar4 variant of the current kernel when it is the faster one on the device, or 0.
+	 *
+	 * The first call for a filter of a session times both kernels on the input, with the
+	 * extra arguments that are set, so they have to be set on both kernels before.
+	 * Later calls look the result up.
+	 *
+	 * @param openCLSession is the session that holds the kernel to be executed
+	 * @param input describes the RGBA pixels that are going to be processed
+	 * @return The kernel to run on CL_UNSIGNED_INT8 images, or 0 to run the current kernel on CL_UNORM_INT8 images.
+	 */
+cl_kernel chooseIntegerPath(OpenCLSession& openCLSession, const HostImage& input)
+{
+	cl_kernel variant = integerVariant(openCLSession);
+	if(!variant)
+		return 0;
+	std::map<std::string, bool>::iterator it = openCLSession.integerPathFaster.find(openCLSession.kernelKey);
+	if(it != openCLSession.integerPathFaster.end())
+		return it->second ? variant : 0;
+
+	double floatSeconds = timeImageKernel(openCLSession, openCLSession.kernel, CL_UNORM_INT8, input);
+	double integerSeconds = timeImageKernel(openCLSession, variant, CL_UNSIGNED_INT8, input);
+	bool faster = integerSeconds >= 0 && (floatSeconds < 0 || integerSeconds < floatSeconds);
+	openCLSession.integerPathFaster[openCLSession.kernelKey] = faster;
+
+	LOGD("%s: float %.2f ms, uchar4 %.2f ms, using the %s kernel", openCLSession.kernelKey.c_str(),
+			floatSeconds * 1e3, integerSeconds * 1e3, faster ? "uchar4" : "float");
+	return faster ? variant : 0;
+}
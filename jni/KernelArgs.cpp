@@ -0,0 +1,272 @@
+#include "OVSR.h"
+
+#include <cctype>
+
+/*
+ * Typed kernel arguments from argument 2 on, described by a KernelArgs object in Java.
+ *
+ * Every filter with parameters used to need its own native entry point, like
+ * nativeSaturatieImage2DOpenCL. Here the arguments come as a list of ints, floats and
+ * float arrays, so kernels from the input field can take parameters too. The list is
+ * checked against the kernel before it is set: the number of arguments comes from
+ * CL_KERNEL_NUM_ARGS and the types from the signature in the kernel source, because
+ * clGetKernelArgInfo needs OpenCL 1.2. Float arrays go to the device as read-only
+ * buffers for __constant or __global float* arguments. The buffers are cached in the
+ * session by their contents, so a convolution matrix is only uploaded the first time.
+ */
+#define CONSTANT_BUFFER_CACHE_SIZE 16 // float arrays kept per session, the cache is emptied when it is full
+
+/*! \brief Returns the kernel argument type of one parameter declaration, or -1 for other types.
+ *
+ * @param declaration is the parameter as written in the signature, like "__constant float* weights"
+ */
+static int parameterType(const std::string& declaration)
+{
+	std::vector<std::string> words;
+	bool pointer = false;
+	std::string word;
+	for(size_t i = 0; i <= declaration.size(); i++)
+	{
+		char c = (i < declaration.size()) ? declaration[i] : ' ';
+		if(isalnum((unsigned char)c) || c == '_')
+		{
+			word += c;
+			continue;
+		}
+		if(!word.empty())
+			words.push_back(word);
+		word.clear();
+		if(c == '*' || c == '[')
+			pointer = true;
+	}
+	// The last word is the parameter name.
+	if(words.size() < 2)
+		return -1;
+	words.pop_back();
+
+	/*
+	 * Int arguments are always set as 4 bytes, so narrower and wider integer
+	 * types like "unsigned char" or "long" are not accepted as KERNEL_ARG_INT.
+	 */
+	bool isFloat = false;
+	bool isInt = false;
+	bool otherSize = false;
+	for(size_t i = 0; i < words.size(); i++)
+	{
+		const std::string& w = words[i];
+		if(w == "float")
+			isFloat = true;
+		else if(w == "int" || w == "uint" || w == "unsigned")
+			isInt = true;
+		else if(w == "short" || w == "ushort" || w == "char" || w == "uchar" || w == "long" || w == "ulong" ||
+				w == "half" || w == "double" || w == "size_t")
+			otherSize = true;
+	}
+	if(otherSize)
+		return -1;
+	if(pointer)
+		return isFloat ? KERNEL_ARG_FLOAT_ARRAY : -1;
+	if(isFloat)
+		return KERNEL_ARG_FLOAT;
+	return isInt ? KERNEL_ARG_INT : -1;
+}
+
+	/*! \brief Finds the parameter types of a kernel function in its source.
+	 *
+	 * @param source is the OpenCL code that contains the kernel
+	 * @param function is the name of the kernel function
+	 * @param types receives one KERNEL_ARG_* type per parameter, -1 for images and other types
+	 * @return False when the signature is not found.
+	 */
+bool parseKernelSignature(const std::string& source, const std::string& function, std::vector<int>& types)
+{
+	types.clear();
+	for(size_t at = source.find(function); at != std::string::npos; at = source.find(function, at + 1))
+	{
+		if(at > 0 && (isalnum((unsigned char)source[at - 1]) || source[at - 1] == '_'))
+			continue;
+		size_t open = source.find_first_not_of(" \t\r\n", at + function.size());
+		if(open == std::string::npos || source[open] != '(')
+			continue;
+		// Only the definition follows "kernel void", calls of the function do not.
+		size_t kernelWord = source.rfind("kernel", at);
+		if(kernelWord == std::string::npos)
+			continue;
+		std::string between = source.substr(kernelWord + 6, at - kernelWord - 6);
+		if(between.find("void") == std::string::npos || between.find_first_of(";{}()") != std::string::npos)
+			continue;
+
+		size_t close = source.find(')', open);
+		if(close == std::string::npos)
+			return false;
+		std::string parameters = source.substr(open + 1, close - open - 1);
+		size_t start = 0;
+		while(start <= parameters.size())
+		{
+			size_t comma = parameters.find(',', start);
+			if(comma == std::string::npos)
+				comma = parameters.size();
+			std::string declaration = parameters.substr(start, comma - start);
+			if(declaration.find_first_not_of(" \t\r\n") != std::string::npos)
+				types.push_back(parameterType(declaration));
+			start = comma + 1;
+		}
+		return true;
+	}
+	return false;
+}
+
+	/*! \brief Checks a list of arguments against the current kernel of a session.
+	 *
+	 * @param openCLSession is the session that holds the kernel
+	 * @param args are the kernel arguments from argument 2 on
+	 * @param message receives the reason when the arguments do not fit
+	 * @return True when the arguments fit the kernel.
+	 */
+bool checkKernelArguments
+(
+		OpenCLSession& openCLSession,
+		const std::vector<KernelArgument>& args,
+		std::string& message
+)
+{
+	std::ostringstream reason;
+	cl_uint numArgs = 0;
+	cl_int err = clGetKernelInfo(openCLSession.kernel, CL_KERNEL_NUM_ARGS, sizeof(numArgs), &numArgs, 0);
+	if(err != CL_SUCCESS)
+	{
+		message = std::string("Cannot query the kernel arguments: ") + opencl_error_to_str(err);
+		return false;
+	}
+	if(numArgs != args.size() + 2)
+	{
+		reason << openCLSession.kernelKey << " takes " << numArgs << " arguments, "
+				<< args.size() << " after the two images were given";
+		message = reason.str();
+		return false;
+	}
+
+	size_t nameSize = 0;
+	err = clGetKernelInfo(openCLSession.kernel, CL_KERNEL_FUNCTION_NAME, 0, 0, &nameSize);
+	if(err != CL_SUCCESS || nameSize == 0)
+		return true;
+	std::vector<char> name(nameSize);
+	err = clGetKernelInfo(openCLSession.kernel, CL_KERNEL_FUNCTION_NAME, nameSize, &name[0], 0);
+	if(err != CL_SUCCESS)
+		return true;
+
+	std::map<std::string, OpenCLKernelEntry>::const_iterator it = openCLSession.kernels.find(openCLSession.kernelKey);
+	std::vector<int> types;
+	// Without the source only the number of arguments can be checked.
+	if(it == openCLSession.kernels.end() || !parseKernelSignature(it->second.source, &name[0], types) ||
+			types.size() != numArgs)
+		return true;
+
+	static const char* const typeNames[] = {"int", "float", "float array"};
+	for(size_t i = 0; i < args.size(); i++)
+	{
+		if(types[i + 2] != args[i].type)
+		{
+			reason << "Argument " << i + 2 << " of " << &name[0] << " is not ";
+			reason << (args[i].type >= 0 && args[i].type <= KERNEL_ARG_FLOAT_ARRAY ? typeNames[args[i].type] : "known");
+			message = reason.str();
+			return false;
+		}
+		if(args[i].type == KERNEL_ARG_FLOAT_ARRAY && args[i].floats.empty())
+		{
+			reason << "Argument " << i + 2 << " of " << &name[0] << " is an empty float array";
+			message = reason.str();
+			return false;
+		}
+	}
+	return true;
+}
+
+/*! \brief Returns the key of a float array in the buffer cache, its bytes.
+ */
+static std::string constantBufferKey(const std::vector<float>& values)
+{
+	return std::string((const char*)&values[0], values.size() * sizeof(float));
+}
+
+/*! \brief Returns a read-only buffer with a float array, from the cache of the session when possible.
+ */
+static cl_mem constantBuffer(OpenCLSession& openCLSession, const std::vector<float>& values, cl_int* errcode_ret)
+{
+	std::string key = constantBufferKey(values);
+	std::map<std::string, cl_mem>::iterator it = openCLSession.constantBuffers.find(key);
+	if(it != openCLSession.constantBuffers.end())
+	{
+		*errcode_ret = CL_SUCCESS;
+		return it->second;
+	}
+
+	cl_mem buffer = clCreateBuffer(openCLSession.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			values.size() * sizeof(float), (void*)&values[0], errcode_ret);
+	if(*errcode_ret != CL_SUCCESS)
+		return 0;
+	openCLSession.constantBuffers[key] = buffer;
+	return buffer;
+}
+
+	/*! \brief Sets a list of arguments from argument 2 on, check them with checkKernelArguments first.
+	 *
+	 * @param openCLSession is the session that owns the kernel and caches the float arrays
+	 * @param kernel is the kernel the arguments are set for
+	 * @param args are the kernel arguments from argument 2 on
+	 * @return The OpenCL error code.
+	 */
+cl_int setKernelArguments
+(
+		OpenCLSession& openCLSession,
+		cl_kernel kernel,
+		const std::vector<KernelArgument>& args
+)
+{
+	/*
+	 * The cache is emptied before the first argument is set, never in between,
+	 * so it can not release a buffer this list has just bound. Released buffers
+	 * stay alive until the kernels that were enqueued with them are done.
+	 */
+	size_t missing = 0;
+	for(size_t i = 0; i < args.size(); i++)
+	{
+		if(args[i].type == KERNEL_ARG_FLOAT_ARRAY && !args[i].floats.empty() &&
+				openCLSession.constantBuffers.find(constantBufferKey(args[i].floats)) == openCLSession.constantBuffers.end())
+			missing++;
+	}
+	if(missing > 0 && openCLSession.constantBuffers.size() + missing > CONSTANT_BUFFER_CACHE_SIZE)
+		releaseConstantBuffers(openCLSession);
+
+	cl_int err = CL_SUCCESS;
+	for(size_t i = 0; i < args.size() && err == CL_SUCCESS; i++)
+	{
+		const KernelArgument& arg = args[i];
+		if(arg.type == KERNEL_ARG_INT)
+			err = clSetKernelArg(kernel, 2 + i, sizeof(cl_int), &arg.intValue);
+		else if(arg.type == KERNEL_ARG_FLOAT)
+		{
+			cl_float value = arg.floatValue;
+			err = clSetKernelArg(kernel, 2 + i, sizeof(cl_float), &value);
+		}
+		else if(arg.type == KERNEL_ARG_FLOAT_ARRAY && !arg.floats.empty())
+		{
+			cl_mem buffer = constantBuffer(openCLSession, arg.floats, &err);
+			if(err == CL_SUCCESS)
+				err = clSetKernelArg(kernel, 2 + i, sizeof(cl_mem), &buffer);
+		}
+		else
+			err = CL_INVALID_ARG_VALUE;
+	}
+	return err;
+}
+
+	/*! \brief Releases the cached float array buffers of a session.
+	 */
+void releaseConstantBuffers(OpenCLSession& openCLSession)
+{
+	std::map<std::string, cl_mem>::iterator it;
+	for(it = openCLSession.constantBuffers.begin(); it != openCLSession.constantBuffers.end(); ++it)
+		clReleaseMemObject(it->second);
+	openCLSession.constantBuffers.clear();
+}
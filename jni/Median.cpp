@@ -0,0 +1,123 @@
+#include "OVSR.h"
+
+/*
+ * Median filters of any radius, see mediaan.cl.
+ *
+ * Radius 1 runs mediaan3, a median-of-9 sorting network, and radius 2 the mediaan
+ * filter, which uses forgetful selection on 14 pixels. Both run like the other
+ * bundled filters, with their uchar4 variants when those are faster. Larger radii
+ * run mediaanHistogram on CL_UNSIGNED_INT8 images. There every work-item slides a
+ * histogram window down a strip of MEDIAN_STRIP_ROWS rows of one column, so its
+ * global size has one work-item per column and strip instead of one per pixel.
+ */
+#define MEDIAN_STRIP_ROWS 32
+
+	/*! \brief Makes the bundled median kernel of a radius of 1 or 2 the current kernel of a session.
+	 *
+	 * @return False when the kernel is not in the kernel table.
+	 */
+bool selectMedianKernel(OpenCLSession& openCLSession, int radius)
+{
+	std::string key = (radius == 1) ? "mediaan3" : "mediaan";
+	std::map<std::string, OpenCLKernelEntry>::iterator it = openCLSession.kernels.find(key);
+	if(it == openCLSession.kernels.end())
+	{
+		LOGE("The median kernel %s is not in the kernel table, call initOpenCLSession first", key.c_str());
+		return false;
+	}
+	openCLSession.kernelKey = key;
+	openCLSession.kernel = it->second.kernel;
+	openCLSession.kernelBoundsChecked = it->second.boundsChecked;
+	return true;
+}
+
+	/*! \brief Runs the sliding histogram median of a radius on an image.
+	 *
+	 * Images beyond the device limits are not tiled, the halo of large radii would
+	 * take most of every tile.
+	 *
+	 * @param openCLSession is the session that holds the bundled filters
+	 * @param input describes the RGBA pixels that have to be processed
+	 * @param output describes the RGBA pixels that receive the result, with the size of input
+	 * @param radius is the radius of the square window, up to MEDIAN_MAX_RADIUS
+	 */
+void executeMedianHistogram
+(
+		OpenCLSession& openCLSession,
+		const HostImage& input,
+		const HostImage& output,
+		int radius
+)
+{
+	std::map<std::string, OpenCLKernelEntry>::iterator it = openCLSession.kernels.find("mediaanHistogram");
+	if(it == openCLSession.kernels.end())
+	{
+		LOGE("The median kernel mediaanHistogram is not in the kernel table, call initOpenCLSession first");
+		return;
+	}
+	if(needsTiling(openCLSession, input.width, input.height))
+	{
+		LOGE("The image is too large for the device, large median radii do not run in tiles");
+		return;
+	}
+	cl_kernel kernel = it->second.kernel;
+	cl_int medianRadius = radius;
+
+	timeval start;
+	gettimeofday(&start, NULL);
+
+	cl_int err = CL_SUCCESS;
+
+	cl_image_format image_format;
+	image_format.image_channel_data_type=CL_UNSIGNED_INT8;
+	image_format.image_channel_order=CL_RGBA;
+
+	PooledMemObject inputImage(openCLSession);
+	PooledMemObject outputImage(openCLSession);
+	PendingCommands pending(openCLSession.queue);
+	ScopedEvent writeEvent;
+	ScopedEvent kernelEvent;
+	ScopedEvent readEvent;
+
+	inputImage.memObject =
+			acquireHostImage(openCLSession, CL_MEM_READ_ONLY, image_format, input, true, &writeEvent.event, &err);
+	SAMPLE_CHECK_ERRORS(err);
+	outputImage.memObject =
+			acquireHostImage(openCLSession, CL_MEM_WRITE_ONLY, image_format, output, false, 0, &err);
+	SAMPLE_CHECK_ERRORS(err);
+
+	err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &inputImage.memObject);
+	SAMPLE_CHECK_ERRORS(err);
+	err = clSetKernelArg(kernel, 1, sizeof(cl_mem), &outputImage.memObject);
+	SAMPLE_CHECK_ERRORS(err);
+	err = clSetKernelArg(kernel, 2, sizeof(cl_int), &medianRadius);
+	SAMPLE_CHECK_ERRORS(err);
+
+	// The kernel splits the rows over the strips by the global size, the driver chooses the local size.
+	size_t globalSize[2] = {input.width, (input.height + MEDIAN_STRIP_ROWS - 1) / MEDIAN_STRIP_ROWS};
+	err = clEnqueueNDRangeKernel
+			(
+					openCLSession.queue,
+					kernel,
+					2,
+					0,
+					globalSize,
+					0,
+					writeEvent.event ? 1 : 0,
+					writeEvent.event ? &writeEvent.event : 0,
+					&kernelEvent.event
+			);
+	SAMPLE_CHECK_ERRORS(err);
+
+	err = downloadHostImage(openCLSession, outputImage.memObject, output, kernelEvent.event, &readEvent.event);
+	SAMPLE_CHECK_ERRORS(err);
+
+	err = clWaitForEvents(1, &readEvent.event);
+	SAMPLE_CHECK_ERRORS(err);
+	pending.done();
+
+	timeval end;
+	gettimeofday(&end, NULL);
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) * 1e-6;
+	recordExecutionProfile(openCLSession, writeEvent.event, kernelEvent.event, readEvent.event, seconds);
+}
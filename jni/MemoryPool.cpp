@@ -0,0 +1,257 @@
+#include "OVSR.h"
+
+/*
+ * Maximum number of unused memory objects a session keeps around.
+ * Video frames need one input and one output image, so a few sizes
+ * fit in the pool before unused objects of other sizes are released.
+ */
+#define MEMORY_POOL_MAX_FREE 8
+
+bool MemoryPoolKey::operator< (const MemoryPoolKey& other) const
+{
+	if(width != other.width)
+		return width < other.width;
+	if(height != other.height)
+		return height < other.height;
+	if(order != other.order)
+		return order < other.order;
+	if(type != other.type)
+		return type < other.type;
+	if(flags != other.flags)
+		return flags < other.flags;
+	if(hostPtr != other.hostPtr)
+		return hostPtr < other.hostPtr;
+	return rowPitch < other.rowPitch;
+}
+
+/*! \brief Takes a free memory object with the given key out of the pool.
+ *
+ * @param openCLSession is the session that owns the pool
+ * @param key describes the memory object
+ * @return The memory object, or 0 when the pool has no free object with this key.
+ */
+static cl_mem takeFromPool(OpenCLSession& openCLSession, const MemoryPoolKey& key)
+{
+	MemoryPool& pool = openCLSession.memoryPool;
+	std::multimap<MemoryPoolKey, cl_mem>::iterator it = pool.freeObjects.find(key);
+	if(it == pool.freeObjects.end())
+		return 0;
+
+	cl_mem memObject = it->second;
+	pool.freeObjects.erase(it);
+	pool.returnOrder.erase(memObject);
+	pool.checkedOut[memObject] = key;
+	return memObject;
+}
+
+/*! \brief Releases free memory objects until there is room for a new one.
+ *
+ * The objects that were returned the longest time ago go first, so the images a
+ * workload keeps using stay in the pool whatever their size.
+ *
+ * @param openCLSession is the session that owns the pool
+ * @param maxFree is the number of free objects that may be kept
+ */
+static void trimPool(OpenCLSession& openCLSession, size_t maxFree)
+{
+	MemoryPool& pool = openCLSession.memoryPool;
+	while(pool.freeObjects.size() > maxFree)
+	{
+		std::multimap<MemoryPoolKey, cl_mem>::iterator oldest = pool.freeObjects.begin();
+		std::multimap<MemoryPoolKey, cl_mem>::iterator it;
+		for(it = pool.freeObjects.begin(); it != pool.freeObjects.end(); ++it)
+		{
+			if(pool.returnOrder[it->second] < pool.returnOrder[oldest->second])
+				oldest = it;
+		}
+		clReleaseMemObject(oldest->second);
+		pool.returnOrder.erase(oldest->second);
+		pool.freeObjects.erase(oldest);
+	}
+}
+
+	/*! \brief Checks out a 2D image from the memory pool of the session.
+	 *
+	 * A free image with the same size, format and flags is reused.
+	 * Only when there is none a new image is created. When the device is out
+	 * of memory, the free images of other sizes are released and the creation is retried.
+	 * Images created with CL_MEM_USE_HOST_PTR are never reused, see returnToPool.
+	 *
+	 * @param openCLSession is the session that owns the pool
+	 * @param flags are the cl_mem_flags of the image
+	 * @param format is the image format
+	 * @param width is the width of the image in pixels
+	 * @param height is the height of the image in pixels
+	 * @param hostPtr is the host memory for CL_MEM_USE_HOST_PTR, 0 otherwise
+	 * @param rowPitch is the row pitch of hostPtr in bytes, 0 otherwise
+	 * @param errcode_ret receives the OpenCL error code
+	 * @return The image, or 0 on error.
+	 */
+cl_mem acquireImage2D
+(
+		OpenCLSession& openCLSession,
+		cl_mem_flags flags,
+		const cl_image_format& format,
+		size_t width,
+		size_t height,
+		void* hostPtr,
+		size_t rowPitch,
+		cl_int* errcode_ret
+)
+{
+	MemoryPoolKey key;
+	key.width = width;
+	key.height = height;
+	key.order = format.image_channel_order;
+	key.type = format.image_channel_data_type;
+	key.flags = flags;
+	key.hostPtr = hostPtr;
+	key.rowPitch = rowPitch;
+
+	cl_mem image = takeFromPool(openCLSession, key);
+	if(image)
+	{
+		*errcode_ret = CL_SUCCESS;
+		return image;
+	}
+
+	trimPool(openCLSession, MEMORY_POOL_MAX_FREE - 1);
+	image = clCreateImage2D(openCLSession.context, flags, &format, width, height, rowPitch, hostPtr, errcode_ret);
+	if(*errcode_ret == CL_MEM_OBJECT_ALLOCATION_FAILURE || *errcode_ret == CL_OUT_OF_RESOURCES)
+	{
+		trimPool(openCLSession, 0);
+		image = clCreateImage2D(openCLSession.context, flags, &format, width, height, rowPitch, hostPtr, errcode_ret);
+	}
+	if(*errcode_ret != CL_SUCCESS)
+		return 0;
+
+	openCLSession.memoryPool.checkedOut[image] = key;
+	return image;
+}
+
+	/*! \brief Checks out a buffer from the memory pool of the session.
+	 *
+	 * Works like acquireImage2D. Buffers are pooled with their size in bytes as width.
+	 *
+	 * @param openCLSession is the session that owns the pool
+	 * @param flags are the cl_mem_flags of the buffer
+	 * @param size is the size of the buffer in bytes
+	 * @param hostPtr is the host memory for CL_MEM_USE_HOST_PTR, 0 otherwise
+	 * @param errcode_ret receives the OpenCL error code
+	 * @return The buffer, or 0 on error.
+	 */
+cl_mem acquireBuffer
+(
+		OpenCLSession& openCLSession,
+		cl_mem_flags flags,
+		size_t size,
+		void* hostPtr,
+		cl_int* errcode_ret
+)
+{
+	MemoryPoolKey key;
+	key.width = size;
+	key.height = 0;
+	key.order = 0;
+	key.type = 0;
+	key.flags = flags;
+	key.hostPtr = hostPtr;
+	key.rowPitch = 0;
+
+	cl_mem buffer = takeFromPool(openCLSession, key);
+	if(buffer)
+	{
+		*errcode_ret = CL_SUCCESS;
+		return buffer;
+	}
+
+	trimPool(openCLSession, MEMORY_POOL_MAX_FREE - 1);
+	buffer = clCreateBuffer(openCLSession.context, flags, size, hostPtr, errcode_ret);
+	if(*errcode_ret == CL_MEM_OBJECT_ALLOCATION_FAILURE || *errcode_ret == CL_OUT_OF_RESOURCES)
+	{
+		trimPool(openCLSession, 0);
+		buffer = clCreateBuffer(openCLSession.context, flags, size, hostPtr, errcode_ret);
+	}
+	if(*errcode_ret != CL_SUCCESS)
+		return 0;
+
+	openCLSession.memoryPool.checkedOut[buffer] = key;
+	return buffer;
+}
+
+	/*! \brief Returns a memory object that was checked out with acquireImage2D or acquireBuffer.
+	 *
+	 * The object stays allocated on the device and is handed out again by the next
+	 * acquire call with the same key. Objects created with CL_MEM_USE_HOST_PTR are
+	 * released instead: their host memory, like the locked pixels of a bitmap, is only
+	 * valid during the call that created them. Images that downloadHostImage left
+	 * mapped are unmapped first. The caller must not use it anymore.
+	 *
+	 * @param openCLSession is the session that owns the pool
+	 * @param memObject is the memory object to be returned, 0 is ignored
+	 */
+void returnToPool(OpenCLSession& openCLSession, cl_mem memObject)
+{
+	if(!memObject)
+		return;
+
+	MemoryPool& pool = openCLSession.memoryPool;
+	std::map<cl_mem, MemoryPoolKey>::iterator it = pool.checkedOut.find(memObject);
+	if(it == pool.checkedOut.end())
+	{
+		LOGE("Memory object returned to a pool it does not belong to");
+		return;
+	}
+	std::map<cl_mem, void*>::iterator mapping = pool.hostMappings.find(memObject);
+	if(mapping != pool.hostMappings.end())
+	{
+		// The host is done with the pixels of the download, see downloadHostImage.
+		ScopedEvent unmapEvent;
+		if(clEnqueueUnmapMemObject(openCLSession.queue, memObject, mapping->second, 0, 0, &unmapEvent.event) == CL_SUCCESS)
+			clWaitForEvents(1, &unmapEvent.event);
+		pool.hostMappings.erase(mapping);
+	}
+	if(it->second.flags & CL_MEM_USE_HOST_PTR)
+		clReleaseMemObject(memObject);
+	else
+	{
+		pool.freeObjects.insert(std::make_pair(it->second, memObject));
+		pool.returnOrder[memObject] = ++pool.returns;
+	}
+	pool.checkedOut.erase(it);
+}
+
+PooledMemObject::~PooledMemObject()
+{
+	returnToPool(mSession, memObject);
+}
+
+	/*! \brief Returns the pool key of a checked out memory object.
+	 *
+	 * @param openCLSession is the session that owns the pool
+	 * @param memObject is a memory object that is checked out
+	 * @return The key, or 0 when the object is not checked out from this pool.
+	 */
+const MemoryPoolKey* findPoolKey(OpenCLSession& openCLSession, cl_mem memObject)
+{
+	std::map<cl_mem, MemoryPoolKey>::iterator it = openCLSession.memoryPool.checkedOut.find(memObject);
+	if(it == openCLSession.memoryPool.checkedOut.end())
+		return 0;
+	return &it->second;
+}
+
+	/*! \brief Releases all memory objects of the pool, also the ones that are still checked out.
+	 *
+	 * @param openCLSession is the session that owns the pool
+	 */
+void clearMemoryPool(OpenCLSession& openCLSession)
+{
+	MemoryPool& pool = openCLSession.memoryPool;
+	trimPool(openCLSession, 0);
+
+	std::map<cl_mem, MemoryPoolKey>::iterator it;
+	for(it = pool.checkedOut.begin(); it != pool.checkedOut.end(); ++it)
+		clReleaseMemObject(it->first);
+	pool.checkedOut.clear();
+	pool.hostMappings.clear();
+}
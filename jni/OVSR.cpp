@@ -1,59 +1,81 @@
-#define CL_USE_DEPRECATED_OPENCL_1_1_APIS
+#include "OVSR.h"
 
-#include <jni.h>
-#include <android/bitmap.h>
-#include <android/log.h>
-
-#include <string>
-#include <cstring>
-#include <sstream>
-#include <vector>
+#include <algorithm>
 
 /*
- * needed for loadProgram function
+ * The Java class, the callbacks the native code calls and the field with the engine
+ * handle, resolved once in JNI_OnLoad. FindClass from a native method of a worker
+ * thread does not see the application class loader, so the class is looked up while
+ * the library is loaded.
  */
-#include <iostream>
-#include <fstream>
-#include <cstdio>
-#include <cstdlib>
-
-#include <sys/time.h>
-
-#include <CL/opencl.h>
+static jclass openCLClass = 0;
+static jmethodID setTimeFromJNIMethod = 0;
+static jmethodID setConsoleOutputMethod = 0;
+static jmethodID setProfileFromJNIMethod = 0;
+static jfieldID engineField = 0;
+
+#define BATCH_CHUNK 64 // bitmaps nativeBatchOpenCL locks at the same time
+
+/*! Locks the engine of the Java object that called a native method for as long
+ * as the object is in scope. engine is 0 when the Java object has no engine.
+ * The native methods are synchronized in Java like closeOpenCL, so the engine
+ * can not be destroyed between reading the field and locking it.
+ */
+class EngineLock
+{
+public:
+	EngineLock(JNIEnv* env, jobject thisObject) :
+		engine((OpenCLEngine*)(intptr_t)env->GetLongField(thisObject, engineField))
+	{
+		if(engine)
+			pthread_mutex_lock(&engine->mutex);
+		else
+			LOGE("The OpenCL object has no native engine, it was closed or the library did not load");
+	}
+	~EngineLock()
+	{
+		if(engine)
+			pthread_mutex_unlock(&engine->mutex);
+	}
 
-#define BUILDOPT "-cl-single-precision-constant -cl-denorms-are-zero -cl-fast-relaxed-math"
-#define  LOG_TAG    "OpenCLnative"
-#define  LOGD(...)  __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
-#define  LOGE(...)  __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+	OpenCLEngine* engine;
 
-struct OpenCLObjects
-{
-	cl_platform_id platform;
-	cl_device_id device;
-	cl_context context;
-	cl_command_queue queue;
-	cl_program program;
-	cl_kernel kernel;
-	bool isInputBufferInitialized;
-	cl_mem inputBuffer;
-	cl_mem outputBuffer;
+private:
+	EngineLock(const EngineLock&);
+	EngineLock& operator= (const EngineLock&);
 };
 
-static OpenCLObjects openCLObjects;
-
-/*! /brief Reads the text from a file and returns it in a string.
- * @param input is the name and full path of the file that has to be read
- * @return It returns the text from a file in a string.
+/*! \brief Resolves the Java callbacks when System.loadLibrary loads the library.
+ *
+ * @param vm is the Java virtual machine
+ * @param reserved is not used
+ * @return The JNI version the library needs, or JNI_ERR when the callbacks or the engine field are not found.
  */
-inline std::string loadProgram(std::string input)
+extern "C" JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* vm, void* reserved)
 {
-	std::ifstream stream(input.c_str());
-	if (!stream.is_open()) {
-		LOGE("Cannot open input file\n");
-		exit(1);
+	JNIEnv* env = 0;
+	if(vm->GetEnv((void**)&env, JNI_VERSION_1_6) != JNI_OK)
+		return JNI_ERR;
+
+	jclass localClass = env->FindClass("com/denayer/ovsr/OpenCL");
+	if(!localClass)
+	{
+		LOGE("Class com/denayer/ovsr/OpenCL not found");
+		return JNI_ERR;
+	}
+	openCLClass = (jclass)env->NewGlobalRef(localClass);
+	env->DeleteLocalRef(localClass);
+
+	setTimeFromJNIMethod = env->GetMethodID(openCLClass, "setTimeFromJNI", "(F)V"); //argument is float, return time is void
+	setConsoleOutputMethod = env->GetMethodID(openCLClass, "setConsoleOutput", "(Ljava/lang/String;)V");
+	setProfileFromJNIMethod = env->GetMethodID(openCLClass, "setProfileFromJNI", "(FFFF)V");
+	engineField = env->GetFieldID(openCLClass, "engine", "J");
+	if(!setTimeFromJNIMethod || !setConsoleOutputMethod || !setProfileFromJNIMethod || !engineField)
+	{
+		LOGE("Callbacks or engine field of com/denayer/ovsr/OpenCL not found");
+		return JNI_ERR;
 	}
-	return std::string( std::istreambuf_iterator<char>(stream),
-			(std::istreambuf_iterator<char>()));
+	return JNI_VERSION_1_6;
 }
 
 /*! This function helps to create informative messages in
@@ -128,638 +150,875 @@ const char* opencl_error_to_str (cl_int error)
 }
 
 
-/*! The following macro is used after each OpenCL call
- * to check if OpenCL error occurs. In the case when ERR != CL_SUCCESS
- * the macro forms an error message with OpenCL error code mnemonic,
- * puts it to LogCat, and returns from a caller function.
- */
-#define SAMPLE_CHECK_ERRORS(ERR)                                                      \
-		if(ERR != CL_SUCCESS)                                                             \
-		{                                                                                 \
-			LOGE                                                                          \
-			(                                                                             \
-					"OpenCL error with code %s happened in file %s at line %d. Exiting.\n",   \
-					opencl_error_to_str(ERR), __FILE__, __LINE__                              \
-			);                                                                            \
-			\
-			return;                                                                       \
-		}
-
-	/*! \brief This function picks and creates all necessary OpenCL objects
-	 * to be used at each filter iteration. 
+	/*! \brief This function creates the OpenCL objects that live
+	 * as long as the session: context and command queue.
 	 *
-	 * The objects are:
-	 * OpenCL platform, device, context, command queue, program,
-	 * and kernel.
+	 * The session is created once per device. Programs and kernels are
+	 * added to it later by initOpenCLSession and initOpenCLFromInput.
 	 *
-	 * @param env is a pointer to the java environment where this function is called.
-	 * @param thisObject is a java object to be able to access java data from the native code
-	 * @param kernelName is a java string that contains the kernel for which the OpenCL code must be initialised
-	 * @param required_device_type is a OpenCL datatype that holds the type of device the context has to be build for.
-	 * @param openCLObjects is the adres of the openCLObjects struct
+	 * @param engine is the engine the session belongs to, for its zero-copy and profiling settings
+	 * @param info is the device the context has to be build for, from enumerateOpenCLDevices.
+	 * @param openCLSession is the session that has to be filled in
 	 */
-void initOpenCL
+void initOpenCLSession
 (
-		JNIEnv* env,
-		jobject thisObject,
-		jstring kernelName,
-		cl_device_type required_device_type,
-		OpenCLObjects& openCLObjects
+		const OpenCLEngine& engine,
+		const OpenCLDeviceInfo& info,
+		OpenCLSession& openCLSession
 )
 {
-
-	using namespace std;
-
-
-	openCLObjects.isInputBufferInitialized = false;
-
 	cl_int err = CL_SUCCESS;
 
-	/* 
-	 * Step 1: Get the first platform
+	/*
+	 * Step 1: Take the platform and device from the device list.
 	 */
-	cl_platform_id platform;
-	err = clGetPlatformIDs(1, &platform, NULL);
-	SAMPLE_CHECK_ERRORS(err);
+	openCLSession.deviceType = info.type;
+	openCLSession.platform = info.platform;
+	openCLSession.device = info.device;
+	openCLSession.image2DMaxWidth = info.image2DMaxWidth;
+	openCLSession.image2DMaxHeight = info.image2DMaxHeight;
+	openCLSession.maxMemAllocSize = info.maxMemAllocSize;
 
-	cl_uint i = 0;
-	size_t platform_name_length = 0;
-	err = clGetPlatformInfo(
-			platform,
-			CL_PLATFORM_NAME,
-			0,
-			0,
-			&platform_name_length
-	);
-	SAMPLE_CHECK_ERRORS(err);
-
-	openCLObjects.platform = platform;
-	/* 
-	 * Step 2: Create context with a device of the specified type (required_device_type).
+	/*
+	 * Step 2: Create context with only this device.
 	 */
-
 	cl_context_properties context_props[] = {
 			CL_CONTEXT_PLATFORM,
-			cl_context_properties(openCLObjects.platform),
+			cl_context_properties(openCLSession.platform),
 			0
 	};
 
-	openCLObjects.context =
-			clCreateContextFromType
+	openCLSession.context =
+			clCreateContext
 			(
 					context_props,
-					required_device_type,
+					1,
+					&openCLSession.device,
 					0,
 					0,
 					&err
 			);
 	SAMPLE_CHECK_ERRORS(err);
-	/* 
-	 * Step 3: Query for OpenCL device that was used for context creation.
-	 */
-	err = clGetContextInfo
-			(
-					openCLObjects.context,
-					CL_CONTEXT_DEVICES,
-					sizeof(openCLObjects.device),
-					&openCLObjects.device,
-					0
-			);
-	SAMPLE_CHECK_ERRORS(err);
 
-	/*  
-	 * Step 4: Create OpenCL program from its source code.
-	 * The file name is passed by java.
-	 * Convert the jstring to const char* and append the needed directory path.
-	 */
-	const char* fileName = env->GetStringUTFChars(kernelName, 0);
-	std::string fileDir;
-	fileDir.append("/data/data/com.denayer.ovsr/app_execdir/");
-	fileDir.append(fileName);
-	fileDir.append(".cl");
-	std::string kernelSource = loadProgram(fileDir);
-	const char* kernelSourceChar = kernelSource.c_str();
-
-	openCLObjects.program =
-			clCreateProgramWithSource
-			(
-					openCLObjects.context,
-					1,
-					&kernelSourceChar,
-					0,
-					&err
-			);
+	initHostTransfer(openCLSession);
+	if(engine.zeroCopyOverride >= 0)
+		openCLSession.zeroCopy = (engine.zeroCopyOverride == 1);
 
+	/*
+	 * Step 3: Create command queue, with CL_QUEUE_PROFILING_ENABLE in profiling mode.
+	 */
+	err = setSessionProfiling(openCLSession, engine.profilingEnabled);
 	SAMPLE_CHECK_ERRORS(err);
+}
 
-	/*
-	 * Build the program with defined BUILDOPT (build optimalisations).
+	/*! \brief Releases every OpenCL object owned by a session and deletes the session.
+	 *
+	 * You can call this in the middle of your application execution
+	 * (not at the end) if you don't need the OpenCL runtime any more,
+	 * for example to free memory or to recreate the session with different parameters.
+	 * Objects that were never created (because initialisation stopped on an error) are skipped.
+	 *
+	 * @param openCLSession is the session to be released
 	 */
-	err = clBuildProgram(openCLObjects.program, 0, 0, BUILDOPT, 0, 0);
-	jstring JavaString = (*env).NewStringUTF("Code compiled succesful.");
-	if(err == CL_BUILD_PROGRAM_FAILURE)
-	{
-		size_t log_length = 0;
-		err = clGetProgramBuildInfo(
-				openCLObjects.program,
-				openCLObjects.device,
-				CL_PROGRAM_BUILD_LOG,
-				0,
-				0,
-				&log_length
-		);
-		SAMPLE_CHECK_ERRORS(err);
+void releaseOpenCLSession (OpenCLSession* openCLSession)
+{
+	clearMemoryPool(*openCLSession);
+	releaseConstantBuffers(*openCLSession);
 
-		vector<char> log(log_length);
+	std::map<std::string, OpenCLKernelEntry>::iterator it;
+	for(it = openCLSession->kernels.begin(); it != openCLSession->kernels.end(); ++it)
+	{
+		clReleaseKernel(it->second.kernel);
+		clReleaseProgram(it->second.program);
+	}
+	openCLSession->kernels.clear();
 
-		err = clGetProgramBuildInfo(
-				openCLObjects.program,
-				openCLObjects.device,
-				CL_PROGRAM_BUILD_LOG,
-				log_length,
-				&log[0],
-				0
-		);
-		SAMPLE_CHECK_ERRORS(err);
+	if(openCLSession->queue)
+		clReleaseCommandQueue(openCLSession->queue);
+	if(openCLSession->context)
+		clReleaseContext(openCLSession->context);
 
-		LOGE
-		(
-				"Error happened during the build of OpenCL program.\nBuild log: %s",
-				&log[0]
-		);
-		/*
-		 * sends the error log to the console text edit.
-		 */
-		std::string str(log.begin(),log.end());
-		const char * c = str.c_str();
-		JavaString = (*env).NewStringUTF(c);
-		jclass MyJavaClass = (*env).FindClass("com/denayer/ovsr/OpenCL");
-		if (!MyJavaClass){
-			LOGD("METHOD NOT FOUND");
-			return;} /* method not found */
-		jmethodID setConsoleOutput = (*env).GetMethodID(MyJavaClass, "setConsoleOutput", "(Ljava/lang/String;)V");
-		(*env).CallVoidMethod(thisObject, setConsoleOutput, JavaString);
-		return;
-	}
-	/* 
-	 * Step 6: Extract kernel from the built program.
+	/* There is no procedure to deallocate OpenCL devices or
+	 * platforms as both are not created at the startup,
+	 * but queried from the OpenCL runtime.
 	 */
-	fileName = env->GetStringUTFChars(kernelName, 0);
-	char result[100];   // array to hold the result.
-	std::strcpy(result,fileName); // copy string one into the result.
-	std::strcat(result,"Kernel"); // append string two to the result.
-	openCLObjects.kernel = clCreateKernel(openCLObjects.program, result, &err);
-	SAMPLE_CHECK_ERRORS(err);
+	delete openCLSession;
+}
 
-	/* 
-	 * Step 7: Create command queue.
+	/*! \brief Lists the OpenCL devices the first time it is called for an engine.
+	 *
+	 * @param engine is the engine that keeps the list
+	 * @return The device list, which is empty when there is no OpenCL device.
 	 */
-
-	openCLObjects.queue =
-			clCreateCommandQueue
-			(
-					openCLObjects.context,
-					openCLObjects.device,
-					0,     
-					&err
-			);
-	SAMPLE_CHECK_ERRORS(err);
-
+static std::vector<OpenCLDeviceInfo>& listOpenCLDevices(OpenCLEngine& engine)
+{
+	if(!engine.devicesListed)
+	{
+		enumerateOpenCLDevices(engine.devices);
+		engine.sessions.assign(engine.devices.size(), (OpenCLSession*)0);
+		engine.devicesListed = true;
+	}
+	return engine.devices;
 }
 
-	/*! \brief This function enables the connection between initOpenCL and Java. 
-	 * 
-	 * @param env is a pointer to the java environment where this function is called.
-	 * @param thisObject is a java object to be able to access java data from the native code
-	 * @param kernelName is a java string that contains the kernel for which the OpenCL code must be initialised
+	/*! \brief Returns the session of a device and creates it on first use.
+	 *
+	 * @param engine is the engine that owns the session
+	 * @param index is the index of the device in the device list
+	 * @return The session, or 0 when the OpenCL objects could not be created.
 	 */
-extern "C" void Java_com_denayer_ovsr_OpenCL_initOpenCL
-(
-		JNIEnv* env,
-		jobject thisObject,
-		jstring kernelName,
-		int dev_type
-)
+OpenCLSession* getDeviceSession (OpenCLEngine& engine, int index)
 {
-	if(dev_type==1)
+	std::vector<OpenCLDeviceInfo>& devices = listOpenCLDevices(engine);
+	if(index < 0 || index >= (int)devices.size() || devices[index].failed)
+		return 0;
+	if(engine.sessions[index])
+		return engine.sessions[index];
+
+	LOGD("Creating OpenCL session on %s", devices[index].name.c_str());
+
+	OpenCLSession* openCLSession = new OpenCLSession();
+	openCLSession->deviceIndex = index;
+	initOpenCLSession(engine, devices[index], *openCLSession);
+	if(!openCLSession->queue)
 	{
-		LOGD("On CPU");
-		initOpenCL
-		(
-				env,
-				thisObject,
-				kernelName,
-				CL_DEVICE_TYPE_CPU,
-				openCLObjects
-		);
+		releaseOpenCLSession(openCLSession);
+		devices[index].failed = true; // auto mode should not pick it again
+		return 0;
 	}
+	engine.sessions[index] = openCLSession;
+	return openCLSession;
+}
+
+	/*! \brief Returns the devices auto mode chooses from: the best device of each type.
+	 */
+static std::vector<int> autoDevices(OpenCLEngine& engine)
+{
+	std::vector<OpenCLDeviceInfo>& devices = listOpenCLDevices(engine);
+	std::vector<int> candidates;
+	int gpu = bestDeviceOfType(devices, CL_DEVICE_TYPE_GPU);
+	int cpu = bestDeviceOfType(devices, CL_DEVICE_TYPE_CPU);
+	if(gpu >= 0)
+		candidates.push_back(gpu);
+	if(cpu >= 0)
+		candidates.push_back(cpu);
+	return candidates;
+}
+
+	/*! \brief Returns the session for a device type and creates it on first use.
+	 *
+	 * @param engine is the engine that owns the session
+	 * @param dev_type is the device type selected in Java: 1 is CPU, everything else is GPU.
+	 * In auto mode it is the session of the device that runs the kernel fastest.
+	 * In split mode it is the GPU session, which runs the first band.
+	 * @param kernelKey is the kernel table key of the kernel that is going to run, only used in auto mode
+	 * @return The session, or 0 when the OpenCL objects could not be created.
+	 */
+OpenCLSession* getOpenCLSession (OpenCLEngine& engine, int dev_type, const std::string& kernelKey)
+{
+	std::vector<OpenCLDeviceInfo>& devices = listOpenCLDevices(engine);
+	int index;
+	if(dev_type == DEV_TYPE_AUTO)
+		index = chooseAutoDevice(kernelKey, autoDevices(engine));
 	else
+		index = bestDeviceOfType(devices, dev_type == DEV_TYPE_CPU ? CL_DEVICE_TYPE_CPU : CL_DEVICE_TYPE_GPU);
+	if(index < 0)
 	{
-		LOGD("On GPU");
-		initOpenCL
-		(
-				env,
-				thisObject,
-				kernelName,
-				CL_DEVICE_TYPE_GPU,
-				openCLObjects
-		);
+		LOGE("No OpenCL device found for device type %d", dev_type);
+		return 0;
 	}
-
+	return getDeviceSession(engine, index);
 }
-	/*! \brief This function prepares OpenCL to compile code from a Java string.
+
+	/*! \brief Sends the build log of a program that failed to build to the console view in Java.
 	 *
-	 * It picks and creates all necessary OpenCL objects
-	 * to be used at each filter iteration. The objects are:
-	 * OpenCL platform, device, context, command queue, program,
-	 * and kernel.
-	 * 
 	 * @param env is a pointer to the java environment where this function is called.
 	 * @param thisObject is a java object to be able to access java data from the native code
-	 * @param kernelCode is the OpenCL code to be compiled
-	 * @param kernelName is a java string that contains the kernel for which the OpenCL code must be initialised
-	 * @param required_device_type is a OpenCL datatype that holds the type of device the context has to be build for.
-	 * @param openCLObjects is the adres of the openCLObjects struct
+	 * @param openCLSession is the session the program was build for
+	 * @param program is the program that failed to build
 	 */
-void initOpenCLFromInput
+void reportBuildFailure
 (
 		JNIEnv* env,
 		jobject thisObject,
-		jstring kernelCode,
-		jstring kernelName,
-		cl_device_type required_device_type,
-		OpenCLObjects& openCLObjects
+		OpenCLSession& openCLSession,
+		cl_program program
 )
 {
 	using namespace std;
 
-	openCLObjects.isInputBufferInitialized = false;
-	cl_int err = CL_SUCCESS;
-
-	cl_platform_id platform;
-	err = clGetPlatformIDs(1, &platform, NULL);
-	SAMPLE_CHECK_ERRORS(err);
-
-	cl_uint i = 0;
-	size_t platform_name_length = 0;
-	err = clGetPlatformInfo(
-			platform,
-			CL_PLATFORM_NAME,
+	size_t log_length = 0;
+	cl_int err = clGetProgramBuildInfo(
+			program,
+			openCLSession.device,
+			CL_PROGRAM_BUILD_LOG,
 			0,
 			0,
-			&platform_name_length
+			&log_length
 	);
 	SAMPLE_CHECK_ERRORS(err);
 
-	openCLObjects.platform = platform;
+	vector<char> log(log_length);
 
-	cl_context_properties context_props[] = {
-			CL_CONTEXT_PLATFORM,
-			cl_context_properties(openCLObjects.platform),
+	err = clGetProgramBuildInfo(
+			program,
+			openCLSession.device,
+			CL_PROGRAM_BUILD_LOG,
+			log_length,
+			&log[0],
 			0
-	};
-
-	openCLObjects.context =
-			clCreateContextFromType
-			(
-					context_props,
-					required_device_type,
-					0,
-					0,
-					&err
-			);
-	SAMPLE_CHECK_ERRORS(err);
-
-	err = clGetContextInfo
-			(
-					openCLObjects.context,
-					CL_CONTEXT_DEVICES,
-					sizeof(openCLObjects.device),
-					&openCLObjects.device,
-					0
-			);
+	);
 	SAMPLE_CHECK_ERRORS(err);
 
-	const char* fileName = env->GetStringUTFChars(kernelCode, 0);
-
-	openCLObjects.program =
-			clCreateProgramWithSource
-			(
-					openCLObjects.context,
-					1,
-					&fileName,
-					0,
-					&err
-			);
+	LOGE
+	(
+			"Error happened during the build of OpenCL program.\nBuild log: %s",
+			&log[0]
+	);
+	/*
+	 * sends the error log to the console text edit.
+	 */
+	std::string str(log.begin(),log.end());
+	jstring JavaString = (*env).NewStringUTF(str.c_str());
+	(*env).CallVoidMethod(thisObject, setConsoleOutputMethod, JavaString);
+	(*env).DeleteLocalRef(JavaString);
+}
 
-	SAMPLE_CHECK_ERRORS(err);
+	/*! \brief Builds a program and extracts one kernel from it.
+	 *
+	 * When the build fails, the build log is sent to the console view in Java.
+	 * On success the program and kernel are stored in the kernel table of the
+	 * session under the given key and the kernel becomes the session's current kernel.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param openCLSession is the session the kernel is build for
+	 * @param key is the name under which the kernel is stored in the kernel table
+	 * @param source is the OpenCL code to be compiled
+	 * @param kernelFunction is the name of the __kernel function in the source
+	 */
+void buildKernel
+(
+		JNIEnv* env,
+		jobject thisObject,
+		OpenCLSession& openCLSession,
+		const std::string& key,
+		const std::string& source,
+		const std::string& kernelFunction
+)
+{
+	cl_int err = CL_SUCCESS;
+	openCLSession.kernel = 0;
 
-	err = clBuildProgram(openCLObjects.program, 0, 0, BUILDOPT, 0, 0);
-	jstring JavaString = (*env).NewStringUTF("Code compiled succesful.");
+	/*
+	 * Build the program with defined BUILDOPT (build optimalisations),
+	 * or load it from the program cache when it was build before.
+	 */
+	OpenCLKernelEntry entry;
+	entry.source = source;
+	entry.boundsChecked = false;
+	entry.program = buildProgramWithCache(openCLSession, source, &err);
 	if(err == CL_BUILD_PROGRAM_FAILURE)
 	{
-		size_t log_length = 0;
-		err = clGetProgramBuildInfo(
-				openCLObjects.program,
-				openCLObjects.device,
-				CL_PROGRAM_BUILD_LOG,
-				0,
-				0,
-				&log_length
-		);
-		SAMPLE_CHECK_ERRORS(err);
-
-		vector<char> log(log_length);
-
-		err = clGetProgramBuildInfo(
-				openCLObjects.program,
-				openCLObjects.device,
-				CL_PROGRAM_BUILD_LOG,
-				log_length,
-				&log[0],
-				0
-		);
-		SAMPLE_CHECK_ERRORS(err);
-
-		LOGE
-		(
-				"Error happened during the build of OpenCL program.\nBuild log: %s",
-				&log[0]
-		);
-		/*
-		 * sends the error log to the console text edit.
-		 */
-		std::string str(log.begin(),log.end());
-		const char * c = str.c_str();
-		JavaString = (*env).NewStringUTF(c);
-		jclass MyJavaClass = (*env).FindClass("com/denayer/ovsr/OpenCL");
-		if (!MyJavaClass){
-			LOGD("METHOD NOT FOUND");
-			return;} /* method not found */
-		jmethodID setConsoleOutput = (*env).GetMethodID(MyJavaClass, "setConsoleOutput", "(Ljava/lang/String;)V");
-		(*env).CallVoidMethod(thisObject, setConsoleOutput, JavaString);
+		reportBuildFailure(env, thisObject, openCLSession, entry.program);
+		clReleaseProgram(entry.program);
+		openCLSession.kernel = 0;
 		return;
 	}
-
-	fileName = env->GetStringUTFChars(kernelName, 0);
-	char result[100];   // array to hold the result.
-	std::strcpy(result,fileName); //place the given kernel name into a string
-	openCLObjects.kernel = clCreateKernel(openCLObjects.program, result, &err);
 	SAMPLE_CHECK_ERRORS(err);
 
-	openCLObjects.queue =
-			clCreateCommandQueue
-			(
-					openCLObjects.context,
-					openCLObjects.device,
-					0,    // Creating queue properties, refer to the OpenCL specification for details.
-					&err
-			);
+	/*
+	 * Extract kernel from the built program.
+	 */
+	entry.kernel = clCreateKernel(entry.program, kernelFunction.c_str(), &err);
+	if(err != CL_SUCCESS)
+		clReleaseProgram(entry.program);
 	SAMPLE_CHECK_ERRORS(err);
+
+	openCLSession.kernels[key] = entry;
+	openCLSession.kernel = entry.kernel;
+	openCLSession.kernelBoundsChecked = entry.boundsChecked;
 }
 
-	/*! \brief This function enables the connection between initOpenCLFromInput and Java. 
-	 * 
+	/*! \brief Builds one program from the sources of all bundled filters.
+	 *
+	 * Every __kernel function of the program is added to the kernel table of the session.
+	 * The key is the function name without the "Kernel" suffix, so "blurKernel" is found
+	 * by initOpenCL("blur"). Each table entry holds its own reference to the shared program.
+	 * The program is only build once per session.
+	 *
 	 * @param env is a pointer to the java environment where this function is called.
 	 * @param thisObject is a java object to be able to access java data from the native code
-	 * @param OpenCLCode is a java string that contains the OpenCL code to be excecuted
-	 * @param kernelName is a java string that contains the kernel for which the OpenCL code must be initialised
+	 * @param sources is a java string array with the OpenCL code of the bundled filters
+	 * @param openCLSession is the session the program has to be build for
 	 */
-extern "C" void Java_com_denayer_ovsr_OpenCL_initOpenCLFromInput
+void initOpenCLBundle
 (
 		JNIEnv* env,
 		jobject thisObject,
-		jstring OpenCLCode,
-		jstring kernelName,
-		int dev_type
+		jobjectArray sources,
+		OpenCLSession& openCLSession
 )
 {
-	if(dev_type==1)
-	{
-		initOpenCLFromInput
-		(
-				env,
-				thisObject,
-				OpenCLCode,
-				kernelName,
-				CL_DEVICE_TYPE_CPU,
-				openCLObjects
-		);
-	}
-	else
+	if(openCLSession.isBundleBuilt)
+		return;
+
+	std::string source;
+	jsize count = env->GetArrayLength(sources);
+	for(jsize i = 0; i < count; i++)
 	{
-		initOpenCLFromInput
-		(
-				env,
-				thisObject,
-				OpenCLCode,
-				kernelName,
-				CL_DEVICE_TYPE_GPU,
-				openCLObjects
-		);
+		jstring javaSource = (jstring)env->GetObjectArrayElement(sources, i);
+		const char* sourceChar = env->GetStringUTFChars(javaSource, 0);
+		source.append(sourceChar);
+		source.append("\n");
+		env->ReleaseStringUTFChars(javaSource, sourceChar);
+		env->DeleteLocalRef(javaSource);
 	}
-}
 
-	/*! \brief This function prepares OpenCL to compile code from a Java string.
-	 *
-	 * This is a regular sequence of calls to deallocate
-	 * all created OpenCL resources in bootstrapOpenCL.
-	 *
-	 * You can call these deallocation procedures in the middle
-	 * of your application execution (not at the end) if you don't
-	 * need OpenCL runtime any more.
-	 * Use deallocation, for example, to free memory or recreate
-	 * OpenCL objects with different parameters.
-	 *
-	 * Calling deallocation in the end of application
-	 * execution might be not so useful, as upon killing
-	 * an application, which is a common thing in the Android OS,
-	 * all OpenCL resources are deallocated automatically.
-	 * 
-	 * @param openCLObjects is the adres of the openCLObjects struct
-	 */
-void shutdownOpenCL (OpenCLObjects& openCLObjects)
-{
-	LOGD("SHUTTING DOWN");
 	cl_int err = CL_SUCCESS;
-
-	if(openCLObjects.isInputBufferInitialized)
+	cl_program program = buildProgramWithCache(openCLSession, source, &err);
+	if(err == CL_BUILD_PROGRAM_FAILURE)
 	{
-		err = clReleaseMemObject(openCLObjects.inputBuffer);
-		SAMPLE_CHECK_ERRORS(err);
+		reportBuildFailure(env, thisObject, openCLSession, program);
+		clReleaseProgram(program);
+		return;
 	}
-
-	err = clReleaseKernel(openCLObjects.kernel);
 	SAMPLE_CHECK_ERRORS(err);
 
-	err = clReleaseProgram(openCLObjects.program);
+	cl_uint numKernels = 0;
+	err = clCreateKernelsInProgram(program, 0, 0, &numKernels);
+	if(err != CL_SUCCESS)
+		clReleaseProgram(program);
 	SAMPLE_CHECK_ERRORS(err);
+	if(numKernels == 0)
+	{
+		LOGE("The kernel bundle holds no kernels");
+		clReleaseProgram(program);
+		return;
+	}
 
-	err = clReleaseCommandQueue(openCLObjects.queue);
+	std::vector<cl_kernel> kernels(numKernels);
+	err = clCreateKernelsInProgram(program, numKernels, &kernels[0], 0);
+	if(err != CL_SUCCESS)
+		clReleaseProgram(program);
 	SAMPLE_CHECK_ERRORS(err);
 
-	err = clReleaseContext(openCLObjects.context);
-	SAMPLE_CHECK_ERRORS(err);
+	for(cl_uint i = 0; i < numKernels; i++)
+	{
+		char functionName[128];
+		err = clGetKernelInfo(kernels[i], CL_KERNEL_FUNCTION_NAME, sizeof(functionName), functionName, 0);
+		if(err != CL_SUCCESS)
+		{
+			LOGE("clGetKernelInfo failed with %s", opencl_error_to_str(err));
+			clReleaseKernel(kernels[i]);
+			continue;
+		}
 
-	/* There is no procedure to deallocate OpenCL devices or
-	 * platforms as both are not created at the startup,
-	 * but queried from the OpenCL runtime.
-	 */
+		std::string key(functionName);
+		if(key.size() > 6 && key.compare(key.size() - 6, 6, "Kernel") == 0)
+			key.erase(key.size() - 6);
+
+		std::map<std::string, OpenCLKernelEntry>::iterator it = openCLSession.kernels.find(key);
+		if(it != openCLSession.kernels.end())
+		{
+			clReleaseKernel(it->second.kernel);
+			clReleaseProgram(it->second.program);
+		}
+
+		OpenCLKernelEntry entry;
+		entry.program = program;
+		entry.kernel = kernels[i];
+		entry.boundsChecked = true; // the bundled filters check the image size
+		clRetainProgram(program);
+		openCLSession.kernels[key] = entry;
+	}
+	clReleaseProgram(program);
+
+	LOGD("Bundled program build with %u kernels", numKernels);
+	openCLSession.isBundleBuilt = true;
 }
 
-	/*! \brief This function enables the connection between shutdownOpenCL and Java. 
-	 * 
+	/*! \brief This function enables the connection between initOpenCLBundle and Java.
+	 *
+	 * Creates the session of the device type when needed and builds the bundled filters in it.
+	 *
 	 * @param env is a pointer to the java environment where this function is called.
 	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param sources is a java string array with the OpenCL code of the bundled filters
+	 * @param dev_type is the device type, 1 is CPU, 2 is auto, 3 is split and everything else is GPU.
+	 * In auto and split mode the filters are build on the best GPU and the best CPU.
+	 * @return True when the filters are build on every device, false to try again at the next call.
 	 */
-extern "C" void Java_com_denayer_ovsr_OpenCL_shutdownOpenCL
+extern "C" jboolean Java_com_denayer_ovsr_OpenCL_initOpenCLSession
 (
 		JNIEnv* env,
-		jobject thisObject
+		jobject thisObject,
+		jobjectArray sources,
+		int dev_type
 )
 {
-	shutdownOpenCL(openCLObjects);
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return JNI_FALSE;
+	OpenCLEngine& engine = *lock.engine;
+
+	std::vector<int> devices;
+	if(dev_type == DEV_TYPE_AUTO || dev_type == DEV_TYPE_SPLIT)
+		devices = autoDevices(engine);
+	else
+		devices.push_back(bestDeviceOfType(listOpenCLDevices(engine),
+				dev_type == DEV_TYPE_CPU ? CL_DEVICE_TYPE_CPU : CL_DEVICE_TYPE_GPU));
+
+	bool built = !devices.empty();
+	for(size_t i = 0; i < devices.size(); i++)
+	{
+		OpenCLSession* openCLSession = getDeviceSession(engine, devices[i]);
+		if(!openCLSession)
+		{
+			built = false;
+			continue;
+		}
+
+		initOpenCLBundle
+		(
+				env,
+				thisObject,
+				sources,
+				*openCLSession
+		);
+		built = built && openCLSession->isBundleBuilt;
+		engine.currentSession = openCLSession;
+	}
+	return built ? JNI_TRUE : JNI_FALSE;
 }
-	/*! \brief Excecutes an OpenCL kernel. Makes no use of image2d
-	 *  
+
+	/*! \brief This function selects the kernel to be used at the next filter iterations.
+	 *
+	 * The kernel is looked up in the kernel table of the session, which holds the
+	 * bundled filters after initOpenCLSession and the kernels built from the input field.
+	 *
 	 * @param env is a pointer to the java environment where this function is called.
 	 * @param thisObject is a java object to be able to access java data from the native code
-	 * @param openCLObjects is the adres of the openCLObjects struct
-	 * @param inputBitmap is the Android bitmap that has to be processed
-	 * @param outputBitmap is the result of the OpenCL kernel
-	*/
-void nativeBasicOpenCL
+	 * @param kernelName is a java string that contains the kernel for which the OpenCL code must be initialised
+	 * @param openCLSession is the session the kernel has to be build for
+	 */
+void initOpenCL
 (
 		JNIEnv* env,
 		jobject thisObject,
-		OpenCLObjects& openCLObjects,
-		jobject inputBitmap,
-		jobject outputBitmap
+		jstring kernelName,
+		OpenCLSession& openCLSession
 )
 {
-	using namespace std;
+	const char* fileName = env->GetStringUTFChars(kernelName, 0);
+	std::string name(fileName);
+	env->ReleaseStringUTFChars(kernelName, fileName);
 
-	timeval start;
-	timeval end;
+	openCLSession.kernelKey = name;
+	std::map<std::string, OpenCLKernelEntry>::iterator it = openCLSession.kernels.find(name);
+	if(it == openCLSession.kernels.end())
+	{
+		LOGE("Kernel %s is not in the kernel table, call initOpenCLSession first", name.c_str());
+		openCLSession.kernel = 0;
+		return;
+	}
+	openCLSession.kernel = it->second.kernel;
+	openCLSession.kernelBoundsChecked = it->second.boundsChecked;
+}
 
-//	gettimeofday(&start, NULL);
+	/*! \brief This function enables the connection between initOpenCL and Java.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param kernelName is a java string that contains the kernel for which the OpenCL code must be initialised
+	 * @param dev_type is the device type, 1 is CPU, 2 is auto, 3 is split and everything else is GPU.
+	 * In split mode the kernel is also selected in the CPU session, when the filter can be split.
+	 */
+extern "C" void Java_com_denayer_ovsr_OpenCL_initOpenCL
+(
+		JNIEnv* env,
+		jobject thisObject,
+		jstring kernelName,
+		int dev_type
+)
+{
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return;
+	OpenCLEngine& engine = *lock.engine;
 
-	AndroidBitmapInfo bitmapInfo;
-	AndroidBitmap_getInfo(env, inputBitmap, &bitmapInfo);
+	const char* nameChar = env->GetStringUTFChars(kernelName, 0);
+	std::string key(nameChar);
+	env->ReleaseStringUTFChars(kernelName, nameChar);
 
-	size_t bufferSize = bitmapInfo.height * bitmapInfo.stride;
+	engine.splitSession = 0;
+	engine.pipeline.clear();
+	engine.currentSession = getOpenCLSession(engine, dev_type, key);
+	if(!engine.currentSession)
+		return;
 
-	cl_uint rowPitch = bitmapInfo.stride / 4;
+	initOpenCL
+	(
+			env,
+			thisObject,
+			kernelName,
+			*engine.currentSession
+	);
 
-	cl_int err = CL_SUCCESS;
+	if(dev_type != DEV_TYPE_SPLIT || splitHaloRows(key) < 0)
+		return;
+	OpenCLSession* cpuSession = getOpenCLSession(engine, DEV_TYPE_CPU, key);
+	if(!cpuSession || cpuSession == engine.currentSession)
+		return;
+	initOpenCL
+	(
+			env,
+			thisObject,
+			kernelName,
+			*cpuSession
+	);
+	if(cpuSession->kernel)
+		engine.splitSession = cpuSession;
+}
+	/*! \brief This function prepares OpenCL to compile code from a Java string.
+	 *
+	 * The code is kept in the kernel table of the session, so executing the same
+	 * code again does not compile it again. When the code changed it is rebuilt.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param kernelCode is the OpenCL code to be compiled
+	 * @param kernelName is a java string that contains the kernel for which the OpenCL code must be initialised
+	 * @param openCLSession is the session the kernel has to be build for
+	 */
+void initOpenCLFromInput
+(
+		JNIEnv* env,
+		jobject thisObject,
+		jstring kernelCode,
+		jstring kernelName,
+		OpenCLSession& openCLSession
+)
+{
+	const char* codeChar = env->GetStringUTFChars(kernelCode, 0);
+	std::string code(codeChar);
+	env->ReleaseStringUTFChars(kernelCode, codeChar);
 
+	const char* nameChar = env->GetStringUTFChars(kernelName, 0);
+	std::string name(nameChar);
+	env->ReleaseStringUTFChars(kernelName, nameChar);
 
-	if(openCLObjects.isInputBufferInitialized)
+	/*
+	 * Code from the input field is stored apart from the bundled filters,
+	 * so a user kernel can not replace one of them.
+	 */
+	std::string key = "input:" + name;
+	openCLSession.kernelKey = key;
+	std::map<std::string, OpenCLKernelEntry>::iterator it = openCLSession.kernels.find(key);
+	if(it != openCLSession.kernels.end())
 	{
-
-		err = clReleaseMemObject(openCLObjects.inputBuffer);
-		SAMPLE_CHECK_ERRORS(err);
+		if(it->second.source == code)
+		{
+			openCLSession.kernel = it->second.kernel;
+			openCLSession.kernelBoundsChecked = it->second.boundsChecked;
+			return;
+		}
+		clReleaseKernel(it->second.kernel);
+		clReleaseProgram(it->second.program);
+		openCLSession.kernels.erase(it);
 	}
 
-	void* inputPixels = 0;
-	AndroidBitmap_lockPixels(env, inputBitmap, &inputPixels);
+	buildKernel(env, thisObject, openCLSession, key, code, name);
+}
 
-	openCLObjects.inputBuffer =
-			clCreateBuffer
-			(
-					openCLObjects.context,
-					CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-					bufferSize,   // Buffer size in bytes.
-					inputPixels,  // Bytes for initialization.
-					&err
-			);
-	SAMPLE_CHECK_ERRORS(err);
+	/*! \brief This function enables the connection between initOpenCLFromInput and Java.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param OpenCLCode is a java string that contains the OpenCL code to be excecuted
+	 * @param kernelName is a java string that contains the kernel for which the OpenCL code must be initialised
+	 * @param dev_type is the device type, 1 is CPU, 2 is auto, 3 is split and everything else is GPU.
+	 * Code from the input field is not split, because its halo is not known, so split runs it on the GPU.
+	 */
+extern "C" void Java_com_denayer_ovsr_OpenCL_initOpenCLFromInput
+(
+		JNIEnv* env,
+		jobject thisObject,
+		jstring OpenCLCode,
+		jstring kernelName,
+		int dev_type
+)
+{
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return;
+	OpenCLEngine& engine = *lock.engine;
 
-	openCLObjects.isInputBufferInitialized = true;
+	const char* nameChar = env->GetStringUTFChars(kernelName, 0);
+	std::string key = std::string("input:") + nameChar;
+	env->ReleaseStringUTFChars(kernelName, nameChar);
+
+	engine.splitSession = 0;
+	engine.pipeline.clear();
+	engine.currentSession = getOpenCLSession(engine, dev_type, key);
+	if(!engine.currentSession)
+		return;
+
+	initOpenCLFromInput
+	(
+			env,
+			thisObject,
+			OpenCLCode,
+			kernelName,
+			*engine.currentSession
+	);
+}
 
-	AndroidBitmap_unlockPixels(env, inputBitmap);
+	/*! \brief Creates the native engine of a Java OpenCL object.
+	 *
+	 * The engine starts without sessions, they are created by the first
+	 * initOpenCLSession or initOpenCL call.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @return The handle Java keeps in its engine field.
+	 */
+extern "C" jlong Java_com_denayer_ovsr_OpenCL_createEngine
+(
+		JNIEnv* env,
+		jobject thisObject
+)
+{
+	return (jlong)(intptr_t)new OpenCLEngine();
+}
 
-	void* outputPixels = 0;
-	AndroidBitmap_lockPixels(env, outputBitmap, &outputPixels);
+	/*! \brief Releases the sessions of all devices and deletes the engine.
+	 *
+	 * Java calls this when it explicitly closes OpenCL, not after every filter.
+	 * closeOpenCL is synchronized like the other native methods and clears the
+	 * engine field, so no other native call can use the engine at the same time.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param handle is the handle returned by createEngine
+	 */
+extern "C" void Java_com_denayer_ovsr_OpenCL_destroyEngine
+(
+		JNIEnv* env,
+		jobject thisObject,
+		jlong handle
+)
+{
+	OpenCLEngine* engine = (OpenCLEngine*)(intptr_t)handle;
+	if(!engine)
+		return;
 
-	cl_mem outputBuffer =
-			clCreateBuffer
-			(
-					openCLObjects.context,
-					CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR,
-					bufferSize,    // Buffer size in bytes, same as the input buffer.
-					outputPixels,  // Area, above which the buffer is created.
-					&err
-			);
+	LOGD("SHUTTING DOWN");
+	pthread_mutex_lock(&engine->mutex);
+	releaseVideoStream(engine->videoStream);
+	engine->videoStream = 0;
+	releaseResidentImage(engine->preview);
+	releaseResidentImage(engine->pinnedInput);
+	for(size_t i = 0; i < engine->sessions.size(); i++)
+	{
+		if(engine->sessions[i])
+			releaseOpenCLSession(engine->sessions[i]);
+	}
+	pthread_mutex_unlock(&engine->mutex);
+	delete engine;
+}
+	/*! \brief Returns the seconds since a gettimeofday timestamp.
+	 */
+static double elapsedSeconds(const timeval& start)
+{
+	timeval end;
+	gettimeofday(&end, NULL);
+	return (end.tv_sec + end.tv_usec * 1e-6) - (start.tv_sec + start.tv_usec * 1e-6);
+}
+	/*! \brief Sends the stage times of the last execution to Java, when profiling is on.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param openCLSession is the session that executed the kernel
+	 */
+static void reportExecutionProfile
+(
+		JNIEnv* env,
+		jobject thisObject,
+		OpenCLSession& openCLSession
+)
+{
+	ExecutionProfile& profile = openCLSession.lastProfile;
+	if(!profile.valid)
+		return;
+	profile.valid = false;
+	(*env).CallVoidMethod(thisObject, setProfileFromJNIMethod,
+			commandMilliseconds(profile.upload),
+			commandMilliseconds(profile.kernel),
+			commandMilliseconds(profile.download),
+			profile.hostMs);
+}
+	/*! \brief Describes the memory of a direct java.nio.ByteBuffer as host pixels.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param buffer is a direct ByteBuffer
+	 * @param width is the width of the image in pixels
+	 * @param height is the height of the image in pixels
+	 * @param stride is the number of bytes per row
+	 * @param pixelBytes is the number of bytes per pixel
+	 * @param host receives the description
+	 * @return False when the size is not positive, or the buffer is not direct or too small.
+	 */
+static bool directBufferImage
+(
+		JNIEnv* env,
+		jobject buffer,
+		jint width,
+		jint height,
+		jint stride,
+		size_t pixelBytes,
+		HostImage* host
+)
+{
+	// Negative sizes would wrap around to huge ones and pass the capacity check.
+	if(width <= 0 || height <= 0 || stride <= 0)
+	{
+		LOGE("The image size %dx%d with %d bytes per row is not valid", (int)width, (int)height, (int)stride);
+		return false;
+	}
+	host->pixels = env->GetDirectBufferAddress(buffer);
+	host->width = width;
+	host->height = height;
+	host->stride = stride;
+	if(!host->pixels || host->stride < host->width * pixelBytes)
+	{
+		LOGE("The pixels have to be in a direct ByteBuffer with at least %d bytes per row", (int)(host->width * pixelBytes));
+		return false;
+	}
+	jlong capacity = env->GetDirectBufferCapacity(buffer);
+	if(capacity < (jlong)((host->height - 1) * host->stride + host->width * pixelBytes))
+	{
+		LOGE("The ByteBuffer holds %lld bytes, that is too small for the image", (long long)capacity);
+		return false;
+	}
+	return true;
+}
+	/*! \brief Runs the current kernel of a session on buffer copies of host pixels. Makes no use of image2d
+	 *
+	 * The input and output buffers are checked out from the memory pool of the session,
+	 * so a call with the same image size as the previous one allocates nothing on the device.
+	 * Input and output have to have the same size and stride.
+	 *
+	 * @param openCLSession is the session that holds the kernel to be executed
+	 * @param input describes the pixels that have to be processed
+	 * @param output describes the pixels that receive the result
+	 */
+void executeBufferKernel
+(
+		OpenCLSession& openCLSession,
+		const HostImage& input,
+		const HostImage& output
+)
+{
+	timeval start;
+	gettimeofday(&start, NULL);
+
+	size_t bufferSize = input.height * input.stride;
+	cl_uint rowPitch = input.stride / 4;
+	cl_uint width = input.width;
+	cl_uint height = input.height;
+
+	cl_int err = CL_SUCCESS;
+
+	PooledMemObject inputBuffer(openCLSession);
+	PooledMemObject outputBuffer(openCLSession);
+	PendingCommands pending(openCLSession.queue);
+	ScopedEvent writeEvent;
+	ScopedEvent kernelEvent;
+	ScopedEvent readEvent;
+
+	inputBuffer.memObject = acquireHostBuffer(openCLSession, CL_MEM_READ_ONLY, input.pixels, bufferSize, true, &writeEvent.event, &err);
 	SAMPLE_CHECK_ERRORS(err);
 
-	err = clSetKernelArg(openCLObjects.kernel, 0, sizeof(openCLObjects.inputBuffer), &openCLObjects.inputBuffer);
+	outputBuffer.memObject = acquireHostBuffer(openCLSession, CL_MEM_WRITE_ONLY, output.pixels, bufferSize, false, 0, &err);
 	SAMPLE_CHECK_ERRORS(err);
-	err = clSetKernelArg(openCLObjects.kernel, 1, sizeof(outputBuffer), &outputBuffer);
+
+	err = clSetKernelArg(openCLSession.kernel, 0, sizeof(cl_mem), &inputBuffer.memObject);
+	SAMPLE_CHECK_ERRORS(err);
+	err = clSetKernelArg(openCLSession.kernel, 1, sizeof(cl_mem), &outputBuffer.memObject);
 	SAMPLE_CHECK_ERRORS(err);
-	err = clSetKernelArg(openCLObjects.kernel, 2, sizeof(cl_uint), &rowPitch);
+	err = clSetKernelArg(openCLSession.kernel, 2, sizeof(cl_uint), &rowPitch);
 	SAMPLE_CHECK_ERRORS(err);
-	err = clSetKernelArg(openCLObjects.kernel, 3, sizeof(cl_uint), &bitmapInfo.width);
+	err = clSetKernelArg(openCLSession.kernel, 3, sizeof(cl_uint), &width);
 	SAMPLE_CHECK_ERRORS(err);
-	err = clSetKernelArg(openCLObjects.kernel, 4, sizeof(cl_uint), &bitmapInfo.height);
+	err = clSetKernelArg(openCLSession.kernel, 4, sizeof(cl_uint), &height);
 	SAMPLE_CHECK_ERRORS(err);
 
-	size_t globalSize[2] = { bitmapInfo.width, bitmapInfo.height };
+	// Kernels from the input field may not check the image size, so the global size is never padded.
+	size_t globalSize[2];
+	size_t localSize[2];
+	bool useLocalSize = chooseWorkSize(openCLSession, openCLSession.kernel, input.width, input.height, false, globalSize, localSize);
 
 	err =
 			clEnqueueNDRangeKernel
 			(
-					openCLObjects.queue,
-					openCLObjects.kernel,
+					openCLSession.queue,
+					openCLSession.kernel,
 					2,
 					0,
 					globalSize,
-					0,
-					0, 0, 0
+					useLocalSize ? localSize : 0,
+					writeEvent.event ? 1 : 0,
+					writeEvent.event ? &writeEvent.event : 0,
+					&kernelEvent.event
 			);
 	SAMPLE_CHECK_ERRORS(err);
 
-	err = clFinish(openCLObjects.queue);
-	SAMPLE_CHECK_ERRORS(err);
-
-	err = clEnqueueReadBuffer (openCLObjects.queue,
-			outputBuffer,
-			true,
-			0,
-			bufferSize,
-			outputPixels,
-			0,
-			0,
-			0);
-	SAMPLE_CHECK_ERRORS(err);
-
-	// Call clFinish to guarantee that the output region is updated.
-	err = clFinish(openCLObjects.queue);
+	err = downloadHostBuffer(openCLSession, outputBuffer.memObject, output.pixels, bufferSize, kernelEvent.event, &readEvent.event);
 	SAMPLE_CHECK_ERRORS(err);
 
-	err = clReleaseMemObject(outputBuffer);
+	// The read depends on the kernel, which depends on the write, so one wait covers the frame.
+	err = clWaitForEvents(1, &readEvent.event);
 	SAMPLE_CHECK_ERRORS(err);
+	pending.done();
 
-	// Make the output content be visible at the Java side by unlocking
-	// pixels in the output bitmap object.
-	AndroidBitmap_unlockPixels(env, outputBitmap);
-
-//	gettimeofday(&end, NULL);
-//
-//	float ndrangeDuration =
-//			(end.tv_sec + end.tv_usec * 1e-6) - (start.tv_sec + start.tv_usec * 1e-6);
+	double seconds = elapsedSeconds(start);
+	recordExecutionProfile(openCLSession, writeEvent.event, kernelEvent.event, readEvent.event, seconds);
+	recordKernelThroughput(openCLSession, input.width * input.height, seconds);
+}
+	/*! \brief Excecutes an OpenCL kernel. Makes no use of image2d
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param openCLSession is the session that holds the kernel to be executed
+	 * @param inputBitmap is the Android bitmap that has to be processed
+	 * @param outputBitmap is the result of the OpenCL kernel
+	*/
+void nativeBasicOpenCL
+(
+		JNIEnv* env,
+		jobject thisObject,
+		OpenCLSession& openCLSession,
+		jobject inputBitmap,
+		jobject outputBitmap
+)
+{
+	BitmapPixels input(env, inputBitmap);
+	BitmapPixels output(env, outputBitmap);
+	if(!input.pixels || !output.pixels)
+	{
+		LOGE("Cannot lock the pixels of the bitmaps");
+		return;
+	}
 
-	//LOGD("nativeBasicOpenCL ends successfully");
+	executeBufferKernel(openCLSession, input.hostImage(), output.hostImage());
+	reportExecutionProfile(env, thisObject, openCLSession);
 
-//	jclass MyJavaClass = (*env).FindClass("com/denayer/ovsr/OpenCL");
-//	if (!MyJavaClass){
-//		return;} /* method not found */
-//	jmethodID setTimeFromJNI = (*env).GetMethodID(MyJavaClass, "setTimeFromJNI", "(F)V");
-//	(*env).CallVoidMethod(thisObject, setTimeFromJNI, ndrangeDuration);
-	//LOGD("Done");
+	// The pixels of the output bitmap are unlocked when output goes out of scope,
+	// which makes the content visible at the Java side.
 }
-	/*! \brief This function enables the connection between nativeBasicOpenCL and Java. 
-	 * 
+	/*! \brief This function enables the connection between nativeBasicOpenCL and Java.
+	 *
 	 * @param env is a pointer to the java environment where this function is called.
 	 * @param thisObject is a java object to be able to access java data from the native code
 	 * @param inputBitmap is the Android bitmap that has to be processed
@@ -773,149 +1032,203 @@ extern "C" void Java_com_denayer_ovsr_OpenCL_nativeBasicOpenCL
 		jobject outputBitmap
 )
 {
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return;
+	OpenCLEngine& engine = *lock.engine;
+
+	if(!engine.currentSession || !engine.currentSession->kernel)
+	{
+		LOGE("nativeBasicOpenCL called without a kernel, call initOpenCL first");
+		return;
+	}
 	nativeBasicOpenCL
 	(
 			env,
 			thisObject,
-			openCLObjects,
+			*engine.currentSession,
 			inputBitmap,
 			outputBitmap
 	);
 }
-	/*! \brief Excecutes an OpenCL kernel. Makes use of the image2d_t data type.
-	 *  
-	 * @param env is a pointer to the java environment where this function is called.
-	 * @param thisObject is a java object to be able to access java data from the native code
-	 * @param openCLObjects is the adres of the openCLObjects struct
-	 * @param inputBitmap is the Android bitmap that has to be processed
-	 * @param outputBitmap is the result of the OpenCL kernel
-	*/
-void nativeImage2DOpenCL
+	/*! \brief Runs the current kernel of a session on an image2d_t copy of host pixels.
+	 *
+	 * The first two kernel arguments are set to the input and output image. Extra
+	 * arguments have to be set by the caller before. The device images are checked
+	 * out from the memory pool of the session, so steady-state calls with the same
+	 * image size do no device allocations. In zero-copy mode the images share
+	 * memory with the host (see HostTransfer.cpp) instead of being copied.
+	 * Images beyond the image or allocation limits of the device run in tiles.
+	 * Filters with a uchar4 variant that is faster on the device run it on
+	 * CL_UNSIGNED_INT8 images instead, see IntegerPath.cpp.
+	 *
+	 * @param openCLSession is the session that holds the kernel to be executed
+	 * @param input describes the RGBA pixels that have to be processed
+	 * @param output describes the RGBA pixels that receive the result, with the size of input
+	 */
+void executeImage2DKernel
 (
-		JNIEnv* env,
-		jobject thisObject,
-		OpenCLObjects& openCLObjects,
-		jobject inputBitmap,
-		jobject outputBitmap
+		OpenCLSession& openCLSession,
+		const HostImage& input,
+		const HostImage& output
 )
 {
-	using namespace std;
-
-	timeval start;
-	timeval end;
+	LOGD("height: %d",(int)input.height);
 
-	gettimeofday(&start, NULL);
+	if(needsTiling(openCLSession, input.width, input.height))
+	{
+		executeTiledImage2DKernel(openCLSession, input, output);
+		return;
+	}
 
-	AndroidBitmapInfo bitmapInfo;
-	AndroidBitmap_getInfo(env, inputBitmap, &bitmapInfo);
+	cl_kernel kernel = chooseIntegerPath(openCLSession, input);
+	bool integerPath = (kernel != 0);
+	if(!integerPath)
+		kernel = openCLSession.kernel;
 
-	size_t bufferSize = bitmapInfo.height * bitmapInfo.stride;
-	LOGD("height: %d",bitmapInfo.height);
-	cl_uint rowPitch = bitmapInfo.stride / 4;
+	timeval start;
+	gettimeofday(&start, NULL);
 
 	cl_int err = CL_SUCCESS;
 
-	void* inputPixels = 0;
-	AndroidBitmap_lockPixels(env, inputBitmap, &inputPixels);
-
 	cl_image_format image_format;
-	image_format.image_channel_data_type=CL_UNORM_INT8;
+	image_format.image_channel_data_type=integerPath ? CL_UNSIGNED_INT8 : CL_UNORM_INT8;
 	image_format.image_channel_order=CL_RGBA;
 
-	openCLObjects.inputBuffer =
-			clCreateImage2D(openCLObjects.context,
-					CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-					&image_format,
-					bitmapInfo.width,
-					bitmapInfo.height,
-					0,
-					inputPixels,
+	PooledMemObject inputImage(openCLSession);
+	PooledMemObject outputImage(openCLSession);
+	PendingCommands pending(openCLSession.queue);
+	ScopedEvent writeEvent;
+	ScopedEvent kernelEvent;
+	ScopedEvent readEvent;
+
+	inputImage.memObject =
+			acquireHostImage(openCLSession,
+					CL_MEM_READ_ONLY,
+					image_format,
+					input,
+					true,
+					&writeEvent.event,
 					&err);
 	SAMPLE_CHECK_ERRORS(err);
 
-	openCLObjects.isInputBufferInitialized = true;
-
-	AndroidBitmap_unlockPixels(env, inputBitmap);
-
-	void* outputPixels = 0;
-	AndroidBitmap_lockPixels(env, outputBitmap, &outputPixels);
-
-	cl_mem outputBuffer =
-			clCreateImage2D(openCLObjects.context,
-					CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR,
-					&image_format,
-					bitmapInfo.width,
-					bitmapInfo.height,
+	outputImage.memObject =
+			acquireHostImage(openCLSession,
+					CL_MEM_WRITE_ONLY,
+					image_format,
+					output,
+					false,
 					0,
-					outputPixels,
 					&err);
 	SAMPLE_CHECK_ERRORS(err);
-	err = clSetKernelArg(openCLObjects.kernel, 0, sizeof(openCLObjects.inputBuffer), &openCLObjects.inputBuffer);
+
+	err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &inputImage.memObject);
 	SAMPLE_CHECK_ERRORS(err);
-	err = clSetKernelArg(openCLObjects.kernel, 1, sizeof(outputBuffer), &outputBuffer);
+	err = clSetKernelArg(kernel, 1, sizeof(cl_mem), &outputImage.memObject);
 	SAMPLE_CHECK_ERRORS(err);
 
-	size_t globalSize[2] = { bitmapInfo.width, bitmapInfo.height };
+	size_t globalSize[2];
+	size_t localSize[2];
+	bool useLocalSize =
+			chooseWorkSize(openCLSession, kernel, input.width, input.height,
+					openCLSession.kernelBoundsChecked, globalSize, localSize);
 
 	err = clEnqueueNDRangeKernel
 			(
-					openCLObjects.queue,
-					openCLObjects.kernel,
+					openCLSession.queue,
+					kernel,
 					2,
 					0,
 					globalSize,
-					0,
-					0, 0, 0
+					useLocalSize ? localSize : 0,
+					writeEvent.event ? 1 : 0,
+					writeEvent.event ? &writeEvent.event : 0,
+					&kernelEvent.event
 			);
 	SAMPLE_CHECK_ERRORS(err);
 
-	err = clFinish(openCLObjects.queue);
-	SAMPLE_CHECK_ERRORS(err);
-
-    const size_t origin[3] = {0, 0, 0};
-    const size_t region[3] = {bitmapInfo.width, bitmapInfo.height, 1};
-
-	err = clEnqueueReadImage(
-			openCLObjects.queue,
-			outputBuffer,
-			true,
-			origin,
-			region,
-			0,
-			0,
-			outputPixels,
-			0,
-			0,
-			0);
-	SAMPLE_CHECK_ERRORS(err);
-
-
-	// Call clFinish to guarantee that the output region is updated.
-	err = clFinish(openCLObjects.queue);
+	err = downloadHostImage(openCLSession, outputImage.memObject, output, kernelEvent.event, &readEvent.event);
 	SAMPLE_CHECK_ERRORS(err);
 
-	err = clReleaseMemObject(outputBuffer);
-	SAMPLE_CHECK_ERRORS(err);
-	err = clReleaseMemObject(openCLObjects.inputBuffer);
+	// The read depends on the kernel, which depends on the write, so one wait covers the frame.
+	err = clWaitForEvents(1, &readEvent.event);
 	SAMPLE_CHECK_ERRORS(err);
-	openCLObjects.isInputBufferInitialized = false;
-	// Make the output content be visible at the Java side by unlocking
-	// pixels in the output bitmap object.
-	AndroidBitmap_unlockPixels(env, outputBitmap);
+	pending.done();
 
-	gettimeofday(&end, NULL);
-
-	float ndrangeDuration =
-			(end.tv_sec + end.tv_usec * 1e-6) - (start.tv_sec + start.tv_usec * 1e-6);
+	double seconds = elapsedSeconds(start);
+	recordExecutionProfile(openCLSession, writeEvent.event, kernelEvent.event, readEvent.event, seconds);
+	recordKernelThroughput(openCLSession, input.width * input.height, seconds);
+}
+	/*! \brief Sets the saturation argument of the saturatie kernel of a session and of its uchar4 variant.
+	 *
+	 * @param openCLSession is the session that holds the saturatie kernel
+	 * @param saturatie is the saturation in percent
+	 * @return The OpenCL error code.
+	 */
+static cl_int setSaturatieArg(OpenCLSession& openCLSession, jfloat saturatie)
+{
+	cl_float saturatieVal = saturatie / 100 ;
+	cl_int err = clSetKernelArg(openCLSession.kernel, 2, sizeof(cl_float), &saturatieVal);
+	cl_kernel variant = integerVariant(openCLSession);
+	if(err == CL_SUCCESS && variant)
+		err = clSetKernelArg(variant, 2, sizeof(cl_float), &saturatieVal);
+	return err;
+}
+	/*! \brief Runs the current kernel of a session, in split mode together with the CPU session.
+	 *
+	 * @param openCLSession is the session that holds the kernel to be executed
+	 * @param splitSession is the CPU session in split mode, or 0
+	 * @param input describes the RGBA pixels that have to be processed
+	 * @param output describes the RGBA pixels that receive the result, with the size of input
+	 */
+static void runImage2DKernel
+(
+		OpenCLSession& openCLSession,
+		OpenCLSession* splitSession,
+		const HostImage& input,
+		const HostImage& output
+)
+{
+	if(splitSession && splitSession != &openCLSession)
+		executeSplitImage2DKernel(openCLSession, *splitSession, input, output);
+	else
+		executeImage2DKernel(openCLSession, input, output);
+}
+	/*! \brief Excecutes an OpenCL kernel. Makes use of the image2d_t data type.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param openCLSession is the session that holds the kernel to be executed
+	 * @param splitSession is the CPU session in split mode, or 0
+	 * @param input describes the pixels that have to be processed
+	 * @param output describes the pixels that receive the result of the OpenCL kernel
+	*/
+void nativeImage2DOpenCL
+(
+		JNIEnv* env,
+		jobject thisObject,
+		OpenCLSession& openCLSession,
+		OpenCLSession* splitSession,
+		const HostImage& input,
+		const HostImage& output
+)
+{
+	timeval start;
+	timeval end;
+
+	gettimeofday(&start, NULL);
+
+	runImage2DKernel(openCLSession, splitSession, input, output);
+
+	gettimeofday(&end, NULL);
+
+	float ndrangeDuration =
+			(end.tv_sec + end.tv_usec * 1e-6) - (start.tv_sec + start.tv_usec * 1e-6);
 
-	LOGD("nativeBasicOpenCL ends successfully");
+	LOGD("nativeImage2DOpenCL ends successfully");
 
-	jclass MyJavaClass = (*env).FindClass("com/denayer/ovsr/OpenCL");
-	if (!MyJavaClass){
-		LOGD("Method not found in OVSR.cpp on line 897");
-		return;} /* method not found */
-	jmethodID setTimeFromJNI = (*env).GetMethodID(MyJavaClass, "setTimeFromJNI", "(F)V"); //argument is float, return time is void
-	(*env).CallVoidMethod(thisObject, setTimeFromJNI, ndrangeDuration);
+	(*env).CallVoidMethod(thisObject, setTimeFromJNIMethod, ndrangeDuration);
+	reportExecutionProfile(env, thisObject, openCLSession);
 }
 	/*! \brief This function enables the connection between nativeImage2DOpenCL and Java. 
 	 * 
@@ -932,13 +1245,31 @@ extern "C" void Java_com_denayer_ovsr_OpenCL_nativeImage2DOpenCL
 		jobject outputBitmap
 )
 {
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return;
+	OpenCLEngine& engine = *lock.engine;
+
+	if(!engine.currentSession || !engine.currentSession->kernel)
+	{
+		LOGE("nativeImage2DOpenCL called without a kernel, call initOpenCL first");
+		return;
+	}
+	BitmapPixels input(env, inputBitmap);
+	BitmapPixels output(env, outputBitmap);
+	if(!input.pixels || !output.pixels)
+	{
+		LOGE("Cannot lock the pixels of the bitmaps");
+		return;
+	}
 	nativeImage2DOpenCL
 	(
 			env,
 			thisObject,
-			openCLObjects,
-			inputBitmap,
-			outputBitmap
+			*engine.currentSession,
+			engine.splitSession,
+			input.hostImage(),
+			output.hostImage()
 	);
 }
 	/*! \brief Excecutes a saturation OpenCL kernel. Makes use of the image2d_t data type.
@@ -947,173 +1278,1268 @@ extern "C" void Java_com_denayer_ovsr_OpenCL_nativeImage2DOpenCL
 	 *
 	 * @param env is a pointer to the java environment where this function is called.
 	 * @param thisObject is a java object to be able to access java data from the native code
-	 * @param openCLObjects is the adres of the openCLObjects struct
-	 * @param inputBitmap is the Android bitmap that has to be processed
-	 * @param outputBitmap is the result of the OpenCL kernel
+	 * @param openCLSession is the session that holds the kernel to be executed
+	 * @param splitSession is the CPU session in split mode, or 0
+	 * @param input describes the pixels that have to be processed
+	 * @param output describes the pixels that receive the result of the OpenCL kernel
 	 * @param saturatie is the saturation value needed to process the kernel
 	*/
 void nativeSaturatieImage2DOpenCL
 (
 		JNIEnv* env,
 		jobject thisObject,
-		OpenCLObjects& openCLObjects,
+		OpenCLSession& openCLSession,
+		OpenCLSession* splitSession,
+		const HostImage& input,
+		const HostImage& output,
+		jfloat saturatie
+)
+{
+	cl_int err = setSaturatieArg(openCLSession, saturatie);
+	SAMPLE_CHECK_ERRORS(err);
+	if(splitSession)
+	{
+		err = setSaturatieArg(*splitSession, saturatie);
+		SAMPLE_CHECK_ERRORS(err);
+	}
+
+	runImage2DKernel(openCLSession, splitSession, input, output);
+	reportExecutionProfile(env, thisObject, openCLSession);
+}
+	/*! \brief This function enables the connection between nativeSaturatieImage2DOpenCL and Java. 
+	 * 
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param inputBitmap is the Android bitmap that has to be processed
+	 * @param outputBitmap is the result of the OpenCL kernel
+	 * @param saturatie is the value to saturate with
+	 */
+extern "C" void Java_com_denayer_ovsr_OpenCL_nativeSaturatieImage2DOpenCL
+(
+		JNIEnv* env,
+		jobject thisObject,
 		jobject inputBitmap,
 		jobject outputBitmap,
 		jfloat saturatie
 )
 {
-	using namespace std;
-
-//	timeval start;
-//	timeval end;
-//
-//	gettimeofday(&start, NULL);
-
-
-	AndroidBitmapInfo bitmapInfo;
-	AndroidBitmap_getInfo(env, inputBitmap, &bitmapInfo);
-
-	size_t bufferSize = bitmapInfo.height * bitmapInfo.stride;
-
-	cl_uint rowPitch = bitmapInfo.stride / 4;
-
-	cl_int err = CL_SUCCESS;
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return;
+	OpenCLEngine& engine = *lock.engine;
 
-	if(openCLObjects.isInputBufferInitialized)
+	if(!engine.currentSession || !engine.currentSession->kernel)
+	{
+		LOGE("nativeSaturatieImage2DOpenCL called without a kernel, call initOpenCL first");
+		return;
+	}
+	BitmapPixels input(env, inputBitmap);
+	BitmapPixels output(env, outputBitmap);
+	if(!input.pixels || !output.pixels)
+	{
+		LOGE("Cannot lock the pixels of the bitmaps");
+		return;
+	}
+	nativeSaturatieImage2DOpenCL
+	(
+			env,
+			thisObject,
+			*engine.currentSession,
+			engine.splitSession,
+			input.hostImage(),
+			output.hostImage(),
+			saturatie
+	);
+}
+	/*! \brief Selects a chain of kernels that runs on one image without host round trips.
+	 *
+	 * Every kernel is selected like with initOpenCL. Kernels with a third argument get
+	 * their parameter, saturatie in percent like setSaturatie. Neighbouring pointwise
+	 * kernels are fused into one, see fusePointwiseStages. The pipeline is used by
+	 * nativePipelineOpenCL and nativeStreamStart until the next initOpenCL call. All
+	 * stages have to run on one device, so auto and split mode run pipelines on the GPU.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param kernelNames is a java string array with the kernels, in the order they run
+	 * @param parameters is a java float array with the parameter of each kernel
+	 * @param dev_type is the device type, 1 is CPU and everything else is GPU.
+	 * @return True when every kernel is available.
+	 */
+extern "C" jboolean Java_com_denayer_ovsr_OpenCL_setPipeline
+(
+		JNIEnv* env,
+		jobject thisObject,
+		jobjectArray kernelNames,
+		jfloatArray parameters,
+		int dev_type
+)
+{
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return JNI_FALSE;
+	OpenCLEngine& engine = *lock.engine;
+
+	engine.splitSession = 0;
+	engine.pipeline.clear();
+	if(dev_type == DEV_TYPE_AUTO || dev_type == DEV_TYPE_SPLIT)
+		dev_type = DEV_TYPE_GPU;
+	engine.currentSession = getOpenCLSession(engine, dev_type, "");
+	if(!engine.currentSession)
+		return false;
+
+	jsize count = env->GetArrayLength(kernelNames);
+	if(count == 0 || env->GetArrayLength(parameters) < count)
 	{
+		LOGE("setPipeline needs a parameter for every kernel");
+		return false;
+	}
+	std::vector<jfloat> values(count);
+	env->GetFloatArrayRegion(parameters, 0, count, &values[0]);
 
-		err = clReleaseMemObject(openCLObjects.inputBuffer);
-		SAMPLE_CHECK_ERRORS(err);
+	std::vector<PipelineStage> stages;
+	for(jsize i = 0; i < count; i++)
+	{
+		jstring kernelName = (jstring)env->GetObjectArrayElement(kernelNames, i);
+		initOpenCL
+		(
+				env,
+				thisObject,
+				kernelName,
+				*engine.currentSession
+		);
+		env->DeleteLocalRef(kernelName);
+
+		PipelineStage stage = currentPipelineStage(*engine.currentSession);
+		if(!stage.kernel)
+			return false;
+		if(stage.numArgs > 2)
+			stage.parameters.push_back((stage.key == "saturatie") ? values[i] / 100 : values[i]);
+		stages.push_back(stage);
 	}
+	fusePointwiseStages(env, thisObject, *engine.currentSession, stages);
+	engine.pipeline = stages;
+	return true;
+}
+	/*! \brief Runs the pipeline of setPipeline on a bitmap.
+	 *
+	 * Only the input bitmap is uploaded and only the result of the last kernel is read back.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param inputBitmap is the Android bitmap that has to be processed
+	 * @param outputBitmap is the result of the last kernel
+	 */
+extern "C" void Java_com_denayer_ovsr_OpenCL_nativePipelineOpenCL
+(
+		JNIEnv* env,
+		jobject thisObject,
+		jobject inputBitmap,
+		jobject outputBitmap
+)
+{
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return;
+	OpenCLEngine& engine = *lock.engine;
 
-	void* inputPixels = 0;
-	AndroidBitmap_lockPixels(env, inputBitmap, &inputPixels);
+	if(!engine.currentSession || engine.pipeline.empty())
+	{
+		LOGE("nativePipelineOpenCL called without a pipeline, call setPipeline first");
+		return;
+	}
+	BitmapPixels input(env, inputBitmap);
+	BitmapPixels output(env, outputBitmap);
+	if(!input.pixels || !output.pixels)
+	{
+		LOGE("Cannot lock the pixels of the bitmaps");
+		return;
+	}
 
-	cl_image_format image_format;
-	image_format.image_channel_data_type=CL_UNORM_INT8;
-	image_format.image_channel_order=CL_RGBA;
+	timeval start;
+	gettimeofday(&start, NULL);
 
-	//        http://www.khronos.org/registry/cl/sdk/1.1/docs/man/xhtml/clCreateImage2D.html
-	openCLObjects.inputBuffer =
-			clCreateImage2D(openCLObjects.context,
-					CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-					&image_format,
-					bitmapInfo.width,
-					bitmapInfo.height,
-					0,
-					inputPixels,
-					&err);
-	SAMPLE_CHECK_ERRORS(err);
+	executePipeline(*engine.currentSession, engine.pipeline, input.hostImage(), output.hostImage());
 
-	openCLObjects.isInputBufferInitialized = true;
+	float duration = elapsedSeconds(start);
+	(*env).CallVoidMethod(thisObject, setTimeFromJNIMethod, duration);
+	reportExecutionProfile(env, thisObject, *engine.currentSession);
+}
+	/*! \brief Runs the current kernel, or the pipeline of setPipeline, over a list of bitmaps in one call.
+	 *
+	 * The bitmaps are enqueued back to back with overlapping transfers, see executeBatch.
+	 * The total time is reported to setTimeFromJNI. Split mode runs the batch on the GPU.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param inputBitmaps is a java array with the bitmaps that have to be processed
+	 * @param outputBitmaps is a java array with a bitmap of the same size for every input bitmap
+	 * @return A java float array with the seconds each bitmap took from its submission until its result was back, or null on error.
+	 */
+extern "C" jfloatArray Java_com_denayer_ovsr_OpenCL_nativeBatchOpenCL
+(
+		JNIEnv* env,
+		jobject thisObject,
+		jobjectArray inputBitmaps,
+		jobjectArray outputBitmaps
+)
+{
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return 0;
+	OpenCLEngine& engine = *lock.engine;
 
-	AndroidBitmap_unlockPixels(env, inputBitmap);
+	if(!engine.currentSession || !engine.currentSession->kernel)
+	{
+		LOGE("nativeBatchOpenCL called without a kernel, call initOpenCL first");
+		return 0;
+	}
+	jsize count = env->GetArrayLength(inputBitmaps);
+	if(env->GetArrayLength(outputBitmaps) != count)
+	{
+		LOGE("nativeBatchOpenCL needs an output bitmap for every input bitmap");
+		return 0;
+	}
 
-	void* outputPixels = 0;
-	AndroidBitmap_lockPixels(env, outputBitmap, &outputPixels);
+	std::vector<PipelineStage> stages = engine.pipeline;
+	if(stages.empty())
+		stages.push_back(currentPipelineStage(*engine.currentSession));
 
-	cl_mem outputBuffer =
-			clCreateImage2D(openCLObjects.context,
-					CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR,
-					&image_format,
-					bitmapInfo.width,
-					bitmapInfo.height,
-					0,
-					outputPixels,
-					&err);
-	SAMPLE_CHECK_ERRORS(err);
-	err = clSetKernelArg(openCLObjects.kernel, 0, sizeof(openCLObjects.inputBuffer), &openCLObjects.inputBuffer);
-	SAMPLE_CHECK_ERRORS(err);
-	err = clSetKernelArg(openCLObjects.kernel, 1, sizeof(outputBuffer), &outputBuffer);
-	SAMPLE_CHECK_ERRORS(err);
-	cl_float saturatieVal = saturatie / 100 ;
-	err = clSetKernelArg(openCLObjects.kernel, 2, sizeof(cl_float), &saturatieVal);
-	SAMPLE_CHECK_ERRORS(err);
+	/*
+	 * The bitmaps are locked and run in chunks, which keeps the number
+	 * of local references below the limit of the JNI local reference table.
+	 */
+	std::vector<double> itemSeconds(count, 0);
+	cl_int err = CL_SUCCESS;
+	bool valid = true;
+	timeval start;
+	gettimeofday(&start, NULL);
+	for(jsize first = 0; first < count && valid && err == CL_SUCCESS; first += BATCH_CHUNK)
+	{
+		jsize last = std::min(count, first + BATCH_CHUNK);
+		std::vector<jobject> bitmaps;
+		std::vector<BitmapPixels*> locked;
+		std::vector<HostImage> inputs;
+		std::vector<HostImage> outputs;
+		for(jsize i = first; i < last && valid; i++)
+		{
+			bitmaps.push_back(env->GetObjectArrayElement(inputBitmaps, i));
+			bitmaps.push_back(env->GetObjectArrayElement(outputBitmaps, i));
+			BitmapPixels* input = new BitmapPixels(env, bitmaps[bitmaps.size() - 2]);
+			BitmapPixels* output = new BitmapPixels(env, bitmaps[bitmaps.size() - 1]);
+			locked.push_back(input);
+			locked.push_back(output);
+			if(!input->pixels || !output->pixels ||
+					input->info.width != output->info.width || input->info.height != output->info.height)
+			{
+				LOGE("Cannot lock batch bitmap %d, or its output has another size", (int)i);
+				valid = false;
+			}
+			inputs.push_back(input->hostImage());
+			outputs.push_back(output->hostImage());
+		}
 
-	size_t globalSize[2] = { bitmapInfo.width, bitmapInfo.height };
+		std::vector<double> chunkSeconds;
+		if(valid)
+			err = executeBatch(*engine.currentSession, stages, inputs, outputs, chunkSeconds);
+		for(size_t i = 0; i < chunkSeconds.size(); i++)
+			itemSeconds[first + i] = chunkSeconds[i];
+
+		// The bitmaps are unlocked before their local references are deleted.
+		for(size_t i = 0; i < locked.size(); i++)
+			delete locked[i];
+		for(size_t i = 0; i < bitmaps.size(); i++)
+			env->DeleteLocalRef(bitmaps[i]);
+	}
+	float duration = elapsedSeconds(start);
 
-	err = clEnqueueNDRangeKernel
-			(
-					openCLObjects.queue,
-					openCLObjects.kernel,
-					2,
-					0,
-					globalSize,
-					0,
-					0, 0, 0
-			);
-	SAMPLE_CHECK_ERRORS(err);
+	if(!valid)
+		return 0;
+	if(err != CL_SUCCESS)
+	{
+		LOGE("Cannot execute the batch: %s", opencl_error_to_str(err));
+		return 0;
+	}
 
-	err = clFinish(openCLObjects.queue);
-	SAMPLE_CHECK_ERRORS(err);
+	LOGD("Batch of %d bitmaps in %.1f ms, %.1f bitmaps/s", (int)count, duration * 1e3,
+			duration > 0 ? count / duration : 0);
+	(*env).CallVoidMethod(thisObject, setTimeFromJNIMethod, duration);
+
+	jfloatArray times = env->NewFloatArray(count);
+	if(!times)
+		return 0;
+	std::vector<jfloat> values(itemSeconds.begin(), itemSeconds.end());
+	if(count > 0)
+		env->SetFloatArrayRegion(times, 0, count, &values[0]);
+	return times;
+}
+	/*! \brief Runs the current kernel on a rectangle of a bitmap, see executeImage2DKernelRegion.
+	 *
+	 * Only the rectangle and the pixels the filter reads around it are transferred, and the
+	 * output bitmap keeps its pixels outside the rectangle. Set extra kernel arguments, like
+	 * setSaturatie, before. Split mode runs the region on the GPU.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param inputBitmap is the Android bitmap that has to be processed
+	 * @param outputBitmap receives the result in the rectangle, with the size of inputBitmap
+	 * @param x is the left column of the rectangle
+	 * @param y is the top row of the rectangle
+	 * @param width is the width of the rectangle in pixels
+	 * @param height is the height of the rectangle in pixels
+	 */
+extern "C" void Java_com_denayer_ovsr_OpenCL_nativeImage2DOpenCLRegion
+(
+		JNIEnv* env,
+		jobject thisObject,
+		jobject inputBitmap,
+		jobject outputBitmap,
+		jint x,
+		jint y,
+		jint width,
+		jint height
+)
+{
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return;
+	OpenCLEngine& engine = *lock.engine;
 
-    const size_t origin[3] = {0, 0, 0};
-    const size_t region[3] = {bitmapInfo.width, bitmapInfo.height, 1};
+	if(!engine.currentSession || !engine.currentSession->kernel)
+	{
+		LOGE("nativeImage2DOpenCLRegion called without a kernel, call initOpenCL first");
+		return;
+	}
+	if(x < 0 || y < 0 || width <= 0 || height <= 0)
+		return;
+	BitmapPixels input(env, inputBitmap);
+	BitmapPixels output(env, outputBitmap);
+	if(!input.pixels || !output.pixels)
+	{
+		LOGE("Cannot lock the pixels of the bitmaps");
+		return;
+	}
+	if(input.info.width != output.info.width || input.info.height != output.info.height)
+	{
+		LOGE("The output bitmap does not have the size of the input bitmap");
+		return;
+	}
 
-	err = clEnqueueReadImage(
-			openCLObjects.queue,
-			outputBuffer,
-			true,
-			origin,
-			region,
-			0,
-			0,
-			outputPixels,
-			0,
-			0,
-			0);
-	SAMPLE_CHECK_ERRORS(err);
+	ImageRegion region;
+	region.x = x;
+	region.y = y;
+	region.width = width;
+	region.height = height;
 
+	timeval start;
+	gettimeofday(&start, NULL);
 
-	// Call clFinish to guarantee that the output region is updated.
-	err = clFinish(openCLObjects.queue);
-	SAMPLE_CHECK_ERRORS(err);
+	executeImage2DKernelRegion(*engine.currentSession, input.hostImage(), output.hostImage(), region);
 
-	err = clReleaseMemObject(outputBuffer);
-	SAMPLE_CHECK_ERRORS(err);
+	float duration = elapsedSeconds(start);
+	(*env).CallVoidMethod(thisObject, setTimeFromJNIMethod, duration);
+	reportExecutionProfile(env, thisObject, *engine.currentSession);
+}
+	/*! \brief Describes the input and output ByteBuffers of the *Buffer entry points as host pixels.
+	 *
+	 * @return False when there is no kernel or a buffer is not usable.
+	 */
+static bool directBufferPair
+(
+		JNIEnv* env,
+		OpenCLEngine& engine,
+		const char* caller,
+		jobject inputBuffer,
+		jobject outputBuffer,
+		jint width,
+		jint height,
+		jint stride,
+		HostImage* input,
+		HostImage* output
+)
+{
+	if(!engine.currentSession || !engine.currentSession->kernel)
+	{
+		LOGE("%s called without a kernel, call initOpenCL first", caller);
+		return false;
+	}
+	return directBufferImage(env, inputBuffer, width, height, stride, 4, input) &&
+			directBufferImage(env, outputBuffer, width, height, stride, 4, output);
+}
+	/*! \brief Works like nativeImage2DOpenCL on RGBA pixels in direct ByteBuffers instead of bitmaps.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param inputBuffer is a direct ByteBuffer with the pixels that have to be processed
+	 * @param outputBuffer is a direct ByteBuffer that receives the result of the OpenCL kernel
+	 * @param width is the width of the image in pixels
+	 * @param height is the height of the image in pixels
+	 * @param stride is the number of bytes per row of both buffers
+	 */
+extern "C" void Java_com_denayer_ovsr_OpenCL_nativeImage2DOpenCLBuffer
+(
+		JNIEnv* env,
+		jobject thisObject,
+		jobject inputBuffer,
+		jobject outputBuffer,
+		jint width,
+		jint height,
+		jint stride
+)
+{
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return;
+	OpenCLEngine& engine = *lock.engine;
 
-	// Make the output content be visible at the Java side by unlocking
-	// pixels in the output bitmap object.
-	AndroidBitmap_unlockPixels(env, outputBitmap);
-
-//	gettimeofday(&end, NULL);
-//
-//	float ndrangeDuration =
-//			(end.tv_sec + end.tv_usec * 1e-6) - (start.tv_sec + start.tv_usec * 1e-6);
-//
-//	LOGD("nativeBasicOpenCL ends successfully");
-//
-//	jclass MyJavaClass = (*env).FindClass("com/denayer/ovsr/OpenCL");
-//	if (!MyJavaClass){
-//		LOGD("Aj :(");
-//		return;} /* method not found */
-//	jmethodID setTimeFromJNI = (*env).GetMethodID(MyJavaClass, "setTimeFromJNI", "(F)V"); //argument is float, return time is void
-//	(*env).CallVoidMethod(thisObject, setTimeFromJNI, ndrangeDuration);
+	HostImage input;
+	HostImage output;
+	if(!directBufferPair(env, engine, "nativeImage2DOpenCLBuffer", inputBuffer, outputBuffer, width, height, stride, &input, &output))
+		return;
+	nativeImage2DOpenCL(env, thisObject, *engine.currentSession, engine.splitSession, input, output);
 }
-	/*! \brief This function enables the connection between nativeSaturatieImage2DOpenCL and Java. 
-	 * 
+	/*! \brief Works like nativeSaturatieImage2DOpenCL on RGBA pixels in direct ByteBuffers instead of bitmaps.
+	 *
 	 * @param env is a pointer to the java environment where this function is called.
 	 * @param thisObject is a java object to be able to access java data from the native code
-	 * @param inputBitmap is the Android bitmap that has to be processed
-	 * @param outputBitmap is the result of the OpenCL kernel
+	 * @param inputBuffer is a direct ByteBuffer with the pixels that have to be processed
+	 * @param outputBuffer is a direct ByteBuffer that receives the result of the OpenCL kernel
+	 * @param width is the width of the image in pixels
+	 * @param height is the height of the image in pixels
+	 * @param stride is the number of bytes per row of both buffers
 	 * @param saturatie is the value to saturate with
 	 */
-extern "C" void Java_com_denayer_ovsr_OpenCL_nativeSaturatieImage2DOpenCL
+extern "C" void Java_com_denayer_ovsr_OpenCL_nativeSaturatieImage2DOpenCLBuffer
 (
 		JNIEnv* env,
 		jobject thisObject,
-		jobject inputBitmap,
-		jobject outputBitmap,
+		jobject inputBuffer,
+		jobject outputBuffer,
+		jint width,
+		jint height,
+		jint stride,
 		jfloat saturatie
 )
 {
-	nativeSaturatieImage2DOpenCL
-	(
-			env,
-			thisObject,
-			openCLObjects,
-			inputBitmap,
-			outputBitmap,
-			saturatie
-	);
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return;
+	OpenCLEngine& engine = *lock.engine;
+
+	HostImage input;
+	HostImage output;
+	if(!directBufferPair(env, engine, "nativeSaturatieImage2DOpenCLBuffer", inputBuffer, outputBuffer, width, height, stride, &input, &output))
+		return;
+	nativeSaturatieImage2DOpenCL(env, thisObject, *engine.currentSession, engine.splitSession, input, output, saturatie);
+}
+	/*! \brief Switches zero-copy transfers on or off for all sessions.
+	 *
+	 * By default zero-copy is used on devices with unified host memory.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param enable is true to share host memory with the device, false to copy
+	 */
+extern "C" void Java_com_denayer_ovsr_OpenCL_setZeroCopy
+(
+		JNIEnv* env,
+		jobject thisObject,
+		jboolean enable
+)
+{
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return;
+	OpenCLEngine& engine = *lock.engine;
+
+	engine.zeroCopyOverride = enable ? 1 : 0;
+	for(size_t i = 0; i < engine.sessions.size(); i++)
+	{
+		if(engine.sessions[i])
+			engine.sessions[i]->zeroCopy = enable;
+	}
+}
+	/*! \brief Starts streaming video frames through the current kernel or pipeline.
+	 *
+	 * Call initOpenCL or setPipeline first. Set extra arguments of a single kernel, like
+	 * setSaturatie, before submitting frames. A stream that is still open is closed first.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param width is the width of the frames in pixels
+	 * @param height is the height of the frames in pixels
+	 * @param packedBGR is true to submit 3 byte BGR frames with nativeStreamSubmitBGR, false for bitmaps
+	 * @return True when the stream was created.
+	 */
+extern "C" jboolean Java_com_denayer_ovsr_OpenCL_nativeStreamStart
+(
+		JNIEnv* env,
+		jobject thisObject,
+		jint width,
+		jint height,
+		jboolean packedBGR
+)
+{
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return JNI_FALSE;
+	OpenCLEngine& engine = *lock.engine;
+
+	releaseVideoStream(engine.videoStream);
+	engine.videoStream = 0;
+	if(!engine.currentSession || !engine.currentSession->kernel)
+	{
+		LOGE("nativeStreamStart called without a kernel, call initOpenCL first");
+		return false;
+	}
+	// Negative sizes would wrap around to huge ones, like in directBufferImage.
+	if(width <= 0 || height <= 0)
+	{
+		LOGE("The frame size %dx%d is not valid", (int)width, (int)height);
+		return false;
+	}
+
+	std::vector<PipelineStage> stages = engine.pipeline;
+	if(stages.empty())
+		stages.push_back(currentPipelineStage(*engine.currentSession));
+
+	cl_int err = CL_SUCCESS;
+	engine.videoStream = createVideoStream(*engine.currentSession, stages, width, height, packedBGR, &err);
+	if(!engine.videoStream)
+	{
+		LOGE("Cannot create the video stream: %s", opencl_error_to_str(err));
+		return false;
+	}
+	return true;
+}
+	/*! \brief Submits a video frame and returns the result of an older frame when one is done.
+	 *
+	 * The stream keeps VIDEO_STREAM_SLOTS frames in flight, so the result lags behind the input.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param inputBitmap is the new frame, it can be reused as soon as the call returns
+	 * @param outputBitmap receives the result of an older frame
+	 * @return True when outputBitmap was written.
+	 */
+extern "C" jboolean Java_com_denayer_ovsr_OpenCL_nativeStreamSubmit
+(
+		JNIEnv* env,
+		jobject thisObject,
+		jobject inputBitmap,
+		jobject outputBitmap
+)
+{
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return JNI_FALSE;
+	OpenCLEngine& engine = *lock.engine;
+
+	if(!engine.videoStream || engine.videoStream->pixelBytes != 4)
+	{
+		LOGE("nativeStreamSubmit called without a bitmap stream, call nativeStreamStart first");
+		return false;
+	}
+	BitmapPixels input(env, inputBitmap);
+	BitmapPixels output(env, outputBitmap);
+	if(!input.pixels || !output.pixels)
+	{
+		LOGE("Cannot lock the pixels of the bitmaps");
+		return false;
+	}
+	if(input.info.width != engine.videoStream->width || input.info.height != engine.videoStream->height ||
+			output.info.width != engine.videoStream->width || output.info.height != engine.videoStream->height)
+	{
+		LOGE("The bitmaps do not have the size of the video stream");
+		return false;
+	}
+
+	bool outputReady = false;
+	cl_int err = submitVideoFrame(*engine.videoStream, input.hostImage(), output.hostImage(), &outputReady);
+	if(err != CL_SUCCESS)
+		LOGE("Cannot submit the video frame: %s", opencl_error_to_str(err));
+	return outputReady;
+}
+	/*! \brief Submits a packed BGR video frame, see nativeStreamSubmit.
+	 *
+	 * The frame is converted to RGBA and back on the device, so frames of FFmpegFrameGrabber
+	 * can be recorded without cvCvtColor. The stream has to be started with packedBGR set.
+	 * The device downloads the result straight into output, so unlike nativeStreamSubmit
+	 * every frame needs its own output until it is returned.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param input is a direct ByteBuffer with the new frame, it can be reused as soon as the call returns
+	 * @param inputStride is the number of bytes per row of input
+	 * @param output is a direct ByteBuffer that receives the result of this frame, it must not be
+	 * touched until the frame is returned by a later call
+	 * @param outputStride is the number of bytes per row of output
+	 * @return STREAM_FRAME_READY when the output of the frame submitted VIDEO_STREAM_SLOTS calls before
+	 * holds its result, STREAM_NO_FRAME when no frame is done yet, STREAM_ERROR when the frame failed.
+	 */
+extern "C" jint Java_com_denayer_ovsr_OpenCL_nativeStreamSubmitBGR
+(
+		JNIEnv* env,
+		jobject thisObject,
+		jobject input,
+		jint inputStride,
+		jobject output,
+		jint outputStride
+)
+{
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return STREAM_ERROR;
+	OpenCLEngine& engine = *lock.engine;
+
+	if(!engine.videoStream || engine.videoStream->pixelBytes != 3)
+	{
+		LOGE("nativeStreamSubmitBGR called without a BGR stream, call nativeStreamStart first");
+		return STREAM_ERROR;
+	}
+	HostImage inputImage;
+	HostImage outputImage;
+	jint width = (jint)engine.videoStream->width;
+	jint height = (jint)engine.videoStream->height;
+	if(!directBufferImage(env, input, width, height, inputStride, 3, &inputImage) ||
+			!directBufferImage(env, output, width, height, outputStride, 3, &outputImage))
+		return STREAM_ERROR;
+
+	bool outputReady = false;
+	cl_int err = submitVideoFrame(*engine.videoStream, inputImage, outputImage, &outputReady);
+	if(err != CL_SUCCESS)
+	{
+		LOGE("Cannot submit the video frame: %s", opencl_error_to_str(err));
+		return STREAM_ERROR;
+	}
+	return outputReady ? STREAM_FRAME_READY : STREAM_NO_FRAME;
+}
+	/*! \brief Finishes the oldest packed BGR frame in flight, see nativeStreamFlush.
+	 *
+	 * The result is in the output the frame was submitted with.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @return STREAM_FRAME_READY when a frame was finished, STREAM_NO_FRAME when no frame is left,
+	 * STREAM_ERROR when the frame failed.
+	 */
+extern "C" jint Java_com_denayer_ovsr_OpenCL_nativeStreamFlushBGR
+(
+		JNIEnv* env,
+		jobject thisObject
+)
+{
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return STREAM_ERROR;
+	OpenCLEngine& engine = *lock.engine;
+
+	if(!engine.videoStream || engine.videoStream->pixelBytes != 3)
+		return STREAM_ERROR;
+
+	bool outputReady = false;
+	cl_int err = flushVideoFrame(*engine.videoStream, 0, &outputReady);
+	if(err != CL_SUCCESS)
+	{
+		LOGE("Cannot finish the video frame: %s", opencl_error_to_str(err));
+		return STREAM_ERROR;
+	}
+	return outputReady ? STREAM_FRAME_READY : STREAM_NO_FRAME;
+}
+	/*! \brief Returns the result of the oldest frame in flight, call it until it returns false after the last frame.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param outputBitmap receives the result
+	 * @return True when outputBitmap was written, false when no frame is left.
+	 */
+extern "C" jboolean Java_com_denayer_ovsr_OpenCL_nativeStreamFlush
+(
+		JNIEnv* env,
+		jobject thisObject,
+		jobject outputBitmap
+)
+{
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return JNI_FALSE;
+	OpenCLEngine& engine = *lock.engine;
+
+	if(!engine.videoStream || engine.videoStream->pixelBytes != 4)
+		return false;
+	BitmapPixels output(env, outputBitmap);
+	if(!output.pixels)
+	{
+		LOGE("Cannot lock the pixels of the bitmap");
+		return false;
+	}
+	if(output.info.width != engine.videoStream->width || output.info.height != engine.videoStream->height)
+	{
+		LOGE("The bitmap does not have the size of the video stream");
+		return false;
+	}
+
+	bool outputReady = false;
+	HostImage outputImage = output.hostImage();
+	cl_int err = flushVideoFrame(*engine.videoStream, &outputImage, &outputReady);
+	if(err != CL_SUCCESS)
+		LOGE("Cannot finish the video frame: %s", opencl_error_to_str(err));
+	return outputReady;
+}
+	/*! \brief Closes the video stream. Frames that are still in flight are dropped.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 */
+extern "C" void Java_com_denayer_ovsr_OpenCL_nativeStreamStop
+(
+		JNIEnv* env,
+		jobject thisObject
+)
+{
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return;
+	OpenCLEngine& engine = *lock.engine;
+
+	releaseVideoStream(engine.videoStream);
+	engine.videoStream = 0;
+}
+	/*! \brief Sets the saturation of the current kernel for the frames that are submitted next.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param saturatie is the saturation in percent
+	 */
+extern "C" void Java_com_denayer_ovsr_OpenCL_setSaturatie
+(
+		JNIEnv* env,
+		jobject thisObject,
+		jfloat saturatie
+)
+{
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return;
+	OpenCLEngine& engine = *lock.engine;
+
+	if(!engine.currentSession || !engine.currentSession->kernel)
+	{
+		LOGE("setSaturatie called without a kernel, call initOpenCL first");
+		return;
+	}
+	cl_int err = setSaturatieArg(*engine.currentSession, saturatie);
+	SAMPLE_CHECK_ERRORS(err);
+}
+	/*! \brief Opens a downsampled preview of a bitmap for the current kernel.
+	 *
+	 * Call initOpenCL with the filter first. The preview stays on the device until
+	 * nativePreviewStop, so moving a slider only runs the kernel on the small copy.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param inputBitmap is the full resolution Android bitmap
+	 * @param maxSide is the longest side of the preview in pixels
+	 * @return A java int array with the width and height of the preview, or null on error.
+	 */
+extern "C" jintArray Java_com_denayer_ovsr_OpenCL_nativePreviewStart
+(
+		JNIEnv* env,
+		jobject thisObject,
+		jobject inputBitmap,
+		jint maxSide
+)
+{
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return 0;
+	OpenCLEngine& engine = *lock.engine;
+
+	releaseResidentImage(engine.preview);
+	if(!engine.currentSession || !engine.currentSession->kernel || maxSide <= 0)
+	{
+		LOGE("nativePreviewStart called without a kernel, call initOpenCL first");
+		return 0;
+	}
+	BitmapPixels input(env, inputBitmap);
+	if(!input.pixels)
+	{
+		LOGE("Cannot lock the pixels of the bitmap");
+		return 0;
+	}
+
+	cl_int err = startImagePreview(*engine.currentSession, input.hostImage(), maxSide, engine.preview);
+	if(err != CL_SUCCESS)
+	{
+		LOGE("Cannot open the preview: %s", opencl_error_to_str(err));
+		return 0;
+	}
+
+	jintArray size = env->NewIntArray(2);
+	if(!size)
+		return 0;
+	jint values[2] = { (jint)engine.preview.width, (jint)engine.preview.height };
+	env->SetIntArrayRegion(size, 0, 2, values);
+	return size;
+}
+	/*! \brief Renders the preview with the current kernel and its current arguments, like setSaturatie.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param previewBitmap receives the result, with the size nativePreviewStart returned
+	 * @return True when previewBitmap was written.
+	 */
+extern "C" jboolean Java_com_denayer_ovsr_OpenCL_nativePreviewRender
+(
+		JNIEnv* env,
+		jobject thisObject,
+		jobject previewBitmap
+)
+{
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return JNI_FALSE;
+	OpenCLEngine& engine = *lock.engine;
+
+	if(!engine.preview.session || engine.preview.session != engine.currentSession)
+	{
+		LOGE("nativePreviewRender called without a preview for the current session");
+		return false;
+	}
+	BitmapPixels output(env, previewBitmap);
+	if(!output.pixels || output.info.width != engine.preview.width || output.info.height != engine.preview.height)
+	{
+		LOGE("The preview bitmap can not be locked or does not have the preview size");
+		return false;
+	}
+
+	cl_int err = renderResidentImage(engine.preview, output.hostImage());
+	if(err != CL_SUCCESS)
+	{
+		LOGE("Cannot render the preview: %s", opencl_error_to_str(err));
+		return false;
+	}
+	return true;
+}
+	/*! \brief Closes the preview of nativePreviewStart.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 */
+extern "C" void Java_com_denayer_ovsr_OpenCL_nativePreviewStop
+(
+		JNIEnv* env,
+		jobject thisObject
+)
+{
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return;
+	OpenCLEngine& engine = *lock.engine;
+
+	releaseResidentImage(engine.preview);
+}
+	/*! \brief Keeps a copy of a bitmap on the device of the current session for nativeRerunPinned.
+	 *
+	 * Call initOpenCL first, so the bitmap lands on the device that runs the kernel.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param inputBitmap is the Android bitmap that is going to be processed several times
+	 * @return True when the bitmap is on the device.
+	 */
+extern "C" jboolean Java_com_denayer_ovsr_OpenCL_nativePinInput
+(
+		JNIEnv* env,
+		jobject thisObject,
+		jobject inputBitmap
+)
+{
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return JNI_FALSE;
+	OpenCLEngine& engine = *lock.engine;
+
+	releaseResidentImage(engine.pinnedInput);
+	if(!engine.currentSession)
+	{
+		LOGE("nativePinInput called without a session, call initOpenCL first");
+		return false;
+	}
+	BitmapPixels input(env, inputBitmap);
+	if(!input.pixels)
+	{
+		LOGE("Cannot lock the pixels of the bitmap");
+		return false;
+	}
+
+	cl_int err = pinHostImage(*engine.currentSession, input.hostImage(), engine.pinnedInput);
+	if(err != CL_SUCCESS)
+	{
+		LOGE("Cannot pin the input: %s", opencl_error_to_str(err));
+		return false;
+	}
+	return true;
+}
+	/*! \brief Checks the arguments of a KernelArgs object and sets them on the current kernel.
+	 *
+	 * They are set on the uchar4 variant of the kernel and on the kernel of the split session as well.
+	 * When they do not fit, the reason goes to the console.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param engine is the engine that holds the current kernel
+	 * @param types is a java int array with the KERNEL_ARG_* type of every argument
+	 * @param ints is a java int array with the values of the int arguments
+	 * @param floats is a java float array with the values of the float arguments
+	 * @param arrays is a java array with the float arrays of the float array arguments
+	 * @return True when the arguments are set.
+	 */
+static bool applyKernelArguments
+(
+		JNIEnv* env,
+		jobject thisObject,
+		OpenCLEngine& engine,
+		jintArray types,
+		jintArray ints,
+		jfloatArray floats,
+		jobjectArray arrays
+)
+{
+	jsize count = env->GetArrayLength(types);
+	std::vector<KernelArgument> args(count);
+	if(count > 0)
+	{
+		std::vector<jint> typeValues(count);
+		std::vector<jint> intValues(count);
+		std::vector<jfloat> floatValues(count);
+		env->GetIntArrayRegion(types, 0, count, &typeValues[0]);
+		env->GetIntArrayRegion(ints, 0, count, &intValues[0]);
+		env->GetFloatArrayRegion(floats, 0, count, &floatValues[0]);
+		for(jsize i = 0; i < count; i++)
+		{
+			args[i].type = typeValues[i];
+			args[i].intValue = intValues[i];
+			args[i].floatValue = floatValues[i];
+			if(typeValues[i] != KERNEL_ARG_FLOAT_ARRAY)
+				continue;
+			jfloatArray array = (jfloatArray)env->GetObjectArrayElement(arrays, i);
+			if(!array)
+				continue;
+			jsize length = env->GetArrayLength(array);
+			args[i].floats.resize(length);
+			if(length > 0)
+				env->GetFloatArrayRegion(array, 0, length, &args[i].floats[0]);
+			env->DeleteLocalRef(array);
+		}
+	}
+
+	std::string message;
+	if(!checkKernelArguments(*engine.currentSession, args, message))
+	{
+		LOGE("%s", message.c_str());
+		jstring JavaString = (*env).NewStringUTF(message.c_str());
+		(*env).CallVoidMethod(thisObject, setConsoleOutputMethod, JavaString);
+		(*env).DeleteLocalRef(JavaString);
+		return false;
+	}
+	cl_int err = setKernelArguments(*engine.currentSession, engine.currentSession->kernel, args);
+	cl_kernel variant = integerVariant(*engine.currentSession);
+	if(err == CL_SUCCESS && variant)
+		err = setKernelArguments(*engine.currentSession, variant, args);
+	if(err == CL_SUCCESS && engine.splitSession && engine.splitSession != engine.currentSession)
+		err = setKernelArguments(*engine.splitSession, engine.splitSession->kernel, args);
+	if(err != CL_SUCCESS)
+	{
+		LOGE("Cannot set the kernel arguments: %s", opencl_error_to_str(err));
+		return false;
+	}
+	return true;
+}
+	/*! \brief Runs the current kernel on the pinned input with new typed arguments.
+	 *
+	 * Only the arguments are set, the kernel is enqueued and the result is read back,
+	 * the input is not uploaded again. The arguments are checked like in nativeImage2DOpenCLArgs.
+	 * Without arguments the kernel runs with the arguments that are set, for example by setSaturatie.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param outputBitmap receives the result, with the size of the pinned bitmap
+	 * @param types is a java int array with the KERNEL_ARG_* type of every argument
+	 * @param ints is a java int array with the values of the int arguments
+	 * @param floats is a java float array with the values of the float arguments
+	 * @param arrays is a java array with the float arrays of the float array arguments
+	 * @return True when outputBitmap was written.
+	 */
+extern "C" jboolean Java_com_denayer_ovsr_OpenCL_nativeRerunPinned
+(
+		JNIEnv* env,
+		jobject thisObject,
+		jobject outputBitmap,
+		jintArray types,
+		jintArray ints,
+		jfloatArray floats,
+		jobjectArray arrays
+)
+{
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return JNI_FALSE;
+	OpenCLEngine& engine = *lock.engine;
+
+	ResidentImage& pinned = engine.pinnedInput;
+	if(!pinned.session || pinned.session != engine.currentSession || !pinned.session->kernel)
+	{
+		LOGE("nativeRerunPinned called without a pinned input for the current kernel, call nativePinInput first");
+		return false;
+	}
+	BitmapPixels output(env, outputBitmap);
+	if(!output.pixels || output.info.width != pinned.width || output.info.height != pinned.height)
+	{
+		LOGE("The output bitmap can not be locked or does not have the size of the pinned input");
+		return false;
+	}
+
+	timeval start;
+	gettimeofday(&start, NULL);
+
+	OpenCLSession& openCLSession = *pinned.session;
+	if(env->GetArrayLength(types) > 0 && !applyKernelArguments(env, thisObject, engine, types, ints, floats, arrays))
+		return false;
+
+	ScopedEvent kernelEvent;
+	ScopedEvent readEvent;
+	cl_int err = renderResidentImage(pinned, output.hostImage(), &kernelEvent.event, &readEvent.event);
+	if(err != CL_SUCCESS)
+	{
+		LOGE("Cannot run the kernel on the pinned input: %s", opencl_error_to_str(err));
+		return false;
+	}
+
+	float duration = elapsedSeconds(start);
+	recordExecutionProfile(openCLSession, 0, kernelEvent.event, readEvent.event, duration);
+	(*env).CallVoidMethod(thisObject, setTimeFromJNIMethod, duration);
+	reportExecutionProfile(env, thisObject, openCLSession);
+	return true;
+}
+	/*! \brief Releases the pinned input of nativePinInput.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 */
+extern "C" void Java_com_denayer_ovsr_OpenCL_nativeUnpinInput
+(
+		JNIEnv* env,
+		jobject thisObject
+)
+{
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return;
+	OpenCLEngine& engine = *lock.engine;
+
+	releaseResidentImage(engine.pinnedInput);
+}
+	/*! \brief Excecutes a median filter with a radius.
+	 *
+	 * Call initOpenCL("mediaan") first to select the session. Radius 1 and 2 run the
+	 * sorting network and forgetful selection kernels, also in split mode. Larger radii
+	 * run the sliding histogram median on the current session, see Median.cpp.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param inputBitmap is the Android bitmap that has to be processed
+	 * @param outputBitmap is the result of the median filter
+	 * @param radius is the radius of the square window, from 1 to MEDIAN_MAX_RADIUS
+	 */
+extern "C" void Java_com_denayer_ovsr_OpenCL_nativeMedianOpenCL
+(
+		JNIEnv* env,
+		jobject thisObject,
+		jobject inputBitmap,
+		jobject outputBitmap,
+		jint radius
+)
+{
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return;
+	OpenCLEngine& engine = *lock.engine;
+
+	if(!engine.currentSession)
+	{
+		LOGE("nativeMedianOpenCL called without a session, call initOpenCL first");
+		return;
+	}
+	if(radius < 1)
+	{
+		LOGE("The median radius has to be at least 1, not %d", (int)radius);
+		return;
+	}
+	if(radius > MEDIAN_MAX_RADIUS)
+	{
+		LOGE("The median radius can be at most %d, not %d", MEDIAN_MAX_RADIUS, (int)radius);
+		return;
+	}
+	BitmapPixels input(env, inputBitmap);
+	BitmapPixels output(env, outputBitmap);
+	if(!input.pixels || !output.pixels)
+	{
+		LOGE("Cannot lock the pixels of the bitmaps");
+		return;
+	}
+
+	if(radius <= 2)
+	{
+		if(!selectMedianKernel(*engine.currentSession, radius))
+			return;
+		// Without the kernel on the second device only this call runs unsplit.
+		OpenCLSession* splitSession = engine.splitSession;
+		if(splitSession && !selectMedianKernel(*splitSession, radius))
+			splitSession = 0;
+		nativeImage2DOpenCL
+		(
+				env,
+				thisObject,
+				*engine.currentSession,
+				splitSession,
+				input.hostImage(),
+				output.hostImage()
+		);
+		return;
+	}
+
+	timeval start;
+	gettimeofday(&start, NULL);
+	executeMedianHistogram(*engine.currentSession, input.hostImage(), output.hostImage(), radius);
+	float duration = elapsedSeconds(start);
+	(*env).CallVoidMethod(thisObject, setTimeFromJNIMethod, duration);
+	reportExecutionProfile(env, thisObject, *engine.currentSession);
+}
+	/*! \brief Excecutes the current kernel with typed arguments from argument 2 on.
+	 *
+	 * The arguments are described by a KernelArgs object in Java, as parallel arrays with
+	 * one entry per argument. They are checked against the kernel first, see KernelArgs.cpp.
+	 * When they do not fit, the reason goes to the console and the kernel does not run.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param inputBitmap is the Android bitmap that has to be processed
+	 * @param outputBitmap is the result of the OpenCL kernel
+	 * @param types is a java int array with the KERNEL_ARG_* type of every argument
+	 * @param ints is a java int array with the values of the int arguments
+	 * @param floats is a java float array with the values of the float arguments
+	 * @param arrays is a java array with the float arrays of the float array arguments
+	 * @return True when the kernel ran.
+	 */
+extern "C" jboolean Java_com_denayer_ovsr_OpenCL_nativeImage2DOpenCLArgs
+(
+		JNIEnv* env,
+		jobject thisObject,
+		jobject inputBitmap,
+		jobject outputBitmap,
+		jintArray types,
+		jintArray ints,
+		jfloatArray floats,
+		jobjectArray arrays
+)
+{
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return JNI_FALSE;
+	OpenCLEngine& engine = *lock.engine;
+
+	if(!engine.currentSession || !engine.currentSession->kernel)
+	{
+		LOGE("nativeImage2DOpenCLArgs called without a kernel, call initOpenCL first");
+		return false;
+	}
+
+	if(!applyKernelArguments(env, thisObject, engine, types, ints, floats, arrays))
+		return false;
+
+	BitmapPixels input(env, inputBitmap);
+	BitmapPixels output(env, outputBitmap);
+	if(!input.pixels || !output.pixels)
+	{
+		LOGE("Cannot lock the pixels of the bitmaps");
+		return false;
+	}
+	nativeImage2DOpenCL
+	(
+			env,
+			thisObject,
+			*engine.currentSession,
+			engine.splitSession,
+			input.hostImage(),
+			output.hostImage()
+	);
+	return true;
+}
+	/*! \brief Switches per-stage profiling on or off for all sessions.
+	 *
+	 * The command queues are recreated with or without CL_QUEUE_PROFILING_ENABLE.
+	 * In profiling mode every execution reports its upload, kernel, download and
+	 * host times to setProfileFromJNI. An open video stream is closed.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param enable is true to profile
+	 */
+extern "C" void Java_com_denayer_ovsr_OpenCL_setProfiling
+(
+		JNIEnv* env,
+		jobject thisObject,
+		jboolean enable
+)
+{
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return;
+	OpenCLEngine& engine = *lock.engine;
+
+	if(engine.profilingEnabled == (enable != 0))
+		return;
+	engine.profilingEnabled = (enable != 0);
+
+	releaseVideoStream(engine.videoStream);
+	engine.videoStream = 0;
+	for(size_t i = 0; i < engine.sessions.size(); i++)
+	{
+		if(!engine.sessions[i])
+			continue;
+		cl_int err = setSessionProfiling(*engine.sessions[i], engine.profilingEnabled);
+		if(err != CL_SUCCESS)
+			LOGE("Cannot recreate the command queue: %s", opencl_error_to_str(err));
+	}
+}
+	/*! \brief Describes every OpenCL device of every platform for Java.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @return A java string array with one line per device, see describeOpenCLDevice.
+	 */
+extern "C" jobjectArray Java_com_denayer_ovsr_OpenCL_getDeviceList
+(
+		JNIEnv* env,
+		jobject thisObject
+)
+{
+	EngineLock lock(env, thisObject);
+	if(!lock.engine)
+		return 0;
+	OpenCLEngine& engine = *lock.engine;
+
+	std::vector<OpenCLDeviceInfo>& devices = listOpenCLDevices(engine);
+	jclass stringClass = env->FindClass("java/lang/String");
+	jobjectArray list = env->NewObjectArray(devices.size(), stringClass, 0);
+	if(!list)
+		return 0;
+	for(size_t i = 0; i < devices.size(); i++)
+	{
+		jstring line = env->NewStringUTF(describeOpenCLDevice(devices[i]).c_str());
+		env->SetObjectArrayElement(list, i, line);
+		env->DeleteLocalRef(line);
+	}
+	return list;
 }
@@ -0,0 +1,705 @@
+#ifndef OVSR_H
+#define OVSR_H
+
+#define CL_USE_DEPRECATED_OPENCL_1_1_APIS
+
+#include <jni.h>
+#include <android/bitmap.h>
+#include <android/log.h>
+
+#include <string>
+#include <cstring>
+#include <sstream>
+#include <vector>
+#include <map>
+
+/*
+ * needed for the program cache and the work-group size database in EXECDIR
+ */
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+
+#include <sys/time.h>
+#include <pthread.h>
+
+#include <CL/opencl.h>
+
+#define BUILDOPT "-cl-single-precision-constant -cl-denorms-are-zero -cl-fast-relaxed-math"
+#define EXECDIR "/data/data/com.denayer.ovsr/app_execdir/"
+#define  LOG_TAG    "OpenCLnative"
+#define  LOGD(...)  __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+#define  LOGE(...)  __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+/*! A kernel that is compiled once and kept in the kernel table of a session.
+ */
+struct OpenCLKernelEntry
+{
+	cl_program program;
+	cl_kernel kernel;
+	std::string source;
+	bool boundsChecked; // the kernel returns for work-items outside the image, so its global size can be padded
+};
+
+/*! Identifies memory objects that can replace each other in the memory pool.
+ * Buffers use their size in bytes as width and 0 for the other image fields.
+ * hostPtr and rowPitch are only set for objects created with CL_MEM_USE_HOST_PTR,
+ * which are released when they are returned instead of being pooled.
+ */
+struct MemoryPoolKey
+{
+	size_t width;
+	size_t height;
+	cl_channel_order order;
+	cl_channel_type type;
+	cl_mem_flags flags;
+	void* hostPtr;
+	size_t rowPitch;
+
+	bool operator< (const MemoryPoolKey& other) const;
+};
+
+/*! Device images and buffers that are kept allocated between filter calls.
+ */
+struct MemoryPool
+{
+	MemoryPool() : returns(0) {}
+
+	std::multimap<MemoryPoolKey, cl_mem> freeObjects;
+	std::map<cl_mem, unsigned long> returnOrder; // number of the return that freed each free object
+	unsigned long returns;
+	std::map<cl_mem, MemoryPoolKey> checkedOut;
+	std::map<cl_mem, void*> hostMappings; // checked out objects that stay mapped for the host until they are returned
+};
+
+/*! Properties of one OpenCL device, filled by enumerateOpenCLDevices.
+ */
+struct OpenCLDeviceInfo
+{
+	OpenCLDeviceInfo() :
+		platform(0), device(0), type(0), computeUnits(0), clockMHz(0), imageSupport(false),
+		image2DMaxWidth(0), image2DMaxHeight(0), localMemSize(0), globalMemSize(0), maxMemAllocSize(0), failed(false) {}
+
+	cl_platform_id platform;
+	cl_device_id device;
+	std::string platformName;
+	std::string name;
+	cl_device_type type;
+	cl_uint computeUnits;
+	cl_uint clockMHz;
+	bool imageSupport;
+	size_t image2DMaxWidth;
+	size_t image2DMaxHeight;
+	cl_ulong localMemSize;
+	cl_ulong globalMemSize;
+	cl_ulong maxMemAllocSize;
+	bool failed; // no session could be created on the device
+};
+
+/*
+ * Device types Java passes as dev_type. In auto mode every kernel runs on the
+ * device with the highest measured throughput for it, see Devices.cpp. In split
+ * mode the GPU and the CPU each run a band of the image, see Split.cpp.
+ */
+#define DEV_TYPE_GPU 0
+#define DEV_TYPE_CPU 1
+#define DEV_TYPE_AUTO 2
+#define DEV_TYPE_SPLIT 3
+
+/*! Timestamps of one enqueued command in nanoseconds, see clGetEventProfilingInfo.
+ */
+struct CommandTimes
+{
+	cl_ulong queued;
+	cl_ulong submit;
+	cl_ulong start;
+	cl_ulong end;
+};
+
+/*! Stage times of the last execution of a session, filled in profiling mode.
+ */
+struct ExecutionProfile
+{
+	ExecutionProfile() : hostMs(0), valid(false) {}
+
+	CommandTimes upload;
+	CommandTimes kernel;
+	CommandTimes download;
+	float hostMs; // wall-clock time that was not spent on the three commands
+	bool valid;
+};
+
+/*! A session keeps the OpenCL objects alive between filter calls.
+ * Each engine has one session per device. It is created on the first initOpenCL
+ * or initOpenCLSession call that selects the device and released with the engine.
+ */
+struct OpenCLSession
+{
+	OpenCLSession() :
+		deviceIndex(-1), deviceType(0), platform(0), device(0), context(0), queue(0), isBundleBuilt(false),
+		kernel(0), kernelBoundsChecked(false), zeroCopy(false), hostPtrAlignment(0), profiling(false),
+		image2DMaxWidth(0), image2DMaxHeight(0), maxMemAllocSize(0) {}
+
+	int deviceIndex; // index in the device list of Devices.cpp
+	cl_device_type deviceType;
+	cl_platform_id platform;
+	cl_device_id device;
+	cl_context context;
+	cl_command_queue queue;
+	std::map<std::string, OpenCLKernelEntry> kernels;
+	bool isBundleBuilt; // the bundled filters are in the kernel table
+	cl_kernel kernel; // kernel selected by the last initOpenCL call
+	bool kernelBoundsChecked; // boundsChecked of the entry of kernel
+	std::string kernelKey; // kernel table key of kernel
+	MemoryPool memoryPool;
+	bool zeroCopy; // share host memory with the device instead of copying, see HostTransfer.cpp
+	size_t hostPtrAlignment; // CL_DEVICE_MEM_BASE_ADDR_ALIGN in bytes
+	bool profiling; // the queue has CL_QUEUE_PROFILING_ENABLE, see Profiling.cpp
+	ExecutionProfile lastProfile;
+	size_t image2DMaxWidth;   // device limits, larger images run in tiles, see Tiling.cpp
+	size_t image2DMaxHeight;
+	cl_ulong maxMemAllocSize;
+	std::map<std::string, cl_mem> constantBuffers; // float array kernel arguments by their bytes, see KernelArgs.cpp
+	std::map<std::string, bool> integerPathFaster; // per kernel key, the uchar4 variant was faster, see IntegerPath.cpp
+};
+
+/*! Pixels in host memory, for example the locked pixels of an Android bitmap.
+ */
+struct HostImage
+{
+	void* pixels;
+	size_t width;
+	size_t height;
+	size_t stride; // bytes per row
+};
+
+/*! A rectangle of an image in pixels, see Region.cpp.
+ */
+struct ImageRegion
+{
+	ImageRegion() : x(0), y(0), width(0), height(0) {}
+
+	size_t x;
+	size_t y;
+	size_t width;
+	size_t height;
+};
+
+/*
+ * Types of the kernel arguments of a KernelArgs object in Java, see KernelArgs.cpp.
+ */
+#define KERNEL_ARG_INT 0
+#define KERNEL_ARG_FLOAT 1
+#define KERNEL_ARG_FLOAT_ARRAY 2
+
+/*! One kernel argument from argument 2 on, only the field of its type is used.
+ */
+struct KernelArgument
+{
+	KernelArgument() : type(KERNEL_ARG_INT), intValue(0), floatValue(0) {}
+
+	int type;
+	cl_int intValue;
+	float floatValue;
+	std::vector<float> floats;
+};
+
+/*! One kernel of a filter pipeline, see Pipeline.cpp.
+ */
+struct PipelineStage
+{
+	PipelineStage() :
+		kernel(0), boundsChecked(false), numArgs(0),
+		workSizeChosen(false), useLocalSize(false), chosenWidth(0), chosenHeight(0) {}
+
+	std::string key; // kernel table key
+	cl_kernel kernel;
+	bool boundsChecked;
+	cl_uint numArgs;
+	std::vector<float> parameters; // float arguments 2 and up, like the saturation of saturatie
+	bool workSizeChosen; // globalSize and localSize are chosen with the first run of an image size
+	bool useLocalSize;
+	size_t globalSize[2];
+	size_t localSize[2];
+	size_t chosenWidth;  // image size the work sizes were chosen for
+	size_t chosenHeight;
+};
+
+/*
+ * Number of frames a video stream keeps in flight. With three slots frame N+1
+ * is uploaded and frame N-1 is read back while the kernel of frame N runs.
+ * OpenCL.java has the same constant for the outputs of packed BGR streams.
+ */
+#define VIDEO_STREAM_SLOTS 3
+
+// Results of the packed BGR stream calls, the same values as in OpenCL.java
+#define STREAM_ERROR -1
+#define STREAM_NO_FRAME 0
+#define STREAM_FRAME_READY 1
+
+/*! One frame of a video stream with its own staging memory and device images.
+ */
+struct VideoFrameSlot
+{
+	VideoFrameSlot() :
+		inputImage(0), outputImage(0), tempImage(0), inputBuffer(0), outputBuffer(0), readEvent(0), busy(false) {}
+
+	std::vector<unsigned char> input;  // staging copy of the input frame of bitmap streams, rows of width * 4
+	std::vector<unsigned char> output; // staging copy of the result of bitmap streams, read back by the download queue
+	cl_mem inputImage;
+	cl_mem outputImage;
+	cl_mem tempImage;                  // ping-pong image of streams with more than one stage
+	cl_mem inputBuffer;                // packed BGR frame, only for packed BGR streams
+	cl_mem outputBuffer;
+	cl_event readEvent;                // completes when output holds the result
+	bool busy;
+};
+
+/*! Runs a kernel, or a pipeline of kernels, over a sequence of frames with several frames in flight.
+ *
+ * Uploads and downloads go to their own queues, the kernels to the queue of the
+ * session, so the transfers of neighbouring frames overlap with the kernels.
+ */
+struct VideoStream
+{
+	VideoStream() :
+		session(0), unpackKernel(0), packKernel(0),
+		uploadQueue(0), downloadQueue(0), width(0), height(0), pixelBytes(0),
+		next(0), inFlight(0) {}
+
+	OpenCLSession* session;
+	std::vector<PipelineStage> stages; // the filter kernels, with their chosen work sizes
+	cl_kernel unpackKernel; // BGR to RGBA pre-stage of packed BGR streams, 0 for RGBA streams
+	cl_kernel packKernel;   // RGBA to BGR post-stage
+	cl_command_queue uploadQueue;
+	cl_command_queue downloadQueue;
+	size_t width;
+	size_t height;
+	size_t pixelBytes; // 4 for RGBA frames, 3 for packed BGR frames
+	size_t convertSize[2]; // global size of the convert kernels
+	VideoFrameSlot slots[VIDEO_STREAM_SLOTS];
+	size_t next;     // slot of the next submitted frame
+	size_t inFlight; // number of busy slots
+};
+
+/*! An input image and a result image that stay on the device between kernel runs, see Resident.cpp.
+ */
+struct ResidentImage
+{
+	ResidentImage() : session(0), sourceImage(0), resultImage(0), width(0), height(0) {}
+
+	OpenCLSession* session; // session that owns the images, 0 when the resident image is not open
+	cl_mem sourceImage;
+	cl_mem resultImage;
+	size_t width;
+	size_t height;
+};
+
+/*! The native state of one Java OpenCL object, which owns it through a jlong handle.
+ *
+ * Every native method locks the mutex of its engine for the whole call, so the calls
+ * of one Java object never interleave. Separate engines have their own sessions,
+ * with their own contexts, queues and kernels, and can run in parallel.
+ */
+struct OpenCLEngine
+{
+	OpenCLEngine() :
+		devicesListed(false), currentSession(0), splitSession(0), zeroCopyOverride(-1),
+		videoStream(0), profilingEnabled(false)
+	{
+		pthread_mutex_init(&mutex, 0);
+	}
+	~OpenCLEngine()
+	{
+		pthread_mutex_destroy(&mutex);
+	}
+
+	pthread_mutex_t mutex;
+	std::vector<OpenCLDeviceInfo> devices; // every device of every platform, see Devices.cpp
+	bool devicesListed;
+	std::vector<OpenCLSession*> sessions; // one per entry of devices, created on first use
+	OpenCLSession* currentSession; // session used by the execution functions
+	OpenCLSession* splitSession; // session of the second band in split mode, see Split.cpp
+	std::vector<PipelineStage> pipeline; // stages set by setPipeline, until initOpenCL selects a single kernel
+	int zeroCopyOverride; // -1 follows the device, 0 or 1 is set by Java
+	VideoStream* videoStream; // stream of the video filter, see VideoStream.cpp
+	ResidentImage preview; // downsampled preview of the interactive filters, see Preview.cpp
+	ResidentImage pinnedInput; // full resolution input for re-runs with other arguments
+	bool profilingEnabled; // queues are created with CL_QUEUE_PROFILING_ENABLE, set by Java
+
+private:
+	OpenCLEngine(const OpenCLEngine&);
+	OpenCLEngine& operator= (const OpenCLEngine&);
+};
+
+/*! Locks the pixels of an Android bitmap for as long as the object is in scope,
+ * so an early return never leaves a bitmap locked.
+ */
+class BitmapPixels
+{
+public:
+	BitmapPixels(JNIEnv* env, jobject bitmap) : pixels(0), mEnv(env), mBitmap(bitmap)
+	{
+		AndroidBitmap_getInfo(env, bitmap, &info);
+		if(AndroidBitmap_lockPixels(env, bitmap, &pixels) != 0)
+			pixels = 0;
+	}
+	~BitmapPixels()
+	{
+		if(pixels)
+			AndroidBitmap_unlockPixels(mEnv, mBitmap);
+	}
+
+	/*! \brief Describes the locked pixels as a host image. */
+	HostImage hostImage() const
+	{
+		HostImage image;
+		image.pixels = pixels;
+		image.width = info.width;
+		image.height = info.height;
+		image.stride = info.stride;
+		return image;
+	}
+
+	AndroidBitmapInfo info;
+	void* pixels;
+
+private:
+	JNIEnv* mEnv;
+	jobject mBitmap;
+};
+
+/*! Holds a memory object checked out from the memory pool of a session
+ * and returns it to the pool when the object goes out of scope.
+ */
+class PooledMemObject
+{
+public:
+	PooledMemObject(OpenCLSession& openCLSession) : memObject(0), mSession(openCLSession) {}
+	~PooledMemObject();
+
+	cl_mem memObject;
+
+private:
+	OpenCLSession& mSession;
+};
+
+/*! Releases an OpenCL event when the object goes out of scope.
+ */
+class ScopedEvent
+{
+public:
+	ScopedEvent() : event(0) {}
+	~ScopedEvent()
+	{
+		if(event)
+			clReleaseEvent(event);
+	}
+
+	cl_event event;
+
+private:
+	ScopedEvent(const ScopedEvent&);
+	ScopedEvent& operator= (const ScopedEvent&);
+};
+
+/*! Waits for the commands of a queue when the object goes out of scope, unless they are known to be done.
+ *
+ * Transfers are enqueued without blocking, so an early return must not unlock host
+ * memory that a pending command still reads or writes. Declare it after the host
+ * memory, so it is destroyed first, and call done() once the last event completed.
+ */
+class PendingCommands
+{
+public:
+	PendingCommands(cl_command_queue queue) : mQueue(queue) {}
+	~PendingCommands()
+	{
+		if(mQueue)
+			clFinish(mQueue);
+	}
+
+	void done() { mQueue = 0; }
+
+private:
+	cl_command_queue mQueue;
+
+	PendingCommands(const PendingCommands&);
+	PendingCommands& operator= (const PendingCommands&);
+};
+
+const char* opencl_error_to_str (cl_int error);
+
+/*! The following macro is used after each OpenCL call
+ * to check if OpenCL error occurs. In the case when ERR != CL_SUCCESS
+ * the macro forms an error message with OpenCL error code mnemonic,
+ * puts it to LogCat, and returns from a caller function.
+ */
+#define SAMPLE_CHECK_ERRORS(ERR)                                                      \
+		if(ERR != CL_SUCCESS)                                                             \
+		{                                                                                 \
+			LOGE                                                                          \
+			(                                                                             \
+					"OpenCL error with code %s happened in file %s at line %d. Exiting.\n",   \
+					opencl_error_to_str(ERR), __FILE__, __LINE__                              \
+			);                                                                            \
+			\
+			return;                                                                       \
+		}
+
+cl_program buildProgramWithCache
+(
+		OpenCLSession& openCLSession,
+		const std::string& source,
+		cl_int* errcode_ret
+);
+unsigned long long sourceHash(const std::string& source);
+
+cl_mem acquireImage2D
+(
+		OpenCLSession& openCLSession,
+		cl_mem_flags flags,
+		const cl_image_format& format,
+		size_t width,
+		size_t height,
+		void* hostPtr,
+		size_t rowPitch,
+		cl_int* errcode_ret
+);
+cl_mem acquireBuffer
+(
+		OpenCLSession& openCLSession,
+		cl_mem_flags flags,
+		size_t size,
+		void* hostPtr,
+		cl_int* errcode_ret
+);
+void returnToPool(OpenCLSession& openCLSession, cl_mem memObject);
+const MemoryPoolKey* findPoolKey(OpenCLSession& openCLSession, cl_mem memObject);
+void clearMemoryPool(OpenCLSession& openCLSession);
+
+void initHostTransfer(OpenCLSession& openCLSession);
+cl_mem acquireHostImage
+(
+		OpenCLSession& openCLSession,
+		cl_mem_flags access,
+		const cl_image_format& format,
+		const HostImage& host,
+		bool upload,
+		cl_event* event_ret,
+		cl_int* errcode_ret
+);
+cl_int downloadHostImage
+(
+		OpenCLSession& openCLSession,
+		cl_mem image,
+		const HostImage& host,
+		cl_event waitEvent,
+		cl_event* event_ret
+);
+cl_mem acquireHostBuffer
+(
+		OpenCLSession& openCLSession,
+		cl_mem_flags access,
+		void* hostPtr,
+		size_t size,
+		bool upload,
+		cl_event* event_ret,
+		cl_int* errcode_ret
+);
+cl_int downloadHostBuffer
+(
+		OpenCLSession& openCLSession,
+		cl_mem buffer,
+		void* hostPtr,
+		size_t size,
+		cl_event waitEvent,
+		cl_event* event_ret
+);
+float commandMilliseconds(const CommandTimes& times);
+cl_int setSessionProfiling(OpenCLSession& openCLSession, bool enable);
+void recordExecutionProfile
+(
+		OpenCLSession& openCLSession,
+		cl_event uploadEvent,
+		cl_event kernelEvent,
+		cl_event downloadEvent,
+		double wallSeconds,
+		cl_event lastKernelEvent = 0
+);
+
+bool chooseWorkSize
+(
+		OpenCLSession& openCLSession,
+		cl_kernel kernel,
+		size_t width,
+		size_t height,
+		bool padded,
+		size_t globalSize[2],
+		size_t localSize[2]
+);
+
+void copyRows(void* dst, size_t dstPitch, const void* src, size_t srcPitch, size_t rowSize, size_t rows);
+
+VideoStream* createVideoStream
+(
+		OpenCLSession& openCLSession,
+		const std::vector<PipelineStage>& stages,
+		size_t width,
+		size_t height,
+		bool packedBGR,
+		cl_int* errcode_ret
+);
+cl_int submitVideoFrame
+(
+		VideoStream& stream,
+		const HostImage& input,
+		const HostImage& output,
+		bool* outputReady
+);
+cl_int flushVideoFrame
+(
+		VideoStream& stream,
+		const HostImage* output,
+		bool* outputReady
+);
+void releaseVideoStream(VideoStream* stream);
+
+void enumerateOpenCLDevices(std::vector<OpenCLDeviceInfo>& devices);
+std::string describeOpenCLDevice(const OpenCLDeviceInfo& info);
+int bestDeviceOfType(const std::vector<OpenCLDeviceInfo>& devices, cl_device_type type);
+int chooseAutoDevice(const std::string& kernelKey, const std::vector<int>& candidates);
+void recordKernelThroughput(OpenCLSession& openCLSession, size_t pixels, double seconds);
+
+void executeImage2DKernel
+(
+		OpenCLSession& openCLSession,
+		const HostImage& input,
+		const HostImage& output
+);
+int splitHaloRows(const std::string& kernelKey);
+
+bool needsTiling(const OpenCLSession& openCLSession, size_t width, size_t height);
+void executeTiledImage2DKernel
+(
+		OpenCLSession& openCLSession,
+		const HostImage& input,
+		const HostImage& output
+);
+
+cl_int startImagePreview
+(
+		OpenCLSession& openCLSession,
+		const HostImage& input,
+		size_t maxSide,
+		ResidentImage& preview
+);
+cl_int pinHostImage
+(
+		OpenCLSession& openCLSession,
+		const HostImage& input,
+		ResidentImage& resident
+);
+cl_int renderResidentImage
+(
+		ResidentImage& resident,
+		const HostImage& output,
+		cl_event* kernelEvent_ret = 0,
+		cl_event* readEvent_ret = 0
+);
+void releaseResidentImage(ResidentImage& resident);
+
+bool clipImageRegion(ImageRegion& region, size_t width, size_t height);
+void executeImage2DKernelRegion
+(
+		OpenCLSession& openCLSession,
+		const HostImage& input,
+		const HostImage& output,
+		ImageRegion region
+);
+
+bool parseKernelSignature(const std::string& source, const std::string& function, std::vector<int>& types);
+bool checkKernelArguments
+(
+		OpenCLSession& openCLSession,
+		const std::vector<KernelArgument>& args,
+		std::string& message
+);
+cl_int setKernelArguments
+(
+		OpenCLSession& openCLSession,
+		cl_kernel kernel,
+		const std::vector<KernelArgument>& args
+);
+void releaseConstantBuffers(OpenCLSession& openCLSession);
+
+cl_kernel integerVariant(OpenCLSession& openCLSession);
+cl_kernel chooseIntegerPath(OpenCLSession& openCLSession, const HostImage& input);
+
+#define MEDIAN_MAX_RADIUS 127 // the window has to fit the ushort histogram bins of mediaan.cl
+bool selectMedianKernel(OpenCLSession& openCLSession, int radius);
+void executeMedianHistogram
+(
+		OpenCLSession& openCLSession,
+		const HostImage& input,
+		const HostImage& output,
+		int radius
+);
+
+void buildKernel
+(
+		JNIEnv* env,
+		jobject thisObject,
+		OpenCLSession& openCLSession,
+		const std::string& key,
+		const std::string& source,
+		const std::string& kernelFunction
+);
+
+PipelineStage currentPipelineStage(OpenCLSession& openCLSession);
+cl_int executeBatch
+(
+		OpenCLSession& openCLSession,
+		std::vector<PipelineStage>& stages,
+		const std::vector<HostImage>& inputs,
+		const std::vector<HostImage>& outputs,
+		std::vector<double>& itemSeconds
+);
+void fusePointwiseStages
+(
+		JNIEnv* env,
+		jobject thisObject,
+		OpenCLSession& openCLSession,
+		std::vector<PipelineStage>& stages
+);
+cl_int enqueuePipeline
+(
+		OpenCLSession& openCLSession,
+		std::vector<PipelineStage>& stages,
+		cl_mem input,
+		cl_mem output,
+		cl_mem temp,
+		size_t width,
+		size_t height,
+		cl_event uploadEvent,
+		bool waitForUpload,
+		cl_event* firstKernelEvent_ret,
+		cl_event* lastKernelEvent_ret
+);
+void executePipeline
+(
+		OpenCLSession& openCLSession,
+		std::vector<PipelineStage>& stages,
+		const HostImage& input,
+		const HostImage& output
+);
+void executeSplitImage2DKernel
+(
+		OpenCLSession& first,
+		OpenCLSession& second,
+		const HostImage& input,
+		const HostImage& output
+);
+
+#endif // OVSR_H
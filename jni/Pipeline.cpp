@@ -0,0 +1,390 @@
+#include "OVSR.h"
+
+/*
+ * Runs several kernels after each other on one image without host round trips.
+ *
+ * Only the input is uploaded and only the result of the last stage is read back.
+ * The stages in between write to two device images in turn: the last stage always
+ * writes the output image, the stage before it the temporary image, and so on back
+ * to the first stage, which reads the input image. All stages run on the in-order
+ * queue of the session, so only the first one waits for the upload.
+ *
+ * Neighbouring pointwise stages, which only read the pixel they write, are fused
+ * into one generated kernel that applies them one after the other in registers
+ * between a single read_imagef and write_imagef. Neighbourhood filters read the
+ * pixels around theirs from the image, so they end a group of fused stages.
+ */
+
+/*! A per-pixel filter that can be fused with its neighbours in a pipeline.
+ *
+ * The code works on float4 pixel and finds the parameter of its stage, if it has
+ * one, in the float parameter. It has to do what the kernel of the filter does.
+ */
+struct PointwiseOperation
+{
+	const char* key;
+	cl_uint parameters;
+	const char* code;
+};
+
+static const PointwiseOperation pointwiseOperations[] =
+{
+	{
+		"inverse", 0,
+		"        pixel.x = 1.0f-pixel.x;\n"
+		"        pixel.y = 1.0f-pixel.y;\n"
+		"        pixel.z = 1.0f-pixel.z;\n"
+	},
+	{
+		"saturatie", 1,
+		"        float P = sqrt(pixel.x*pixel.x*0.299f+pixel.y*pixel.y*0.587f+pixel.z*pixel.z*0.114f);\n"
+		"        pixel.x = P+(pixel.x-P)*parameter;\n"
+		"        pixel.y = P+(pixel.y-P)*parameter;\n"
+		"        pixel.z = P+(pixel.z-P)*parameter;\n"
+	}
+};
+
+/*! \brief Returns the pointwise operation of a kernel, or 0 for other kernels.
+ */
+static const PointwiseOperation* findPointwiseOperation(const std::string& kernelKey)
+{
+	for(size_t i = 0; i < sizeof(pointwiseOperations) / sizeof(pointwiseOperations[0]); i++)
+	{
+		if(kernelKey == pointwiseOperations[i].key)
+			return &pointwiseOperations[i];
+	}
+	return 0;
+}
+
+/*! \brief Generates the source of a kernel that applies a group of pointwise stages.
+ *
+ * The kernel takes the source and destination image and then one float per
+ * parameter of the stages, in stage order.
+ *
+ * @param operations are the operations of the stages, in the order they run
+ * @return The OpenCL code of fusedKernel.
+ */
+static std::string fusedKernelSource(const std::vector<const PointwiseOperation*>& operations)
+{
+	std::ostringstream source;
+	std::ostringstream body;
+	source << "__kernel void fusedKernel(__read_only  image2d_t  srcImage,\n"
+			<< "                          __write_only image2d_t  dstImage";
+	int parameter = 0;
+	for(size_t i = 0; i < operations.size(); i++)
+	{
+		body << "    { // " << operations[i]->key << "\n";
+		if(operations[i]->parameters > 0)
+		{
+			source << ",\n                          const float p" << parameter;
+			body << "        const float parameter = p" << parameter << ";\n";
+			parameter++;
+		}
+		body << operations[i]->code << "    }\n";
+	}
+	source << ")\n"
+			<< "{\n"
+			<< "    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |\n"
+			<< "                               CLK_ADDRESS_CLAMP_TO_EDGE  |\n"
+			<< "                               CLK_FILTER_NEAREST;\n"
+			<< "    int x = get_global_id(0);\n"
+			<< "    int y = get_global_id(1);\n"
+			<< "    if(x >= get_image_width(dstImage) || y >= get_image_height(dstImage))\n"
+			<< "        return; // padding of the global size\n"
+			<< "    int2 coords = (int2) (x,y);\n"
+			<< "\n"
+			<< "    float4 pixel = read_imagef(srcImage,sampler,coords);\n"
+			<< body.str()
+			<< "    write_imagef(dstImage,coords,pixel);\n"
+			<< "}\n";
+	return source.str();
+}
+
+	/*! \brief Describes the current kernel of a session as a pipeline stage without parameter.
+	 *
+	 * @param openCLSession is the session, after initOpenCL or initOpenCLFromInput
+	 * @return The stage, with kernel 0 when the session has no current kernel.
+	 */
+PipelineStage currentPipelineStage(OpenCLSession& openCLSession)
+{
+	PipelineStage stage;
+	stage.key = openCLSession.kernelKey;
+	stage.kernel = openCLSession.kernel;
+	stage.boundsChecked = openCLSession.kernelBoundsChecked;
+	if(stage.kernel)
+		clGetKernelInfo(stage.kernel, CL_KERNEL_NUM_ARGS, sizeof(stage.numArgs), &stage.numArgs, 0);
+	return stage;
+}
+
+	/*! \brief Replaces every run of two or more pointwise stages by one generated kernel.
+	 *
+	 * The fused kernel is stored in the kernel table of the session under a key made of
+	 * the keys of its stages, like "fused:inverse+saturatie", so it is generated and built
+	 * once per chain. The program cache keeps the binary between runs of the app.
+	 * The current kernel of the session is left as it was. When a fused kernel does
+	 * not build, its stages stay apart.
+	 *
+	 * @param env is a pointer to the java environment where this function is called.
+	 * @param thisObject is a java object to be able to access java data from the native code
+	 * @param openCLSession is the session that holds the kernels of the stages
+	 * @param stages are the stages, with their parameters set
+	 */
+void fusePointwiseStages
+(
+		JNIEnv* env,
+		jobject thisObject,
+		OpenCLSession& openCLSession,
+		std::vector<PipelineStage>& stages
+)
+{
+	std::vector<PipelineStage> fused;
+	size_t i = 0;
+	while(i < stages.size())
+	{
+		std::vector<const PointwiseOperation*> operations;
+		size_t end = i;
+		while(end < stages.size())
+		{
+			const PointwiseOperation* operation = findPointwiseOperation(stages[end].key);
+			if(!operation || stages[end].parameters.size() != operation->parameters)
+				break;
+			operations.push_back(operation);
+			end++;
+		}
+		if(operations.size() < 2)
+		{
+			fused.push_back(stages[i]);
+			i++;
+			continue;
+		}
+
+		PipelineStage stage;
+		stage.key = "fused:" + stages[i].key;
+		for(size_t s = i + 1; s < end; s++)
+			stage.key += "+" + stages[s].key;
+		for(size_t s = i; s < end; s++)
+			stage.parameters.insert(stage.parameters.end(), stages[s].parameters.begin(), stages[s].parameters.end());
+
+		std::map<std::string, OpenCLKernelEntry>::iterator it = openCLSession.kernels.find(stage.key);
+		if(it == openCLSession.kernels.end())
+		{
+			cl_kernel currentKernel = openCLSession.kernel;
+			bool currentBoundsChecked = openCLSession.kernelBoundsChecked;
+			buildKernel(env, thisObject, openCLSession, stage.key, fusedKernelSource(operations), "fusedKernel");
+			openCLSession.kernel = currentKernel;
+			openCLSession.kernelBoundsChecked = currentBoundsChecked;
+			it = openCLSession.kernels.find(stage.key);
+			if(it != openCLSession.kernels.end())
+				it->second.boundsChecked = true;
+		}
+		if(it == openCLSession.kernels.end())
+		{
+			LOGE("Cannot fuse %s, its stages run apart", stage.key.c_str());
+			fused.insert(fused.end(), stages.begin() + i, stages.begin() + end);
+		}
+		else
+		{
+			stage.kernel = it->second.kernel;
+			stage.boundsChecked = it->second.boundsChecked;
+			stage.numArgs = 2 + stage.parameters.size();
+			fused.push_back(stage);
+		}
+		i = end;
+	}
+	stages.swap(fused);
+}
+
+	/*! \brief Enqueues the kernels of a pipeline on the queue of a session.
+	 *
+	 * The kernel arguments are set right before each launch, so one kernel can be used
+	 * by several stages. The work sizes of a stage are chosen with its first run and kept
+	 * in the stage until the image size changes. Choosing them runs the kernel, so the host
+	 * waits for the upload then.
+	 *
+	 * @param openCLSession is the session that holds the kernels
+	 * @param stages are the stages, in the order they run
+	 * @param input is the image the first stage reads
+	 * @param output is the image the last stage writes, it has to be readable for pipelines of more than one stage
+	 * @param temp is the second ping-pong image, only used with more than one stage
+	 * @param width is the width of the images in pixels
+	 * @param height is the height of the images in pixels
+	 * @param uploadEvent is the event that completes the input, or 0
+	 * @param waitForUpload tells if the first kernel has to wait for uploadEvent, false when the queue orders it already
+	 * @param firstKernelEvent_ret receives the event of the first kernel, may be 0
+	 * @param lastKernelEvent_ret receives the event of the last kernel, may be 0
+	 * @return The OpenCL error code.
+	 */
+cl_int enqueuePipeline
+(
+		OpenCLSession& openCLSession,
+		std::vector<PipelineStage>& stages,
+		cl_mem input,
+		cl_mem output,
+		cl_mem temp,
+		size_t width,
+		size_t height,
+		cl_event uploadEvent,
+		bool waitForUpload,
+		cl_event* firstKernelEvent_ret,
+		cl_event* lastKernelEvent_ret
+)
+{
+	cl_int err = CL_SUCCESS;
+	size_t count = stages.size();
+	bool uploadWaited = false;
+
+	cl_mem source = input;
+	for(size_t i = 0; i < count; i++)
+	{
+		PipelineStage& stage = stages[i];
+		cl_mem destination = ((count - 1 - i) % 2 == 0) ? output : temp;
+
+		err = clSetKernelArg(stage.kernel, 0, sizeof(cl_mem), &source);
+		if(err == CL_SUCCESS)
+			err = clSetKernelArg(stage.kernel, 1, sizeof(cl_mem), &destination);
+		for(size_t p = 0; p < stage.parameters.size() && err == CL_SUCCESS; p++)
+			err = clSetKernelArg(stage.kernel, 2 + p, sizeof(cl_float), &stage.parameters[p]);
+		if(err != CL_SUCCESS)
+			return err;
+
+		if(!stage.workSizeChosen || stage.chosenWidth != width || stage.chosenHeight != height)
+		{
+			if(uploadEvent && !uploadWaited)
+			{
+				err = clWaitForEvents(1, &uploadEvent);
+				if(err != CL_SUCCESS)
+					return err;
+				uploadWaited = true;
+			}
+			stage.useLocalSize =
+					chooseWorkSize(openCLSession, stage.kernel, width, height,
+							stage.boundsChecked, stage.globalSize, stage.localSize);
+			stage.workSizeChosen = true;
+			stage.chosenWidth = width;
+			stage.chosenHeight = height;
+		}
+
+		bool waits = (i == 0 && uploadEvent && waitForUpload);
+		cl_event* event_ret = 0;
+		if(i == 0 && firstKernelEvent_ret)
+			event_ret = firstKernelEvent_ret;
+		else if(i == count - 1 && lastKernelEvent_ret)
+			event_ret = lastKernelEvent_ret;
+
+		err = clEnqueueNDRangeKernel
+				(
+						openCLSession.queue,
+						stage.kernel,
+						2,
+						0,
+						stage.globalSize,
+						stage.useLocalSize ? stage.localSize : 0,
+						waits ? 1 : 0,
+						waits ? &uploadEvent : 0,
+						event_ret
+				);
+		if(err != CL_SUCCESS)
+			return err;
+
+		// A one stage pipeline returns the same event as first and last kernel.
+		if(count == 1 && firstKernelEvent_ret && lastKernelEvent_ret)
+		{
+			*lastKernelEvent_ret = *firstKernelEvent_ret;
+			clRetainEvent(*lastKernelEvent_ret);
+		}
+		source = destination;
+	}
+	return CL_SUCCESS;
+}
+
+	/*! \brief Runs a pipeline on an image2d_t copy of host pixels and reads back only the result.
+	 *
+	 * The images are checked out from the memory pool of the session, like in executeImage2DKernel.
+	 *
+	 * @param openCLSession is the session that holds the kernels
+	 * @param stages are the stages, in the order they run
+	 * @param input describes the RGBA pixels that have to be processed
+	 * @param output describes the RGBA pixels that receive the result, with the size of input
+	 */
+void executePipeline
+(
+		OpenCLSession& openCLSession,
+		std::vector<PipelineStage>& stages,
+		const HostImage& input,
+		const HostImage& output
+)
+{
+	if(stages.empty())
+		return;
+
+	timeval start;
+	gettimeofday(&start, NULL);
+
+	cl_int err = CL_SUCCESS;
+
+	cl_image_format image_format;
+	image_format.image_channel_data_type=CL_UNORM_INT8;
+	image_format.image_channel_order=CL_RGBA;
+
+	PooledMemObject inputImage(openCLSession);
+	PooledMemObject outputImage(openCLSession);
+	PooledMemObject tempImage(openCLSession);
+	PendingCommands pending(openCLSession.queue);
+	ScopedEvent writeEvent;
+	ScopedEvent firstKernelEvent;
+	ScopedEvent lastKernelEvent;
+	ScopedEvent readEvent;
+
+	inputImage.memObject =
+			acquireHostImage(openCLSession,
+					CL_MEM_READ_ONLY,
+					image_format,
+					input,
+					true,
+					&writeEvent.event,
+					&err);
+	SAMPLE_CHECK_ERRORS(err);
+
+	// The output image is read by the stage after the one that writes it.
+	cl_mem_flags outputAccess = (stages.size() > 1) ? CL_MEM_READ_WRITE : CL_MEM_WRITE_ONLY;
+	outputImage.memObject =
+			acquireHostImage(openCLSession,
+					outputAccess,
+					image_format,
+					output,
+					false,
+					0,
+					&err);
+	SAMPLE_CHECK_ERRORS(err);
+
+	if(stages.size() > 1)
+	{
+		tempImage.memObject =
+				acquireImage2D(openCLSession,
+						CL_MEM_READ_WRITE,
+						image_format,
+						input.width,
+						input.height,
+						0,
+						0,
+						&err);
+		SAMPLE_CHECK_ERRORS(err);
+	}
+
+	err = enqueuePipeline(openCLSession, stages, inputImage.memObject, outputImage.memObject, tempImage.memObject,
+			input.width, input.height, writeEvent.event, true, &firstKernelEvent.event, &lastKernelEvent.event);
+	SAMPLE_CHECK_ERRORS(err);
+
+	err = downloadHostImage(openCLSession, outputImage.memObject, output, lastKernelEvent.event, &readEvent.event);
+	SAMPLE_CHECK_ERRORS(err);
+
+	err = clWaitForEvents(1, &readEvent.event);
+	SAMPLE_CHECK_ERRORS(err);
+	pending.done();
+
+	timeval end;
+	gettimeofday(&end, NULL);
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) * 1e-6;
+	recordExecutionProfile(openCLSession, writeEvent.event, firstKernelEvent.event, readEvent.event,
+			seconds, lastKernelEvent.event);
+}
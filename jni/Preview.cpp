@@ -0,0 +1,107 @@
+#include "OVSR.h"
+
+#include <algorithm>
+
+/*
+ * Live preview of the interactive filters, like the saturation slider.
+ *
+ * When the slider opens, the image is downsampled once on the host with a box
+ * filter so that its longest side fits the preview size, and uploaded to a device
+ * image that stays there. Every slider change only runs the kernel on that small
+ * image and reads the small result back, which costs the same for every photo
+ * size. The full resolution result is rendered once, when the value is committed.
+ * The preview is a resident image, see Resident.cpp.
+ */
+
+/*! \brief Averages blocks of RGBA pixels into a smaller image.
+ *
+ * @param input describes the RGBA pixels of the full image
+ * @param width is the width of the small image
+ * @param height is the height of the small image
+ * @param pixels receives the pixels of the small image, without row padding
+ */
+static void downsampleHostImage(const HostImage& input, size_t width, size_t height, std::vector<unsigned char>& pixels)
+{
+	pixels.resize(width * height * 4);
+	for(size_t y = 0; y < height; y++)
+	{
+		size_t y0 = y * input.height / height;
+		size_t y1 = std::max(y0 + 1, (y + 1) * input.height / height);
+		for(size_t x = 0; x < width; x++)
+		{
+			size_t x0 = x * input.width / width;
+			size_t x1 = std::max(x0 + 1, (x + 1) * input.width / width);
+			unsigned int sum[4] = {0, 0, 0, 0};
+			for(size_t sy = y0; sy < y1; sy++)
+			{
+				const unsigned char* row = (const unsigned char*)input.pixels + sy * input.stride;
+				for(size_t sx = x0; sx < x1; sx++)
+				{
+					for(int c = 0; c < 4; c++)
+						sum[c] += row[sx * 4 + c];
+				}
+			}
+			unsigned int count = (x1 - x0) * (y1 - y0);
+			unsigned char* pixel = &pixels[(y * width + x) * 4];
+			for(int c = 0; c < 4; c++)
+				pixel[c] = (unsigned char)((sum[c] + count / 2) / count);
+		}
+	}
+}
+
+	/*! \brief Opens a preview of an image on the device of a session.
+	 *
+	 * A preview that is still open is released first. Images that already fit are not scaled.
+	 *
+	 * @param openCLSession is the session of the kernels that are going to render the preview
+	 * @param input describes the RGBA pixels of the full image
+	 * @param maxSide is the longest side of the preview in pixels
+	 * @param preview receives the device images and the size of the preview
+	 * @return The OpenCL error code.
+	 */
+cl_int startImagePreview
+(
+		OpenCLSession& openCLSession,
+		const HostImage& input,
+		size_t maxSide,
+		ResidentImage& preview
+)
+{
+	releaseResidentImage(preview);
+	if(input.width == 0 || input.height == 0 || maxSide == 0)
+		return CL_INVALID_IMAGE_SIZE;
+
+	size_t longest = std::max(input.width, input.height);
+	size_t width = input.width;
+	size_t height = input.height;
+	if(longest > maxSide)
+	{
+		width = std::max((size_t)1, input.width * maxSide / longest);
+		height = std::max((size_t)1, input.height * maxSide / longest);
+	}
+
+	std::vector<unsigned char> pixels;
+	downsampleHostImage(input, width, height, pixels);
+
+	cl_int err = CL_SUCCESS;
+	cl_image_format image_format;
+	image_format.image_channel_data_type=CL_UNORM_INT8;
+	image_format.image_channel_order=CL_RGBA;
+
+	preview.session = &openCLSession;
+	preview.width = width;
+	preview.height = height;
+	preview.sourceImage = acquireImage2D(openCLSession, CL_MEM_READ_ONLY, image_format, width, height, 0, 0, &err);
+	if(err == CL_SUCCESS)
+		preview.resultImage = acquireImage2D(openCLSession, CL_MEM_WRITE_ONLY, image_format, width, height, 0, 0, &err);
+	if(err == CL_SUCCESS)
+	{
+		const size_t origin[3] = {0, 0, 0};
+		const size_t region[3] = {width, height, 1};
+		err = clEnqueueWriteImage(openCLSession.queue, preview.sourceImage, CL_TRUE,
+				origin, region, width * 4, 0, &pixels[0], 0, 0, 0);
+	}
+	if(err != CL_SUCCESS)
+		releaseResidentImage(preview);
+	return err;
+}
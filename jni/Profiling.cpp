@@ -0,0 +1,129 @@
+#include "OVSR.h"
+
+/*
+ * Per-stage timing of the execution functions.
+ *
+ * In profiling mode the command queue of a session is created with
+ * CL_QUEUE_PROFILING_ENABLE and the events of the upload, the kernel and the
+ * download of the last execution are read back into ExecutionProfile. The
+ * difference between the wall-clock time of the execution and the time the
+ * device spent on the three commands is reported as host overhead.
+ */
+
+/*! \brief Reads the CL_PROFILING_COMMAND_* timestamps of an event.
+ *
+ * @param event is a completed event of a queue with profiling enabled, 0 gives zero times
+ * @param times receives the timestamps in nanoseconds
+ */
+static void readCommandTimes(cl_event event, CommandTimes* times)
+{
+	times->queued = times->submit = times->start = times->end = 0;
+	if(!event)
+		return;
+	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &times->queued, 0);
+	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &times->submit, 0);
+	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &times->start, 0);
+	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &times->end, 0);
+}
+
+	/*! \brief Returns the time a command ran on the device.
+	 *
+	 * @param times are the timestamps of the command
+	 * @return The time from START to END in milliseconds.
+	 */
+float commandMilliseconds(const CommandTimes& times)
+{
+	if(times.end <= times.start)
+		return 0;
+	return (times.end - times.start) * 1e-6f;
+}
+
+	/*! \brief Switches profiling on or off for a session by recreating its command queue.
+	 *
+	 * Commands on the old queue are finished first. Nothing happens when the
+	 * session already is in the requested mode.
+	 *
+	 * @param openCLSession is the session
+	 * @param enable is true to create the queue with CL_QUEUE_PROFILING_ENABLE
+	 * @return The OpenCL error code.
+	 */
+cl_int setSessionProfiling(OpenCLSession& openCLSession, bool enable)
+{
+	if(openCLSession.profiling == enable && openCLSession.queue)
+		return CL_SUCCESS;
+
+	cl_int err = CL_SUCCESS;
+	cl_command_queue queue =
+			clCreateCommandQueue
+			(
+					openCLSession.context,
+					openCLSession.device,
+					enable ? CL_QUEUE_PROFILING_ENABLE : 0,
+					&err
+			);
+	if(err != CL_SUCCESS)
+		return err;
+
+	if(openCLSession.queue)
+	{
+		clFinish(openCLSession.queue);
+		clReleaseCommandQueue(openCLSession.queue);
+	}
+	openCLSession.queue = queue;
+	openCLSession.profiling = enable;
+	openCLSession.lastProfile.valid = false;
+	return CL_SUCCESS;
+}
+
+	/*! \brief Stores the stage times of an execution in the session when profiling is on.
+	 *
+	 * All events have to be completed.
+	 *
+	 * @param openCLSession is the session that ran the commands
+	 * @param uploadEvent is the event of the upload, or 0
+	 * @param kernelEvent is the event of the kernel
+	 * @param downloadEvent is the event of the download
+	 * @param wallSeconds is the wall-clock time of the whole execution in seconds
+	 * @param lastKernelEvent is the event of the last kernel of a pipeline, then kernelEvent is the first one.
+	 * The kernel time runs from the start of the first to the end of the last kernel.
+	 */
+void recordExecutionProfile
+(
+		OpenCLSession& openCLSession,
+		cl_event uploadEvent,
+		cl_event kernelEvent,
+		cl_event downloadEvent,
+		double wallSeconds,
+		cl_event lastKernelEvent
+)
+{
+	if(!openCLSession.profiling)
+		return;
+
+	ExecutionProfile& profile = openCLSession.lastProfile;
+	readCommandTimes(uploadEvent, &profile.upload);
+	readCommandTimes(kernelEvent, &profile.kernel);
+	if(lastKernelEvent)
+	{
+		CommandTimes last;
+		readCommandTimes(lastKernelEvent, &last);
+		profile.kernel.end = last.end;
+	}
+	readCommandTimes(downloadEvent, &profile.download);
+
+	float deviceMs =
+			commandMilliseconds(profile.upload) +
+			commandMilliseconds(profile.kernel) +
+			commandMilliseconds(profile.download);
+	profile.hostMs = (float)(wallSeconds * 1000) - deviceMs;
+	if(profile.hostMs < 0)
+		profile.hostMs = 0;
+	profile.valid = true;
+
+	LOGD("Profile: upload %.3f ms, kernel %.3f ms (queued to start %.3f ms), download %.3f ms, host %.3f ms",
+			commandMilliseconds(profile.upload),
+			commandMilliseconds(profile.kernel),
+			profile.kernel.start > profile.kernel.queued ? (profile.kernel.start - profile.kernel.queued) * 1e-6f : 0.0f,
+			commandMilliseconds(profile.download),
+			profile.hostMs);
+}
@@ -0,0 +1,272 @@
+#include "OVSR.h"
+
+#include <sys/stat.h>
+
+/*
+ * Compiled programs are stored in this directory, one file per program.
+ * A file starts with a small header so a file of another program, device
+ * or driver is never handed to clCreateProgramWithBinary.
+ */
+#define PROGRAM_CACHE_DIR EXECDIR "programcache/"
+#define PROGRAM_CACHE_MAGIC "OVSRBIN1"
+
+struct ProgramCacheHeader
+{
+	char magic[8];
+	unsigned long long key;
+	unsigned long long binarySize;
+};
+
+/*! \brief 64 bit FNV-1a hash, continued from a previous hash value.
+ *
+ * @param hash is the hash of the data before this block
+ * @param data is the block to be hashed
+ * @param size is the size of the block in bytes
+ * @return The new hash value.
+ */
+static unsigned long long fnv1a(unsigned long long hash, const void* data, size_t size)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	for(size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+	/*! \brief Returns the 64 bit FNV-1a hash of an OpenCL source.
+	 *
+	 * @param source is the OpenCL code
+	 * @return The hash value.
+	 */
+unsigned long long sourceHash(const std::string& source)
+{
+	return fnv1a(14695981039346656037ULL, source.data(), source.size());
+}
+/*! \brief Returns a device information string like CL_DEVICE_NAME.
+ *
+ * @param device is the device to be queried
+ * @param param is the cl_device_info to be returned
+ * @return The information string, empty when the query failed.
+ */
+static std::string getDeviceString(cl_device_id device, cl_device_info param)
+{
+	size_t length = 0;
+	if(clGetDeviceInfo(device, param, 0, 0, &length) != CL_SUCCESS || length == 0)
+		return std::string();
+	std::vector<char> value(length);
+	if(clGetDeviceInfo(device, param, length, &value[0], 0) != CL_SUCCESS)
+		return std::string();
+	return std::string(&value[0]);
+}
+
+/*! \brief Computes the cache key of a program.
+ *
+ * The key covers everything that changes the compiled binary: the source code,
+ * the device name, the driver and device version and the build options.
+ *
+ * @param openCLSession is the session that holds the device
+ * @param source is the OpenCL code of the program
+ * @return The cache key.
+ */
+static unsigned long long programCacheKey(OpenCLSession& openCLSession, const std::string& source)
+{
+	std::string parts[4] =
+	{
+			getDeviceString(openCLSession.device, CL_DEVICE_NAME),
+			getDeviceString(openCLSession.device, CL_DRIVER_VERSION),
+			getDeviceString(openCLSession.device, CL_DEVICE_VERSION),
+			BUILDOPT
+	};
+	unsigned long long hash = sourceHash(source);
+	for(int i = 0; i < 4; i++)
+		hash = fnv1a(hash, parts[i].c_str(), parts[i].size() + 1);
+	return hash;
+}
+
+/*! \brief Returns the file name of a cache entry.
+ *
+ * @param key is the cache key of the program
+ * @return The full path of the cache file.
+ */
+static std::string programCacheFile(unsigned long long key)
+{
+	char name[32];
+	sprintf(name, "%016llx.bin", key);
+	return std::string(PROGRAM_CACHE_DIR) + name;
+}
+
+/*! \brief Tries to create and build a program from the program cache.
+ *
+ * @param openCLSession is the session the program is build for
+ * @param key is the cache key of the program
+ * @return The built program, or 0 when there is no usable cache entry.
+ */
+static cl_program loadCachedProgram(OpenCLSession& openCLSession, unsigned long long key)
+{
+	std::string fileName = programCacheFile(key);
+	FILE* file = fopen(fileName.c_str(), "rb");
+	if(!file)
+		return 0;
+
+	ProgramCacheHeader header;
+	std::vector<unsigned char> binary;
+	bool valid =
+			fread(&header, sizeof(header), 1, file) == 1 &&
+			memcmp(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic)) == 0 &&
+			header.key == key &&
+			header.binarySize > 0;
+	if(valid)
+	{
+		binary.resize(header.binarySize);
+		valid = fread(&binary[0], 1, binary.size(), file) == binary.size();
+	}
+	fclose(file);
+	if(!valid)
+	{
+		LOGD("Program cache entry %s is not valid, removing it", fileName.c_str());
+		remove(fileName.c_str());
+		return 0;
+	}
+
+	cl_int err = CL_SUCCESS;
+	cl_int binaryStatus = CL_SUCCESS;
+	size_t binarySize = binary.size();
+	const unsigned char* binaryData = &binary[0];
+	cl_program program =
+			clCreateProgramWithBinary
+			(
+					openCLSession.context,
+					1,
+					&openCLSession.device,
+					&binarySize,
+					&binaryData,
+					&binaryStatus,
+					&err
+			);
+	if(err == CL_SUCCESS && binaryStatus == CL_SUCCESS)
+		err = clBuildProgram(program, 0, 0, BUILDOPT, 0, 0);
+	else if(err == CL_SUCCESS)
+		err = binaryStatus;
+
+	if(err != CL_SUCCESS)
+	{
+		/*
+		 * The driver does not accept the binary anymore, for example after
+		 * a driver update that kept the version string. Build from source.
+		 */
+		LOGD("Cached program rejected with %s, building from source", opencl_error_to_str(err));
+		if(program)
+			clReleaseProgram(program);
+		remove(fileName.c_str());
+		return 0;
+	}
+	return program;
+}
+
+/*! \brief Stores the binary of a built program in the program cache.
+ *
+ * The file is written under a temporary name first and then renamed,
+ * so a half written file is never loaded.
+ *
+ * @param program is the built program
+ * @param key is the cache key of the program
+ */
+static void storeCachedProgram(cl_program program, unsigned long long key)
+{
+	size_t binarySize = 0;
+	cl_int err = clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(binarySize), &binarySize, 0);
+	SAMPLE_CHECK_ERRORS(err);
+	if(binarySize == 0)
+		return;
+
+	std::vector<unsigned char> binary(binarySize);
+	unsigned char* binaryData = &binary[0];
+	err = clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binaryData), &binaryData, 0);
+	SAMPLE_CHECK_ERRORS(err);
+
+	mkdir(PROGRAM_CACHE_DIR, 0700);
+	std::string fileName = programCacheFile(key);
+	// Engines on other threads may store the same program, so the temporary name is per thread.
+	std::ostringstream suffix;
+	suffix << ".tmp" << (unsigned long)pthread_self();
+	std::string tempName = fileName + suffix.str();
+	FILE* file = fopen(tempName.c_str(), "wb");
+	if(!file)
+	{
+		LOGE("Cannot open %s to store the program", tempName.c_str());
+		return;
+	}
+
+	ProgramCacheHeader header;
+	memcpy(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic));
+	header.key = key;
+	header.binarySize = binarySize;
+	bool written =
+			fwrite(&header, sizeof(header), 1, file) == 1 &&
+			fwrite(binaryData, 1, binarySize, file) == binarySize;
+	written = (fclose(file) == 0) && written;
+
+	if(!written || rename(tempName.c_str(), fileName.c_str()) != 0)
+	{
+		LOGE("Cannot store the program in %s", fileName.c_str());
+		remove(tempName.c_str());
+	}
+}
+
+	/*! \brief Creates and builds a program, using the on-disk program cache.
+	 *
+	 * The cache is keyed by a hash of the source, the device name, the driver version
+	 * and BUILDOPT. When a cached binary exists it is loaded with clCreateProgramWithBinary,
+	 * otherwise (or when the driver rejects the binary) the program is built from source
+	 * and its binary is stored for the next run.
+	 *
+	 * @param openCLSession is the session the program is build for
+	 * @param source is the OpenCL code of the program
+	 * @param errcode_ret receives CL_SUCCESS, CL_BUILD_PROGRAM_FAILURE or another OpenCL error
+	 * @return The program. On CL_BUILD_PROGRAM_FAILURE the program is returned as well,
+	 * so the caller can read the build log and has to release it. On other errors 0 is returned.
+	 */
+cl_program buildProgramWithCache
+(
+		OpenCLSession& openCLSession,
+		const std::string& source,
+		cl_int* errcode_ret
+)
+{
+	unsigned long long key = programCacheKey(openCLSession, source);
+
+	cl_program program = loadCachedProgram(openCLSession, key);
+	if(program)
+	{
+		LOGD("Program loaded from the program cache");
+		*errcode_ret = CL_SUCCESS;
+		return program;
+	}
+
+	const char* sourceChar = source.c_str();
+	program =
+			clCreateProgramWithSource
+			(
+					openCLSession.context,
+					1,
+					&sourceChar,
+					0,
+					errcode_ret
+			);
+	if(*errcode_ret != CL_SUCCESS)
+		return 0;
+
+	*errcode_ret = clBuildProgram(program, 0, 0, BUILDOPT, 0, 0);
+	if(*errcode_ret == CL_BUILD_PROGRAM_FAILURE)
+		return program;
+	if(*errcode_ret != CL_SUCCESS)
+	{
+		clReleaseProgram(program);
+		return 0;
+	}
+
+	storeCachedProgram(program, key);
+	return program;
+}
@@ -0,0 +1,154 @@
+#include "OVSR.h"
+
+#include <algorithm>
+
+/*
+ * Runs a kernel on a rectangle of an image, for edits that touch only part of it.
+ *
+ * The device images have the size of the whole image, so the kernels see the same
+ * coordinates as in a full run. Only the region plus the halo the filter reads around
+ * it is uploaded, the kernel runs with a global offset over the region and only the
+ * region is read back. The pixels of the output outside the region are left as they
+ * are, so a brush can apply a filter stroke by stroke onto the previous result.
+ */
+
+	/*! \brief Clips a region to an image.
+	 *
+	 * @return False when nothing of the region lies inside the image.
+	 */
+bool clipImageRegion(ImageRegion& region, size_t width, size_t height)
+{
+	if(region.x >= width || region.y >= height || region.width == 0 || region.height == 0)
+		return false;
+	region.width = std::min(region.width, width - region.x);
+	region.height = std::min(region.height, height - region.y);
+	return true;
+}
+
+	/*! \brief Runs the current kernel of a session on a region of an image.
+	 *
+	 * The first two kernel arguments are set to the input and output image. Extra
+	 * arguments have to be set by the caller before. Kernels without a known halo, like
+	 * code from the input field, get the whole input uploaded, because it is not known
+	 * which pixels they read. The device images are checked out from the memory pool.
+	 *
+	 * @param openCLSession is the session that holds the kernel to be executed
+	 * @param input describes the RGBA pixels that have to be processed
+	 * @param output describes the RGBA pixels that receive the result in the region, with the size of input
+	 * @param region is the rectangle that has to be processed, clipped to the image
+	 */
+void executeImage2DKernelRegion
+(
+		OpenCLSession& openCLSession,
+		const HostImage& input,
+		const HostImage& output,
+		ImageRegion region
+)
+{
+	if(!clipImageRegion(region, input.width, input.height))
+		return;
+
+	timeval start;
+	gettimeofday(&start, NULL);
+
+	cl_int err = CL_SUCCESS;
+
+	cl_image_format image_format;
+	image_format.image_channel_data_type=CL_UNORM_INT8;
+	image_format.image_channel_order=CL_RGBA;
+
+	PooledMemObject inputImage(openCLSession);
+	PooledMemObject outputImage(openCLSession);
+	PendingCommands pending(openCLSession.queue);
+	ScopedEvent writeEvent;
+	ScopedEvent kernelEvent;
+	ScopedEvent readEvent;
+
+	inputImage.memObject =
+			acquireImage2D(openCLSession, CL_MEM_READ_ONLY, image_format, input.width, input.height, 0, 0, &err);
+	SAMPLE_CHECK_ERRORS(err);
+	outputImage.memObject =
+			acquireImage2D(openCLSession, CL_MEM_WRITE_ONLY, image_format, input.width, input.height, 0, 0, &err);
+	SAMPLE_CHECK_ERRORS(err);
+
+	// The halo around the region, clamped to the image like the sampler of the filters.
+	ImageRegion upload;
+	int halo = splitHaloRows(openCLSession.kernelKey);
+	if(halo < 0)
+	{
+		upload.width = input.width;
+		upload.height = input.height;
+	}
+	else
+	{
+		upload.x = (region.x > (size_t)halo) ? region.x - halo : 0;
+		upload.y = (region.y > (size_t)halo) ? region.y - halo : 0;
+		upload.width = std::min(input.width, region.x + region.width + halo) - upload.x;
+		upload.height = std::min(input.height, region.y + region.height + halo) - upload.y;
+	}
+
+	const size_t uploadOrigin[3] = {upload.x, upload.y, 0};
+	const size_t uploadRegion[3] = {upload.width, upload.height, 1};
+	err = clEnqueueWriteImage(openCLSession.queue, inputImage.memObject, CL_FALSE,
+			uploadOrigin, uploadRegion, input.stride, 0,
+			(char*)input.pixels + upload.y * input.stride + upload.x * 4,
+			0, 0, &writeEvent.event);
+	SAMPLE_CHECK_ERRORS(err);
+
+	err = clSetKernelArg(openCLSession.kernel, 0, sizeof(cl_mem), &inputImage.memObject);
+	SAMPLE_CHECK_ERRORS(err);
+	err = clSetKernelArg(openCLSession.kernel, 1, sizeof(cl_mem), &outputImage.memObject);
+	SAMPLE_CHECK_ERRORS(err);
+
+	/*
+	 * The local size is the one tuned for the whole image, so brush strokes of every
+	 * size do not each start a tuning run. Padding of the global size only adds
+	 * work-items past the region, which write pixels of the device image that are
+	 * not read back, or return at the image edge.
+	 */
+	size_t imageGlobalSize[2];
+	size_t localSize[2];
+	bool useLocalSize =
+			chooseWorkSize(openCLSession, openCLSession.kernel, input.width, input.height,
+					openCLSession.kernelBoundsChecked, imageGlobalSize, localSize);
+	size_t globalSize[2] = {region.width, region.height};
+	if(useLocalSize && openCLSession.kernelBoundsChecked)
+	{
+		for(int i = 0; i < 2; i++)
+			globalSize[i] = (globalSize[i] + localSize[i] - 1) / localSize[i] * localSize[i];
+	}
+	else if(useLocalSize && (globalSize[0] % localSize[0] != 0 || globalSize[1] % localSize[1] != 0))
+		useLocalSize = false;
+	const size_t globalOffset[2] = {region.x, region.y};
+
+	err = clEnqueueNDRangeKernel
+			(
+					openCLSession.queue,
+					openCLSession.kernel,
+					2,
+					globalOffset,
+					globalSize,
+					useLocalSize ? localSize : 0,
+					0,
+					0,
+					&kernelEvent.event
+			);
+	SAMPLE_CHECK_ERRORS(err);
+
+	const size_t readOrigin[3] = {region.x, region.y, 0};
+	const size_t readRegion[3] = {region.width, region.height, 1};
+	err = clEnqueueReadImage(openCLSession.queue, outputImage.memObject, CL_FALSE,
+			readOrigin, readRegion, output.stride, 0,
+			(char*)output.pixels + region.y * output.stride + region.x * 4,
+			0, 0, &readEvent.event);
+	SAMPLE_CHECK_ERRORS(err);
+
+	err = clWaitForEvents(1, &readEvent.event);
+	SAMPLE_CHECK_ERRORS(err);
+	pending.done();
+
+	timeval end;
+	gettimeofday(&end, NULL);
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) * 1e-6;
+	recordExecutionProfile(openCLSession, writeEvent.event, kernelEvent.event, readEvent.event, seconds);
+}
@@ -0,0 +1,112 @@
+#include "OVSR.h"
+
+/*
+ * Images that stay on the device between kernel runs.
+ *
+ * A resident image keeps an input image and a result image on the device of a
+ * session. Running a kernel on it only sets the kernel arguments, enqueues the
+ * kernel and reads the result back, the input is never uploaded again. The
+ * slider preview is a downsampled resident image, see Preview.cpp. A pinned input
+ * is a resident copy of the full image, for parameter sweeps and slider scrubbing
+ * at full resolution.
+ */
+
+	/*! \brief Pins a copy of an image on the device of a session.
+	 *
+	 * A resident image that is still open is released first.
+	 *
+	 * @param openCLSession is the session of the kernels that are going to run on the image
+	 * @param input describes the RGBA pixels of the image
+	 * @param resident receives the device images and the size of the image
+	 * @return The OpenCL error code.
+	 */
+cl_int pinHostImage
+(
+		OpenCLSession& openCLSession,
+		const HostImage& input,
+		ResidentImage& resident
+)
+{
+	releaseResidentImage(resident);
+
+	cl_int err = CL_SUCCESS;
+	cl_image_format image_format;
+	image_format.image_channel_data_type=CL_UNORM_INT8;
+	image_format.image_channel_order=CL_RGBA;
+
+	resident.session = &openCLSession;
+	resident.width = input.width;
+	resident.height = input.height;
+	resident.sourceImage = acquireImage2D(openCLSession, CL_MEM_READ_ONLY, image_format, input.width, input.height, 0, 0, &err);
+	if(err == CL_SUCCESS)
+		resident.resultImage = acquireImage2D(openCLSession, CL_MEM_WRITE_ONLY, image_format, input.width, input.height, 0, 0, &err);
+	if(err == CL_SUCCESS)
+	{
+		const size_t origin[3] = {0, 0, 0};
+		const size_t region[3] = {input.width, input.height, 1};
+		err = clEnqueueWriteImage(openCLSession.queue, resident.sourceImage, CL_TRUE,
+				origin, region, input.stride, 0, input.pixels, 0, 0, 0);
+	}
+	if(err != CL_SUCCESS)
+		releaseResidentImage(resident);
+	return err;
+}
+
+	/*! \brief Runs the current kernel of the session of a resident image on it and reads the result back.
+	 *
+	 * Extra kernel arguments, like the saturation, have to be set by the caller before.
+	 *
+	 * @param resident is the open resident image
+	 * @param output describes the RGBA pixels that receive the result, with the size of the resident image
+	 * @param kernelEvent_ret receives the event of the kernel, may be 0
+	 * @param readEvent_ret receives the event of the read back, may be 0
+	 * @return The OpenCL error code.
+	 */
+cl_int renderResidentImage
+(
+		ResidentImage& resident,
+		const HostImage& output,
+		cl_event* kernelEvent_ret,
+		cl_event* readEvent_ret
+)
+{
+	if(!resident.session || !resident.session->kernel)
+		return CL_INVALID_KERNEL;
+	OpenCLSession& openCLSession = *resident.session;
+
+	cl_int err = clSetKernelArg(openCLSession.kernel, 0, sizeof(cl_mem), &resident.sourceImage);
+	if(err != CL_SUCCESS)
+		return err;
+	err = clSetKernelArg(openCLSession.kernel, 1, sizeof(cl_mem), &resident.resultImage);
+	if(err != CL_SUCCESS)
+		return err;
+
+	size_t globalSize[2];
+	size_t localSize[2];
+	bool useLocalSize =
+			chooseWorkSize(openCLSession, openCLSession.kernel, resident.width, resident.height,
+					openCLSession.kernelBoundsChecked, globalSize, localSize);
+	err = clEnqueueNDRangeKernel(openCLSession.queue, openCLSession.kernel, 2, 0,
+			globalSize, useLocalSize ? localSize : 0, 0, 0, kernelEvent_ret);
+	if(err != CL_SUCCESS)
+		return err;
+
+	const size_t origin[3] = {0, 0, 0};
+	const size_t region[3] = {resident.width, resident.height, 1};
+	return clEnqueueReadImage(openCLSession.queue, resident.resultImage, CL_TRUE,
+			origin, region, output.stride, 0, output.pixels, 0, 0, readEvent_ret);
+}
+
+	/*! \brief Gives the device images of a resident image back to the memory pool of its session.
+	 *
+	 * @param resident is the resident image, nothing happens when it is not open
+	 */
+void releaseResidentImage(ResidentImage& resident)
+{
+	if(resident.session)
+	{
+		returnToPool(*resident.session, resident.sourceImage);
+		returnToPool(*resident.session, resident.resultImage);
+	}
+	resident = ResidentImage();
+}
@@ -0,0 +1,335 @@
+#include "OVSR.h"
+
+#include <algorithm>
+
+/*
+ * Runs one image on two devices at the same time, normally the GPU and the CPU.
+ *
+ * The image is cut in two horizontal bands. Each device gets its band plus the
+ * halo rows its kernel reads above and below it, so the neighbourhood filters give
+ * the same result at the cut as on the whole image. Only the rows of the band itself
+ * are read back. The share of the first device adapts to the rows per second each
+ * device reached in earlier runs of the same kernel, so both finish at about the
+ * same time. Completion times come from event callbacks, because the host can only
+ * wait for one device at a time.
+ */
+#define SPLIT_START_SHARE 0.5 // share of the first device before anything is measured
+#define SPLIT_SHARE_WEIGHT 0.5 // weight of a new measurement in the share
+#define SPLIT_MIN_PART 16 // each device gets at least 1/SPLIT_MIN_PART of the rows, so it keeps being measured
+
+struct SplitShare
+{
+	SplitShare() : runs(0), share(SPLIT_START_SHARE) {}
+
+	int runs;
+	double share; // part of the rows of the first device
+};
+
+static std::map<std::string, SplitShare> splitShares; // by kernel table key, shared by all engines
+static pthread_mutex_t splitSharesMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*! Records when the last command of each band completed, from OpenCL event callbacks.
+ *
+ * The destructor waits for callbacks that did not come yet, so an early
+ * return never leaves a callback with a pointer to a destroyed object.
+ */
+class SplitTimer
+{
+public:
+	SplitTimer() : mPending(0)
+	{
+		pthread_mutex_init(&mMutex, 0);
+		pthread_cond_init(&mCond, 0);
+		gettimeofday(&mStart, NULL);
+		for(int i = 0; i < 2; i++)
+		{
+			mBands[i].timer = this;
+			mBands[i].finished = mStart;
+		}
+	}
+	~SplitTimer()
+	{
+		wait();
+		pthread_cond_destroy(&mCond);
+		pthread_mutex_destroy(&mMutex);
+	}
+
+	/*! \brief Takes the time when an event of a band completes. */
+	cl_int watch(int band, cl_event event)
+	{
+		pthread_mutex_lock(&mMutex);
+		cl_int err = clSetEventCallback(event, CL_COMPLETE, completed, &mBands[band]);
+		if(err == CL_SUCCESS)
+			mPending++;
+		pthread_mutex_unlock(&mMutex);
+		return err;
+	}
+
+	/*! \brief Waits until every watched event called back. */
+	void wait()
+	{
+		pthread_mutex_lock(&mMutex);
+		while(mPending > 0)
+			pthread_cond_wait(&mCond, &mMutex);
+		pthread_mutex_unlock(&mMutex);
+	}
+
+	/*! \brief Returns the seconds from the construction until a band completed, call wait first. */
+	double seconds(int band) const
+	{
+		const timeval& end = mBands[band].finished;
+		return (end.tv_sec + end.tv_usec * 1e-6) - (mStart.tv_sec + mStart.tv_usec * 1e-6);
+	}
+
+private:
+	struct Band
+	{
+		SplitTimer* timer;
+		timeval finished;
+	};
+
+	static void CL_CALLBACK completed(cl_event event, cl_int status, void* userData)
+	{
+		Band* band = (Band*)userData;
+		SplitTimer* timer = band->timer;
+		pthread_mutex_lock(&timer->mMutex);
+		gettimeofday(&band->finished, NULL);
+		timer->mPending--;
+		pthread_cond_broadcast(&timer->mCond);
+		pthread_mutex_unlock(&timer->mMutex);
+	}
+
+	pthread_mutex_t mMutex;
+	pthread_cond_t mCond;
+	int mPending;
+	timeval mStart;
+	Band mBands[2];
+
+	SplitTimer(const SplitTimer&);
+	SplitTimer& operator= (const SplitTimer&);
+};
+
+	/*! \brief Returns how many rows above and below its pixel a bundled filter reads.
+	 *
+	 * @param kernelKey is the kernel table key of the filter
+	 * @return The number of halo rows, or -1 for kernels that can not be split, like code from the input field.
+	 */
+int splitHaloRows(const std::string& kernelKey)
+{
+	if(kernelKey == "inverse" || kernelKey == "saturatie")
+		return 0;
+	if(kernelKey == "blur" || kernelKey == "edge" || kernelKey == "sharpen" || kernelKey == "mediaan3")
+		return 1; // 3x3
+	if(kernelKey == "mediaan")
+		return 2; // 5x5
+	return -1;
+}
+
+	/*! \brief Enqueues the upload, kernel and read back of one band on a session.
+	 *
+	 * @param openCLSession is the session that runs the band, with all extra kernel arguments set
+	 * @param input describes the whole input image
+	 * @param output describes the whole output image
+	 * @param firstRow is the first row of the band
+	 * @param rows is the number of rows of the band
+	 * @param halo is the number of extra input rows above and below the band
+	 * @param inputImage receives the device image with the input rows
+	 * @param outputImage receives the device image the kernel writes
+	 * @param writeEvent receives the event of the upload
+	 * @param kernelEvent receives the event of the kernel
+	 * @param readEvent receives the event of the read back
+	 * @return The OpenCL error code.
+	 */
+static cl_int enqueueBand
+(
+		OpenCLSession& openCLSession,
+		const HostImage& input,
+		const HostImage& output,
+		size_t firstRow,
+		size_t rows,
+		size_t halo,
+		PooledMemObject& inputImage,
+		PooledMemObject& outputImage,
+		ScopedEvent& writeEvent,
+		ScopedEvent& kernelEvent,
+		ScopedEvent& readEvent
+)
+{
+	cl_int err = CL_SUCCESS;
+
+	cl_image_format image_format;
+	image_format.image_channel_data_type=CL_UNORM_INT8;
+	image_format.image_channel_order=CL_RGBA;
+
+	size_t top = (firstRow > halo) ? firstRow - halo : 0;
+	size_t bottom = std::min(input.height, firstRow + rows + halo);
+
+	HostImage band = input;
+	band.pixels = (char*)input.pixels + top * input.stride;
+	band.height = bottom - top;
+
+	inputImage.memObject =
+			acquireHostImage(openCLSession,
+					CL_MEM_READ_ONLY,
+					image_format,
+					band,
+					true,
+					&writeEvent.event,
+					&err);
+	if(err != CL_SUCCESS)
+		return err;
+
+	/*
+	 * The output image is never shared with the host, because the halo rows
+	 * of the two bands overlap in the host memory of the output.
+	 */
+	outputImage.memObject =
+			acquireImage2D(openCLSession,
+					CL_MEM_WRITE_ONLY,
+					image_format,
+					band.width,
+					band.height,
+					0,
+					0,
+					&err);
+	if(err != CL_SUCCESS)
+		return err;
+
+	err = clSetKernelArg(openCLSession.kernel, 0, sizeof(cl_mem), &inputImage.memObject);
+	if(err != CL_SUCCESS)
+		return err;
+	err = clSetKernelArg(openCLSession.kernel, 1, sizeof(cl_mem), &outputImage.memObject);
+	if(err != CL_SUCCESS)
+		return err;
+
+	size_t globalSize[2];
+	size_t localSize[2];
+	bool useLocalSize =
+			chooseWorkSize(openCLSession, openCLSession.kernel, band.width, band.height,
+					openCLSession.kernelBoundsChecked, globalSize, localSize);
+
+	err = clEnqueueNDRangeKernel
+			(
+					openCLSession.queue,
+					openCLSession.kernel,
+					2,
+					0,
+					globalSize,
+					useLocalSize ? localSize : 0,
+					writeEvent.event ? 1 : 0,
+					writeEvent.event ? &writeEvent.event : 0,
+					&kernelEvent.event
+			);
+	if(err != CL_SUCCESS)
+		return err;
+
+	const size_t origin[3] = {0, firstRow - top, 0};
+	const size_t region[3] = {band.width, rows, 1};
+	err = clEnqueueReadImage(
+			openCLSession.queue,
+			outputImage.memObject,
+			false,
+			origin,
+			region,
+			output.stride,
+			0,
+			(char*)output.pixels + firstRow * output.stride,
+			1,
+			&kernelEvent.event,
+			&readEvent.event);
+	if(err != CL_SUCCESS)
+		return err;
+
+	// Start the band now, the host waits for the other device before it waits for this one.
+	return clFlush(openCLSession.queue);
+}
+
+	/*! \brief Runs the current kernel of two sessions on one image, each on a band of rows.
+	 *
+	 * Both sessions have to hold the same filter as current kernel, with the extra
+	 * arguments set. The first two kernel arguments are set to the band images.
+	 * Images with fewer than two rows run on the first session only.
+	 *
+	 * @param first is the session of the top band, normally the GPU
+	 * @param second is the session of the bottom band, normally the CPU
+	 * @param input describes the RGBA pixels that have to be processed
+	 * @param output describes the RGBA pixels that receive the result, with the size of input
+	 */
+void executeSplitImage2DKernel
+(
+		OpenCLSession& first,
+		OpenCLSession& second,
+		const HostImage& input,
+		const HostImage& output
+)
+{
+	int halo = splitHaloRows(first.kernelKey);
+	if(halo < 0 || input.height < 2)
+	{
+		executeImage2DKernel(first, input, output);
+		return;
+	}
+
+	pthread_mutex_lock(&splitSharesMutex);
+	double share = splitShares[first.kernelKey].share;
+	pthread_mutex_unlock(&splitSharesMutex);
+
+	size_t minRows = std::max((size_t)1, input.height / SPLIT_MIN_PART);
+	size_t firstRows = (size_t)(input.height * share + 0.5);
+	firstRows = std::min(std::max(firstRows, minRows), input.height - minRows);
+	size_t secondRows = input.height - firstRows;
+
+	cl_int err = CL_SUCCESS;
+
+	// The timer is declared first, so it waits for its callbacks after everything else is released.
+	SplitTimer timer;
+	PooledMemObject firstInput(first);
+	PooledMemObject firstOutput(first);
+	PooledMemObject secondInput(second);
+	PooledMemObject secondOutput(second);
+	PendingCommands firstPending(first.queue);
+	PendingCommands secondPending(second.queue);
+	ScopedEvent firstWrite, firstKernel, firstRead;
+	ScopedEvent secondWrite, secondKernel, secondRead;
+
+	err = enqueueBand(first, input, output, 0, firstRows, halo,
+			firstInput, firstOutput, firstWrite, firstKernel, firstRead);
+	SAMPLE_CHECK_ERRORS(err);
+	err = timer.watch(0, firstRead.event);
+	SAMPLE_CHECK_ERRORS(err);
+
+	err = enqueueBand(second, input, output, firstRows, secondRows, halo,
+			secondInput, secondOutput, secondWrite, secondKernel, secondRead);
+	SAMPLE_CHECK_ERRORS(err);
+	err = timer.watch(1, secondRead.event);
+	SAMPLE_CHECK_ERRORS(err);
+
+	cl_event reads[2] = { firstRead.event, secondRead.event };
+	err = clWaitForEvents(2, reads);
+	SAMPLE_CHECK_ERRORS(err);
+	firstPending.done();
+	secondPending.done();
+	timer.wait();
+
+	/*
+	 * The first run builds and tunes the kernel for the band sizes and is not counted.
+	 * After that the share moves towards the one where both bands take equally long.
+	 */
+	double firstSeconds = timer.seconds(0);
+	double secondSeconds = timer.seconds(1);
+	pthread_mutex_lock(&splitSharesMutex);
+	SplitShare& split = splitShares[first.kernelKey];
+	split.runs++;
+	if(split.runs > 1 && firstSeconds > 0 && secondSeconds > 0)
+	{
+		double firstRate = firstRows / firstSeconds;
+		double secondRate = secondRows / secondSeconds;
+		double target = firstRate / (firstRate + secondRate);
+		split.share += SPLIT_SHARE_WEIGHT * (target - split.share);
+	}
+	share = split.share;
+	pthread_mutex_unlock(&splitSharesMutex);
+	LOGD("Split %s: %u rows in %.1f ms, %u rows in %.1f ms, next share %.2f",
+			first.kernelKey.c_str(), (unsigned)firstRows, firstSeconds * 1e3,
+			(unsigned)secondRows, secondSeconds * 1e3, share);
+}
@@ -0,0 +1,184 @@
+#include "OVSR.h"
+
+#include <algorithm>
+
+/*
+ * Runs a kernel on images that are too large for one device image.
+ *
+ * Camera photos can exceed CL_DEVICE_IMAGE2D_MAX_WIDTH or _HEIGHT, or need more
+ * than CL_DEVICE_MAX_MEM_ALLOC_SIZE for one image. Such images are cut into tiles
+ * that fit. Every tile is uploaded with the halo its kernel reads around it, so the
+ * neighbourhood filters give the same result at the seams, and only the tile itself
+ * is read back into its place in the output. At the image edges the tile ends with
+ * the image, so the sampler clamps like it does on the whole image.
+ *
+ * The tiles of one row have the same size, so they reuse a few pooled device images.
+ * All commands go to the in-order queue of the session, which makes it safe to give
+ * the images of a tile back to the pool while its commands are still pending.
+ */
+#define TILE_UNKNOWN_HALO 2 // halo of kernels with an unknown radius, the largest of the bundled filters
+
+	/*! \brief Tells if an image exceeds the image or allocation limits of the device of a session.
+	 *
+	 * Limits the device did not report are not checked.
+	 */
+bool needsTiling(const OpenCLSession& openCLSession, size_t width, size_t height)
+{
+	if(openCLSession.image2DMaxWidth && width > openCLSession.image2DMaxWidth)
+		return true;
+	if(openCLSession.image2DMaxHeight && height > openCLSession.image2DMaxHeight)
+		return true;
+	return openCLSession.maxMemAllocSize && (cl_ulong)width * height * 4 > openCLSession.maxMemAllocSize;
+}
+
+/*! \brief Enqueues the upload, kernel and read back of one tile.
+ *
+ * @param openCLSession is the session that holds the kernel, with all extra kernel arguments set
+ * @param input describes the whole input image
+ * @param output describes the whole output image
+ * @param tile is the part of the output the tile produces
+ * @param halo is the number of extra input pixels on each side of the tile
+ * @param readEvent receives the event of the read back
+ * @return The OpenCL error code.
+ */
+static cl_int enqueueTile
+(
+		OpenCLSession& openCLSession,
+		const HostImage& input,
+		const HostImage& output,
+		const ImageRegion& tile,
+		size_t halo,
+		cl_event* readEvent
+)
+{
+	cl_int err = CL_SUCCESS;
+
+	cl_image_format image_format;
+	image_format.image_channel_data_type=CL_UNORM_INT8;
+	image_format.image_channel_order=CL_RGBA;
+
+	ImageRegion source;
+	source.x = (tile.x > halo) ? tile.x - halo : 0;
+	source.y = (tile.y > halo) ? tile.y - halo : 0;
+	source.width = std::min(input.width, tile.x + tile.width + halo) - source.x;
+	source.height = std::min(input.height, tile.y + tile.height + halo) - source.y;
+
+	PooledMemObject inputImage(openCLSession);
+	PooledMemObject outputImage(openCLSession);
+	inputImage.memObject =
+			acquireImage2D(openCLSession, CL_MEM_READ_ONLY, image_format, source.width, source.height, 0, 0, &err);
+	if(err != CL_SUCCESS)
+		return err;
+	outputImage.memObject =
+			acquireImage2D(openCLSession, CL_MEM_WRITE_ONLY, image_format, source.width, source.height, 0, 0, &err);
+	if(err != CL_SUCCESS)
+		return err;
+
+	const size_t origin[3] = {0, 0, 0};
+	const size_t sourceRegion[3] = {source.width, source.height, 1};
+	err = clEnqueueWriteImage(openCLSession.queue, inputImage.memObject, CL_FALSE,
+			origin, sourceRegion, input.stride, 0,
+			(char*)input.pixels + source.y * input.stride + source.x * 4,
+			0, 0, 0);
+	if(err != CL_SUCCESS)
+		return err;
+
+	err = clSetKernelArg(openCLSession.kernel, 0, sizeof(cl_mem), &inputImage.memObject);
+	if(err != CL_SUCCESS)
+		return err;
+	err = clSetKernelArg(openCLSession.kernel, 1, sizeof(cl_mem), &outputImage.memObject);
+	if(err != CL_SUCCESS)
+		return err;
+
+	size_t globalSize[2];
+	size_t localSize[2];
+	bool useLocalSize =
+			chooseWorkSize(openCLSession, openCLSession.kernel, source.width, source.height,
+					openCLSession.kernelBoundsChecked, globalSize, localSize);
+
+	err = clEnqueueNDRangeKernel(openCLSession.queue, openCLSession.kernel, 2, 0,
+			globalSize, useLocalSize ? localSize : 0, 0, 0, 0);
+	if(err != CL_SUCCESS)
+		return err;
+
+	const size_t tileOrigin[3] = {tile.x - source.x, tile.y - source.y, 0};
+	const size_t tileRegion[3] = {tile.width, tile.height, 1};
+	err = clEnqueueReadImage(openCLSession.queue, outputImage.memObject, CL_FALSE,
+			tileOrigin, tileRegion, output.stride, 0,
+			(char*)output.pixels + tile.y * output.stride + tile.x * 4,
+			0, 0, readEvent);
+	if(err != CL_SUCCESS)
+		return err;
+	return clFlush(openCLSession.queue);
+}
+
+	/*! \brief Runs the current kernel of a session on an image in tiles that fit the device.
+	 *
+	 * The first two kernel arguments are set to the tile images. Extra arguments have
+	 * to be set by the caller before. The halo comes from the radius of the bundled
+	 * filter, see splitHaloRows. Code from the input field gets TILE_UNKNOWN_HALO.
+	 *
+	 * @param openCLSession is the session that holds the kernel to be executed
+	 * @param input describes the RGBA pixels that have to be processed
+	 * @param output describes the RGBA pixels that receive the result, with the size of input
+	 */
+void executeTiledImage2DKernel
+(
+		OpenCLSession& openCLSession,
+		const HostImage& input,
+		const HostImage& output
+)
+{
+	timeval start;
+	gettimeofday(&start, NULL);
+
+	int radius = splitHaloRows(openCLSession.kernelKey);
+	size_t halo = (radius < 0) ? TILE_UNKNOWN_HALO : radius;
+
+	// The tile size includes the halo on both sides.
+	size_t maxWidth = openCLSession.image2DMaxWidth ? openCLSession.image2DMaxWidth : input.width + 2 * halo;
+	size_t maxHeight = openCLSession.image2DMaxHeight ? openCLSession.image2DMaxHeight : input.height + 2 * halo;
+	if(openCLSession.maxMemAllocSize)
+		maxHeight = std::min(maxHeight, (size_t)(openCLSession.maxMemAllocSize / (maxWidth * 4)));
+	if(maxWidth <= 2 * halo || maxHeight <= 2 * halo)
+	{
+		LOGE("The device limits leave no room for tiles with a halo of %u pixels", (unsigned)halo);
+		return;
+	}
+	size_t tileWidth = maxWidth - 2 * halo;
+	size_t tileHeight = maxHeight - 2 * halo;
+
+	cl_int err = CL_SUCCESS;
+	PendingCommands pending(openCLSession.queue);
+	ScopedEvent lastRead;
+	size_t tiles = 0;
+	for(size_t y = 0; y < input.height; y += tileHeight)
+	{
+		for(size_t x = 0; x < input.width; x += tileWidth)
+		{
+			ImageRegion tile;
+			tile.x = x;
+			tile.y = y;
+			tile.width = std::min(tileWidth, input.width - x);
+			tile.height = std::min(tileHeight, input.height - y);
+
+			if(lastRead.event)
+				clReleaseEvent(lastRead.event);
+			lastRead.event = 0;
+			err = enqueueTile(openCLSession, input, output, tile, halo, &lastRead.event);
+			SAMPLE_CHECK_ERRORS(err);
+			tiles++;
+		}
+	}
+
+	// The queue is in order, so the read back of the last tile completes after all others.
+	err = clWaitForEvents(1, &lastRead.event);
+	SAMPLE_CHECK_ERRORS(err);
+	pending.done();
+
+	timeval end;
+	gettimeofday(&end, NULL);
+	LOGD("%s ran in %u tiles of up to %u x %u pixels in %.1f ms", openCLSession.kernelKey.c_str(),
+			(unsigned)tiles, (unsigned)tileWidth, (unsigned)tileHeight,
+			((end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) * 1e-6) * 1e3);
+}
@@ -0,0 +1,299 @@
+#include "OVSR.h"
+
+#include <algorithm>
+
+/*
+ * Chooses the local work-group size of 2D kernels.
+ *
+ * The first time a kernel runs on a device for an image size class, a set of legal
+ * local sizes is timed and the fastest one is kept. A size class groups images whose
+ * width and height round up to the same power of two. The results are stored in a small
+ * text file, one "lx ly key" line per entry, so later runs of the app skip the timing.
+ * A local size of 0 x 0 means that the driver choice (a NULL local size) was fastest.
+ *
+ * Kernels that return for work-items outside the image get a global size rounded up to
+ * a multiple of the local size. Other kernels, like code from the input field, are only
+ * given local sizes that divide the image size, and the driver choice for images of
+ * their size class that the tuned size does not divide.
+ */
+#define WORK_SIZE_DB EXECDIR "worksizes.txt"
+#define TUNER_RUNS 3
+
+struct WorkGroupSize
+{
+	size_t x;
+	size_t y;
+};
+
+static std::map<std::string, WorkGroupSize> tunedSizes;
+static bool tunedSizesLoaded = false;
+static pthread_mutex_t tunedSizesMutex = PTHREAD_MUTEX_INITIALIZER; // engines on other threads share the database
+
+/*! \brief Reads the work-group size database once. Call it with tunedSizesMutex locked.
+ */
+static void loadTunedSizes()
+{
+	if(tunedSizesLoaded)
+		return;
+	tunedSizesLoaded = true;
+
+	std::ifstream file(WORK_SIZE_DB);
+	std::string line;
+	while(std::getline(file, line))
+	{
+		std::istringstream fields(line);
+		WorkGroupSize size;
+		std::string key;
+		if(!(fields >> size.x >> size.y))
+			continue;
+		std::getline(fields >> std::ws, key);
+		if(!key.empty())
+			tunedSizes[key] = size;
+	}
+}
+
+/*! \brief Writes the work-group size database, under a temporary name first. Call it with tunedSizesMutex locked.
+ */
+static void storeTunedSizes()
+{
+	std::string tempName = std::string(WORK_SIZE_DB) + ".tmp";
+	FILE* file = fopen(tempName.c_str(), "w");
+	if(!file)
+	{
+		LOGE("Cannot open %s to store the work-group sizes", tempName.c_str());
+		return;
+	}
+	std::map<std::string, WorkGroupSize>::iterator it;
+	for(it = tunedSizes.begin(); it != tunedSizes.end(); ++it)
+		fprintf(file, "%u %u %s\n", (unsigned)it->second.x, (unsigned)it->second.y, it->first.c_str());
+	if(fclose(file) != 0 || rename(tempName.c_str(), WORK_SIZE_DB) != 0)
+	{
+		LOGE("Cannot store the work-group sizes in %s", WORK_SIZE_DB);
+		remove(tempName.c_str());
+	}
+}
+
+/*! \brief Returns the smallest power of two that is not smaller than n.
+ */
+static size_t sizeClass(size_t n)
+{
+	size_t c = 1;
+	while(c < n)
+		c <<= 1;
+	return c;
+}
+
+/*! \brief Rounds n up to a multiple of m.
+ */
+static size_t roundUp(size_t n, size_t m)
+{
+	return ((n + m - 1) / m) * m;
+}
+
+/*! \brief Builds the database key of a kernel, device and image size class.
+ */
+static std::string tunerKey(OpenCLSession& openCLSession, cl_kernel kernel, size_t width, size_t height, bool padded)
+{
+	char name[256] = "";
+	char device[256] = "";
+	clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, sizeof(name) - 1, name, 0);
+	clGetDeviceInfo(openCLSession.device, CL_DEVICE_NAME, sizeof(device) - 1, device, 0);
+
+	/*
+	 * Kernels that can not be padded are keyed by the size class as well, so photos
+	 * of new sizes do not tune again. Their size is tuned on divisors of the first
+	 * image size, chooseWorkSize checks that it divides the sizes it is used for.
+	 */
+	std::ostringstream key;
+	key << name << " " << sizeClass(width) << "x" << sizeClass(height);
+	if(!padded)
+		key << " unpadded";
+
+	/*
+	 * Code from the input field is mostly named yourKernel, so its kernels
+	 * are told apart by a hash of their source.
+	 */
+	std::map<std::string, OpenCLKernelEntry>::const_iterator it;
+	for(it = openCLSession.kernels.begin(); it != openCLSession.kernels.end(); ++it)
+	{
+		if(it->second.kernel == kernel && it->first.compare(0, 6, "input:") == 0)
+		{
+			char hash[20];
+			sprintf(hash, "%016llx", sourceHash(it->second.source));
+			key << " " << hash;
+			break;
+		}
+	}
+	key << " " << device;
+	return key.str();
+}
+
+/*! \brief Lists the local sizes the tuner tries for a kernel.
+ *
+ * @return The candidates, starting with 0 x 0 for the driver choice.
+ */
+static std::vector<WorkGroupSize> localSizeCandidates
+(
+		OpenCLSession& openCLSession,
+		cl_kernel kernel,
+		size_t width,
+		size_t height,
+		bool padded
+)
+{
+	size_t kernelMax = 0;
+	size_t deviceMax = 0;
+	size_t itemMax[3] = {0, 0, 0};
+	clGetKernelWorkGroupInfo(kernel, openCLSession.device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(kernelMax), &kernelMax, 0);
+	clGetDeviceInfo(openCLSession.device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(deviceMax), &deviceMax, 0);
+	clGetDeviceInfo(openCLSession.device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(itemMax), itemMax, 0);
+	size_t groupMax = std::min(kernelMax, deviceMax);
+
+	std::vector<WorkGroupSize> candidates;
+	WorkGroupSize driver = {0, 0};
+	candidates.push_back(driver);
+
+	static const size_t sizesX[] = {4, 8, 16, 32, 64, 128};
+	static const size_t sizesY[] = {1, 2, 4, 8, 16};
+	for(size_t i = 0; i < sizeof(sizesX) / sizeof(sizesX[0]); i++)
+	{
+		for(size_t j = 0; j < sizeof(sizesY) / sizeof(sizesY[0]); j++)
+		{
+			WorkGroupSize size = {sizesX[i], sizesY[j]};
+			if(size.x * size.y > groupMax || size.x > itemMax[0] || size.y > itemMax[1])
+				continue;
+			if(size.x > width || size.y > height)
+				continue;
+			if(!padded && (width % size.x != 0 || height % size.y != 0))
+				continue;
+			candidates.push_back(size);
+		}
+	}
+	return candidates;
+}
+
+/*! \brief Runs a kernel with a local size and returns the fastest of TUNER_RUNS runs.
+ *
+ * @return The time in seconds, or a negative value when the local size is rejected.
+ */
+static double timeLocalSize
+(
+		OpenCLSession& openCLSession,
+		cl_kernel kernel,
+		size_t width,
+		size_t height,
+		const WorkGroupSize& size
+)
+{
+	size_t globalSize[2] = { width, height };
+	size_t localSize[2] = { size.x, size.y };
+	if(size.x)
+	{
+		globalSize[0] = roundUp(width, size.x);
+		globalSize[1] = roundUp(height, size.y);
+	}
+
+	double best = -1;
+	for(int run = 0; run <= TUNER_RUNS; run++)
+	{
+		timeval start;
+		timeval end;
+		gettimeofday(&start, NULL);
+		cl_int err = clEnqueueNDRangeKernel(openCLSession.queue, kernel, 2, 0, globalSize,
+				size.x ? localSize : 0, 0, 0, 0);
+		if(err == CL_SUCCESS)
+			err = clFinish(openCLSession.queue);
+		gettimeofday(&end, NULL);
+		if(err != CL_SUCCESS)
+			return -1;
+
+		// The first run warms up caches and lazy driver work and is not counted.
+		double seconds = (end.tv_sec + end.tv_usec * 1e-6) - (start.tv_sec + start.tv_usec * 1e-6);
+		if(run > 0 && (best < 0 || seconds < best))
+			best = seconds;
+	}
+	return best;
+}
+
+	/*! \brief Returns the global and local size for a 2D kernel over an image, tuning it the first time.
+	 *
+	 * Tuning runs the kernel several times with the arguments that are set, so they
+	 * have to be set and the input has to be complete before the first call for a key.
+	 *
+	 * @param openCLSession is the session that runs the kernel
+	 * @param kernel is the kernel, with all arguments set
+	 * @param width is the width of the image in pixels
+	 * @param height is the height of the image in pixels
+	 * @param padded is true when the kernel returns for work-items outside the image
+	 * @param globalSize receives the global size
+	 * @param localSize receives the local size
+	 * @return True when localSize has to be passed to clEnqueueNDRangeKernel, false for the driver choice.
+	 */
+bool chooseWorkSize
+(
+		OpenCLSession& openCLSession,
+		cl_kernel kernel,
+		size_t width,
+		size_t height,
+		bool padded,
+		size_t globalSize[2],
+		size_t localSize[2]
+)
+{
+	std::string key = tunerKey(openCLSession, kernel, width, height, padded);
+	WorkGroupSize best = {0, 0};
+
+	pthread_mutex_lock(&tunedSizesMutex);
+	loadTunedSizes();
+	std::map<std::string, WorkGroupSize>::iterator it = tunedSizes.find(key);
+	bool known = (it != tunedSizes.end());
+	if(known)
+		best = it->second;
+	pthread_mutex_unlock(&tunedSizesMutex);
+
+	/*
+	 * The timing runs without the lock. When two engines tune the same key
+	 * at the same time, the last result is kept.
+	 */
+	if(!known)
+	{
+		std::vector<WorkGroupSize> candidates = localSizeCandidates(openCLSession, kernel, width, height, padded);
+		double bestTime = -1;
+		for(size_t i = 0; i < candidates.size(); i++)
+		{
+			double seconds = timeLocalSize(openCLSession, kernel, width, height, candidates[i]);
+			if(seconds >= 0 && (bestTime < 0 || seconds < bestTime))
+			{
+				bestTime = seconds;
+				best = candidates[i];
+			}
+		}
+		LOGD("Tuned %s: local size %u x %u", key.c_str(), (unsigned)best.x, (unsigned)best.y);
+		pthread_mutex_lock(&tunedSizesMutex);
+		tunedSizes[key] = best;
+		storeTunedSizes();
+		pthread_mutex_unlock(&tunedSizesMutex);
+	}
+
+	globalSize[0] = width;
+	globalSize[1] = height;
+	if(!best.x)
+		return false;
+
+	/*
+	 * A size from the database can be too large for a small image of the size class,
+	 * may not divide the exact size anymore, or may be too large for this build of
+	 * the kernel. Then fall back to the driver choice.
+	 */
+	if(!padded && (width % best.x != 0 || height % best.y != 0))
+		return false;
+	size_t kernelMax = 0;
+	clGetKernelWorkGroupInfo(kernel, openCLSession.device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(kernelMax), &kernelMax, 0);
+	if(best.x * best.y > kernelMax)
+		return false;
+	localSize[0] = best.x;
+	localSize[1] = best.y;
+	globalSize[0] = roundUp(width, best.x);
+	globalSize[1] = roundUp(height, best.y);
+	return true;
+}
@@ -0,0 +1,369 @@
+#include "OVSR.h"
+
+/*
+ * Streams video frames through a kernel, or a pipeline of kernels, with
+ * VIDEO_STREAM_SLOTS frames in flight.
+ *
+ * The upload, kernel and download of a frame are chained with events over three
+ * queues and nothing waits for the kernel or the download. Only when all slots are
+ * busy the oldest frame is waited for and handed back, which is the frame that was
+ * submitted VIDEO_STREAM_SLOTS calls before.
+ *
+ * A packed BGR stream takes the 3 byte per pixel frames of FFmpeg and OpenCV as they
+ * are. They are uploaded to a buffer and the unpackBGR and packBGR kernels of
+ * convert.cl turn them into the RGBA images of the filter and back, so the host does
+ * no colour conversion. The frames come in direct ByteBuffers, so the transfers use
+ * the memory of the caller: the upload reads the input, and the call waits for it so
+ * the input can be reused, and the download writes to the output that was passed
+ * with the frame. Bitmap streams go through the staging memory of the slot instead,
+ * because the pixels of a bitmap are only locked during the call.
+ *
+ * The stages of a pipeline run on the device images of the slot, see enqueuePipeline,
+ * so a frame is uploaded and read back once however many filters it goes through.
+ */
+
+/*! \brief Looks up a kernel of the bundled program.
+ *
+ * @param openCLSession is the session that holds the kernel table
+ * @param name is the key of the kernel, the function name without "Kernel"
+ * @return The kernel, or 0 when the bundle does not have it.
+ */
+static cl_kernel findBundledKernel(OpenCLSession& openCLSession, const std::string& name)
+{
+	std::map<std::string, OpenCLKernelEntry>::iterator it = openCLSession.kernels.find(name);
+	if(it == openCLSession.kernels.end())
+		return 0;
+	return it->second.kernel;
+}
+
+/*! \brief Waits for the oldest frame in flight and copies its result to the host.
+ *
+ * @param stream is the video stream
+ * @param output describes the host pixels that receive the result, 0 for packed BGR
+ * streams, which download to the output that was passed with the frame
+ * @return The OpenCL error code.
+ */
+static cl_int collectOldestFrame(VideoStream& stream, const HostImage* output)
+{
+	size_t oldest = (stream.next + VIDEO_STREAM_SLOTS - stream.inFlight) % VIDEO_STREAM_SLOTS;
+	VideoFrameSlot& slot = stream.slots[oldest];
+
+	cl_int err = clWaitForEvents(1, &slot.readEvent);
+	clReleaseEvent(slot.readEvent);
+	slot.readEvent = 0;
+	slot.busy = false;
+	stream.inFlight--;
+	if(err != CL_SUCCESS || !output)
+		return err;
+
+	size_t rowSize = stream.width * stream.pixelBytes;
+	copyRows(output->pixels, output->stride, &slot.output[0], rowSize, rowSize, stream.height);
+	return CL_SUCCESS;
+}
+
+/*! \brief Waits for the commands of a frame that failed to be enqueued and leaves its slot free.
+ *
+ * The commands that were enqueued before the error still use the memory of the
+ * slot and of the caller.
+ *
+ * @param stream is the video stream
+ * @param slot is the slot of the frame
+ * @param err is the error that stopped the frame
+ * @return err
+ */
+static cl_int abandonFrame(VideoStream& stream, VideoFrameSlot& slot, cl_int err)
+{
+	clFinish(stream.uploadQueue);
+	clFinish(stream.session->queue);
+	clFinish(stream.downloadQueue);
+	if(slot.readEvent)
+		clReleaseEvent(slot.readEvent);
+	slot.readEvent = 0;
+	return err;
+}
+
+/*! \brief Enqueues the upload, kernel and download of a frame in the next slot.
+ *
+ * @param stream is the video stream, the next slot has to be free
+ * @param input describes the host pixels of the frame
+ * @param output describes the host pixels the download of a packed BGR frame writes to,
+ * ignored for bitmap streams
+ * @return The OpenCL error code.
+ */
+static cl_int enqueueFrame(VideoStream& stream, const HostImage& input, const HostImage& output)
+{
+	VideoFrameSlot& slot = stream.slots[stream.next];
+	OpenCLSession& openCLSession = *stream.session;
+	size_t rowSize = stream.width * stream.pixelBytes;
+	const size_t origin[3] = {0, 0, 0};
+	const size_t region[3] = {stream.width, stream.height, 1};
+	const size_t bytesRegion[3] = {rowSize, stream.height, 1};
+	cl_uint pitch = rowSize;
+
+	ScopedEvent writeEvent;
+	cl_int err = CL_SUCCESS;
+	if(stream.unpackKernel)
+	{
+		// The rows of the frame are packed in the buffer, the driver skips the row padding of the host.
+		err = clEnqueueWriteBufferRect(stream.uploadQueue, slot.inputBuffer, CL_FALSE,
+				origin, origin, bytesRegion, rowSize, 0, input.stride, 0, input.pixels, 0, 0, &writeEvent.event);
+		if(err != CL_SUCCESS)
+			return abandonFrame(stream, slot, err);
+
+		err = clSetKernelArg(stream.unpackKernel, 0, sizeof(cl_mem), &slot.inputBuffer);
+		if(err == CL_SUCCESS)
+			err = clSetKernelArg(stream.unpackKernel, 1, sizeof(cl_uint), &pitch);
+		if(err == CL_SUCCESS)
+			err = clSetKernelArg(stream.unpackKernel, 2, sizeof(cl_mem), &slot.inputImage);
+		if(err == CL_SUCCESS)
+			err = clEnqueueNDRangeKernel(openCLSession.queue, stream.unpackKernel, 2, 0, stream.convertSize, 0,
+					1, &writeEvent.event, 0);
+	}
+	else
+	{
+		copyRows(&slot.input[0], rowSize, input.pixels, input.stride, rowSize, stream.height);
+		err = clEnqueueWriteImage(stream.uploadQueue, slot.inputImage, CL_FALSE,
+				origin, region, rowSize, 0, &slot.input[0], 0, 0, &writeEvent.event);
+	}
+	if(err != CL_SUCCESS)
+		return abandonFrame(stream, slot, err);
+
+	/*
+	 * After the unpack stage the filters are ordered by the session queue itself.
+	 * Only the filter stages use their tuned local size, the convert kernels
+	 * check the image size and run on the exact image size with the driver choice.
+	 */
+	ScopedEvent kernelEvent;
+	err = enqueuePipeline(openCLSession, stream.stages, slot.inputImage, slot.outputImage, slot.tempImage,
+			stream.width, stream.height, writeEvent.event, !stream.unpackKernel,
+			0, stream.packKernel ? 0 : &kernelEvent.event);
+	if(err != CL_SUCCESS)
+		return abandonFrame(stream, slot, err);
+
+	if(stream.packKernel)
+	{
+		err = clSetKernelArg(stream.packKernel, 0, sizeof(cl_mem), &slot.outputImage);
+		if(err == CL_SUCCESS)
+			err = clSetKernelArg(stream.packKernel, 1, sizeof(cl_mem), &slot.outputBuffer);
+		if(err == CL_SUCCESS)
+			err = clSetKernelArg(stream.packKernel, 2, sizeof(cl_uint), &pitch);
+		if(err == CL_SUCCESS)
+			err = clEnqueueNDRangeKernel(openCLSession.queue, stream.packKernel, 2, 0, stream.convertSize, 0,
+					0, 0, &kernelEvent.event);
+		if(err == CL_SUCCESS)
+			err = clEnqueueReadBufferRect(stream.downloadQueue, slot.outputBuffer, CL_FALSE,
+					origin, origin, bytesRegion, rowSize, 0, output.stride, 0, output.pixels,
+					1, &kernelEvent.event, &slot.readEvent);
+	}
+	else
+	{
+		err = clEnqueueReadImage(stream.downloadQueue, slot.outputImage, CL_FALSE,
+				origin, region, rowSize, 0, &slot.output[0], 1, &kernelEvent.event, &slot.readEvent);
+	}
+	if(err != CL_SUCCESS)
+		return abandonFrame(stream, slot, err);
+
+	// Commands that wait on other queues only start when every queue was flushed.
+	clFlush(stream.uploadQueue);
+	clFlush(openCLSession.queue);
+	clFlush(stream.downloadQueue);
+
+	slot.busy = true;
+	stream.next = (stream.next + 1) % VIDEO_STREAM_SLOTS;
+	stream.inFlight++;
+
+	// The caller may reuse the input when the call returns, the kernels of older frames keep running.
+	if(stream.unpackKernel)
+		return clWaitForEvents(1, &writeEvent.event);
+	return CL_SUCCESS;
+}
+
+	/*! \brief Creates a video stream that runs a pipeline of kernels of a session.
+	 *
+	 * Every slot gets its device images, and the staging memory of bitmap streams,
+	 * up front, so submitting frames allocates nothing. Packed BGR streams need the convert
+	 * kernels of the bundled program, see initOpenCLBundle.
+	 *
+	 * @param openCLSession is the session that holds the kernels
+	 * @param stages are the filter stages, one stage for a single kernel
+	 * @param width is the width of the frames in pixels
+	 * @param height is the height of the frames in pixels
+	 * @param packedBGR is true for frames with 3 bytes per pixel in BGR order, false for RGBA frames
+	 * @param errcode_ret receives the OpenCL error code
+	 * @return The stream, or 0 on error. Release it with releaseVideoStream.
+	 */
+VideoStream* createVideoStream
+(
+		OpenCLSession& openCLSession,
+		const std::vector<PipelineStage>& stages,
+		size_t width,
+		size_t height,
+		bool packedBGR,
+		cl_int* errcode_ret
+)
+{
+	if(stages.empty())
+	{
+		*errcode_ret = CL_INVALID_KERNEL;
+		return 0;
+	}
+
+
+	cl_kernel unpackKernel = 0;
+	cl_kernel packKernel = 0;
+	if(packedBGR)
+	{
+		unpackKernel = findBundledKernel(openCLSession, "unpackBGR");
+		packKernel = findBundledKernel(openCLSession, "packBGR");
+		if(!unpackKernel || !packKernel)
+		{
+			LOGE("The BGR kernels are missing, build the bundled filters first");
+			*errcode_ret = CL_INVALID_KERNEL_NAME;
+			return 0;
+		}
+	}
+
+	VideoStream* stream = new VideoStream;
+	stream->session = &openCLSession;
+	stream->stages = stages;
+	stream->unpackKernel = unpackKernel;
+	stream->packKernel = packKernel;
+	stream->width = width;
+	stream->height = height;
+	stream->pixelBytes = packedBGR ? 3 : 4;
+	stream->convertSize[0] = width;
+	stream->convertSize[1] = height;
+
+	stream->uploadQueue = clCreateCommandQueue(openCLSession.context, openCLSession.device, 0, errcode_ret);
+	if(*errcode_ret == CL_SUCCESS)
+		stream->downloadQueue = clCreateCommandQueue(openCLSession.context, openCLSession.device, 0, errcode_ret);
+
+	cl_image_format image_format;
+	image_format.image_channel_data_type = CL_UNORM_INT8;
+	image_format.image_channel_order = CL_RGBA;
+
+	for(size_t i = 0; i < VIDEO_STREAM_SLOTS && *errcode_ret == CL_SUCCESS; i++)
+	{
+		VideoFrameSlot& slot = stream->slots[i];
+		size_t frameSize = width * height * stream->pixelBytes;
+		if(!packedBGR)
+		{
+			slot.input.resize(frameSize);
+			slot.output.resize(frameSize);
+		}
+		slot.inputImage = acquireImage2D(openCLSession, CL_MEM_READ_WRITE, image_format, width, height, 0, 0, errcode_ret);
+		if(*errcode_ret == CL_SUCCESS)
+			slot.outputImage = acquireImage2D(openCLSession, CL_MEM_READ_WRITE, image_format, width, height, 0, 0, errcode_ret);
+		if(stages.size() > 1 && *errcode_ret == CL_SUCCESS)
+			slot.tempImage = acquireImage2D(openCLSession, CL_MEM_READ_WRITE, image_format, width, height, 0, 0, errcode_ret);
+		if(packedBGR && *errcode_ret == CL_SUCCESS)
+			slot.inputBuffer = acquireBuffer(openCLSession, CL_MEM_READ_ONLY, frameSize, 0, errcode_ret);
+		if(packedBGR && *errcode_ret == CL_SUCCESS)
+			slot.outputBuffer = acquireBuffer(openCLSession, CL_MEM_WRITE_ONLY, frameSize, 0, errcode_ret);
+	}
+
+	if(*errcode_ret != CL_SUCCESS)
+	{
+		releaseVideoStream(stream);
+		return 0;
+	}
+	return stream;
+}
+
+	/*! \brief Submits a frame to a video stream.
+	 *
+	 * When all slots are busy, the oldest frame is finished first. A bitmap stream
+	 * copies its result to output. A packed BGR stream downloads every frame to the
+	 * output that was passed with it, so there the output of the frame that was
+	 * submitted VIDEO_STREAM_SLOTS calls before is ready, and output has to stay valid
+	 * and untouched until its own frame is ready. The first VIDEO_STREAM_SLOTS calls
+	 * return no result, call flushVideoFrame after the last frame to get the remaining ones.
+	 *
+	 * @param stream is the video stream
+	 * @param input describes the host pixels of the new frame, they can be reused after the call
+	 * @param output describes the host pixels that receive the result of an older frame,
+	 * or of this frame for packed BGR streams
+	 * @param outputReady is set to true when the result of an older frame was written
+	 * @return The OpenCL error code.
+	 */
+cl_int submitVideoFrame
+(
+		VideoStream& stream,
+		const HostImage& input,
+		const HostImage& output,
+		bool* outputReady
+)
+{
+	*outputReady = false;
+	if(stream.inFlight == VIDEO_STREAM_SLOTS)
+	{
+		cl_int err = collectOldestFrame(stream, stream.unpackKernel ? 0 : &output);
+		if(err != CL_SUCCESS)
+			return err;
+		*outputReady = true;
+	}
+	return enqueueFrame(stream, input, output);
+}
+
+	/*! \brief Finishes the oldest frame of a video stream without submitting a new one.
+	 *
+	 * @param stream is the video stream
+	 * @param output describes the host pixels that receive the result, 0 for packed BGR
+	 * streams, whose frames are downloaded to the output that was passed with them
+	 * @param outputReady is set to true when the result was written, false when no frame was in flight
+	 * @return The OpenCL error code.
+	 */
+cl_int flushVideoFrame
+(
+		VideoStream& stream,
+		const HostImage* output,
+		bool* outputReady
+)
+{
+	*outputReady = false;
+	if(stream.inFlight == 0)
+		return CL_SUCCESS;
+
+	cl_int err = collectOldestFrame(stream, output);
+	if(err != CL_SUCCESS)
+		return err;
+	*outputReady = true;
+	return CL_SUCCESS;
+}
+
+	/*! \brief Waits for all frames in flight and releases a video stream.
+	 *
+	 * The images go back to the memory pool of the session.
+	 *
+	 * @param stream is the video stream, 0 is ignored
+	 */
+void releaseVideoStream(VideoStream* stream)
+{
+	if(!stream)
+		return;
+
+	OpenCLSession& openCLSession = *stream->session;
+	if(stream->uploadQueue)
+		clFinish(stream->uploadQueue);
+	clFinish(openCLSession.queue);
+	if(stream->downloadQueue)
+		clFinish(stream->downloadQueue);
+
+	for(size_t i = 0; i < VIDEO_STREAM_SLOTS; i++)
+	{
+		VideoFrameSlot& slot = stream->slots[i];
+		if(slot.readEvent)
+			clReleaseEvent(slot.readEvent);
+		returnToPool(openCLSession, slot.inputImage);
+		returnToPool(openCLSession, slot.outputImage);
+		returnToPool(openCLSession, slot.tempImage);
+		returnToPool(openCLSession, slot.inputBuffer);
+		returnToPool(openCLSession, slot.outputBuffer);
+	}
+
+	if(stream->uploadQueue)
+		clReleaseCommandQueue(stream->uploadQueue);
+	if(stream->downloadQueue)
+		clReleaseCommandQueue(stream->downloadQueue);
+	delete stream;
+}
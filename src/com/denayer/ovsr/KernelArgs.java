@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) <2014> <Dries Goossens / driesgoossens93@gmail.com , Koen Daelman / koendaelman@gmail.com >
+ *
+ *Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ *The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ *THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+package com.denayer.ovsr;
+
+import java.util.ArrayList;
+
+/*! \brief Describes the extra arguments of a kernel, after the input and output image.
+ *
+ * The arguments are added in the order of the kernel signature. The native code checks them
+ * against the kernel before it runs, so runtime compiled kernels can take parameters too.
+ * Float arrays are uploaded once to a __constant buffer that is kept between calls.
+ */
+public class KernelArgs extends Object {
+	static final int INT = 0; // must match KERNEL_ARG_INT in OVSR.h
+	static final int FLOAT = 1;
+	static final int FLOAT_ARRAY = 2;
+
+	private ArrayList<Integer> types = new ArrayList<Integer>();
+	private ArrayList<Integer> ints = new ArrayList<Integer>();
+	private ArrayList<Float> floats = new ArrayList<Float>();
+	private ArrayList<float[]> arrays = new ArrayList<float[]>();
+
+	/*! \brief Adds an int or uint argument.
+	 * @param value is the value of the argument
+	 * @return this object, so calls can be chained
+	 */
+	public KernelArgs add(int value)
+	{
+		return add(INT, value, 0, null);
+	}
+	/*! \brief Adds a float argument.
+	 * @param value is the value of the argument
+	 * @return this object, so calls can be chained
+	 */
+	public KernelArgs add(float value)
+	{
+		return add(FLOAT, 0, value, null);
+	}
+	/*! \brief Adds a __constant or __global float* argument.
+	 * @param values are the floats the kernel reads
+	 * @return this object, so calls can be chained
+	 */
+	public KernelArgs add(float[] values)
+	{
+		return add(FLOAT_ARRAY, 0, 0, values);
+	}
+	private KernelArgs add(int type, int intValue, float floatValue, float[] arrayValue)
+	{
+		types.add(type);
+		ints.add(intValue);
+		floats.add(floatValue);
+		arrays.add(arrayValue);
+		return this;
+	}
+
+	int[] getTypes()
+	{
+		int[] result = new int[types.size()];
+		for(int i = 0; i < result.length; i++)
+			result[i] = types.get(i);
+		return result;
+	}
+	int[] getInts()
+	{
+		int[] result = new int[ints.size()];
+		for(int i = 0; i < result.length; i++)
+			result[i] = ints.get(i);
+		return result;
+	}
+	float[] getFloats()
+	{
+		float[] result = new float[floats.size()];
+		for(int i = 0; i < result.length; i++)
+			result[i] = floats.get(i);
+		return result;
+	}
+	float[][] getArrays()
+	{
+		return arrays.toArray(new float[arrays.size()][]);
+	}
+}
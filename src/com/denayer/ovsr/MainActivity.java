@@ -204,6 +204,11 @@ public class MainActivity extends Activity {
 			editor.putBoolean("showCode", false);
 			editor.commit();
 		}		
+		if(!settings.getBoolean("profileOpenCL", false))
+		{
+			editor.putBoolean("profileOpenCL", false);
+			editor.commit();
+		}
 		if(settings.getString("userName","") == "")
 		{
 			editor.putString("username", "");
@@ -514,6 +519,14 @@ public class MainActivity extends Activity {
 		Input_Image.setImageBitmap(ScaledBitmap);
 	}
 
+	/*! \brief Releases the native OpenCL sessions when the activity is destroyed.
+	 */
+	@Override
+	protected void onDestroy() {
+		OpenCLObject.closeOpenCL();
+		super.onDestroy();
+	}
+
 	/*! \brief Receives data from other activities via intents
 	 *
 	 * This function receives data from other activities via intents. From the resultCode variable the origin of the
@@ -968,7 +981,7 @@ public class MainActivity extends Activity {
 			public void onClick(View v) {
 				OpenCLButton.setChecked(true);
 				RenderScriptButton.setChecked(false);
-				final CharSequence[] items = {"GPU", "CPU"};
+				final CharSequence[] items = {"GPU", "CPU", "Auto", "GPU+CPU"};
 
 				AlertDialog.Builder builder = new AlertDialog.Builder(MainActivity.this);
 				builder.setTitle("Choose device type")
@@ -976,6 +989,7 @@ public class MainActivity extends Activity {
 					public void onClick(DialogInterface dialogInterface, int item) {
 						OpenCLObject.setDeviceType(item);
 						OpenCLButton.setText("OpenCL on " + items[item]);
+						ConsoleView.setText(OpenCLObject.describeDevices());
 						dialogInterface.dismiss();
 					}
 				});
@@ -1664,7 +1678,8 @@ public class MainActivity extends Activity {
 				}
 				else
 				{
-					OpenCLObject = new OpenCL(MainActivity.this,(ImageView)findViewById(R.id.ImageView2),new OpenCL.OnUpdateProcessBar() {
+					// The video gets its own OpenCL object, with its own native engine, so image filters can run meanwhile.
+					OpenCL videoOpenCL = new OpenCL(MainActivity.this,(ImageView)findViewById(R.id.ImageView2),new OpenCL.OnUpdateProcessBar() {
 						@Override
 						public void updateProcessBar(String message) {
 							if(message.contains("Load")){
@@ -1677,7 +1692,11 @@ public class MainActivity extends Activity {
 							} else publishProgress(message);
 						}
 					}); 
-					m.invoke(OpenCLObject,new Object[]{OpenCLVideoArguments});
+					try {
+						m.invoke(videoOpenCL,new Object[]{OpenCLVideoArguments});
+					} finally {
+						videoOpenCL.closeOpenCL();
+					}
 					//String[] bla = {"sharpen",null};
 					//OpenCLObject.OpenCLVideo(bla);
 				}
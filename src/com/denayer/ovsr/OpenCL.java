@@ -13,12 +13,10 @@ package com.denayer.ovsr;
 import static org.bytedeco.javacpp.opencv_core.IPL_DEPTH_8U;
 
 import java.io.BufferedReader;
-import java.io.File;
-import java.io.FileOutputStream;
 import java.io.IOException;
 import java.io.InputStream;
 import java.io.InputStreamReader;
-import java.io.OutputStream;
+import java.nio.ByteBuffer;
 import java.text.SimpleDateFormat;
 import java.util.Date;
 import java.util.concurrent.TimeUnit;
@@ -52,6 +50,15 @@ public class OpenCL extends Object {
 	private OnUpdateProcessBar mGUIUpdater = null;
 	static int dev_type;
 	static LogFile LogFileObject; 
+	static final String[] bundledFilters = {"blur", "edge", "inverse", "mediaan", "saturatie", "sharpen", "convert"}; // convert holds the BGR stages of the video stream
+	boolean sessionReady[] = new boolean[4]; // GPU, CPU, Auto, GPU+CPU
+	private long engine = 0; // handle of the native engine of this object, read by the native code
+	static final int PREVIEW_SIZE = 512; // longest side of the slider preview in pixels
+	static final int VIDEO_STREAM_SLOTS = 3; // frames the native video stream keeps in flight, see OVSR.h
+	static final int STREAM_ERROR = -1; // results of the packed BGR stream calls
+	static final int STREAM_NO_FRAME = 0;
+	static final int STREAM_FRAME_READY = 1;
+	String profileText = ""; // stage times of the last filter, set by setProfileFromJNI in profiling mode
 
 	/*! \brief The OpenCL constructor.
 	 *
@@ -66,6 +73,7 @@ public class OpenCL extends Object {
 		mContext = context;
 		outputButton = imageView;
 		LogFileObject = new LogFile(mContext); 	   
+		mContext.getDir("execdir", Context.MODE_PRIVATE); // creates EXECDIR for the program cache and the work-group sizes
 
 		try { 
 			//Odroid lib
@@ -100,6 +108,7 @@ public class OpenCL extends Object {
 		try {
 			System.loadLibrary("OVSR");  
 			Log.i("Debug","My Lib Loaded!");
+			engine = createEngine();
 		}
 		catch (UnsatisfiedLinkError e) {
 			Log.e("Debug", "Error log", e);
@@ -110,6 +119,13 @@ public class OpenCL extends Object {
 		outputButton = imageView;
 		mGUIUpdater = listener;
 		LogFileObject = new LogFile(mContext); 	   
+		mContext.getDir("execdir", Context.MODE_PRIVATE); // creates EXECDIR for the program cache and the work-group sizes
+		try {
+			engine = createEngine();
+		}
+		catch (UnsatisfiedLinkError e) {
+			Log.e("Debug", "Error log", e);
+		}
 	}
 	/*! \brief Returns a boolean to be able to check OpenCL support in the main code
 	 *
@@ -129,6 +145,8 @@ public class OpenCL extends Object {
 		info[0] = bmpOrig.getWidth();
 		info[1] = bmpOrig.getHeight();
 		bmpOpenCL = Bitmap.createBitmap(info[0], info[1], Bitmap.Config.ARGB_8888);
+		if(engine != 0)
+			nativeUnpinInput(); // the pinned copy belongs to the previous bitmap
 	}
 	/*! \brief Getter function to get the resulting bitmap from one of the OpenCL functions.
 	 *
@@ -141,10 +159,19 @@ public class OpenCL extends Object {
 	}
 	/*! \brief Connection between Java and Native code.
 	 *
-	 * The initOpenCL function needs a kernel name and initialises the OpenCL environment.
+	 * The initOpenCLSession function creates the native session for a device type and
+	 * builds one program from the sources of all bundled filters.
+	 * @param sources contains the OpenCL code of the bundled filters
+	 * @return false when no session could be created or the filters did not build
+	 */
+	private synchronized native boolean initOpenCLSession (String[] sources,int dev_type);
+	/*! \brief Connection between Java and Native code.
+	 *
+	 * The initOpenCL function needs a kernel name and selects the kernel in the session.
+	 * Bundled filters are only looked up, other kernels are compiled the first time.
 	 * @param kernelName is the kernel name of the kernel that has to be excecuted later
 	 */
-	private native void initOpenCL (String kernelName,int dev_type);
+	private synchronized native void initOpenCL (String kernelName,int dev_type);
 	/*! \brief Connection between Java and Native code.
 	 *
 	 * The initOpenCLFromInput function needs a kernel name and the OpenCL code.
@@ -152,14 +179,14 @@ public class OpenCL extends Object {
 	 * @param OpenCLCode is a String that contains the OpenCL code
 	 * @param kernelName is a String that contains the kernel name from the OpenCLCode
 	 */
-	private native void initOpenCLFromInput (String OpenCLCode, String kernelName,int dev_type);
+	private synchronized native void initOpenCLFromInput (String OpenCLCode, String kernelName,int dev_type);
 	/*! \brief Connection between Java and Native code.
 	 *
 	 * The nativeBasicOpenCL function needs an input and output bitmap and executes the kernel initialized in initOpenCL.
 	 * @param inputBitmap is the bitmap to be processed
 	 * @param outputBitmap is the resulting bitmap
 	 */
-	private native void nativeBasicOpenCL (
+	private synchronized native void nativeBasicOpenCL (
 			Bitmap inputBitmap,
 			Bitmap outputBitmap
 			);
@@ -170,7 +197,7 @@ public class OpenCL extends Object {
 	 * @param inputBitmap is the bitmap to be processed
 	 * @param outputBitmap is the resulting bitmap
 	 */
-	private native void nativeImage2DOpenCL(
+	private synchronized native void nativeImage2DOpenCL(
 			Bitmap inputBitmap,
 			Bitmap outputBitmap
 			);
@@ -183,16 +210,302 @@ public class OpenCL extends Object {
 	 * @param outputBitmap is the resulting bitmap
 	 * @param saturatie is a float between 0 and 200
 	 */
-	private native void nativeSaturatieImage2DOpenCL(
+	private synchronized native void nativeSaturatieImage2DOpenCL(
 			Bitmap inputBitmap,
 			Bitmap outputBitmap,
 			float saturatie
 			);
 	/*! \brief Connection between Java and Native code.
 	 *
-	 * The shutdownOpenCL function removes all OpenCL allocations.
+	 * The nativeStreamStart function prepares the kernel initialized in initOpenCL for a sequence of video frames.
+	 * Several frames are in flight at the same time, so uploads, kernels and downloads of neighbouring frames overlap.
+	 * @param width is the width of the frames
+	 * @param height is the height of the frames
+	 * @param packedBGR is true for 3 channel BGR frames (nativeStreamSubmitBGR), false for bitmaps (nativeStreamSubmit)
+	 * @return true when the stream is ready
+	 */
+	private synchronized native boolean nativeStreamStart(int width, int height, boolean packedBGR);
+	/*! \brief Connection between Java and Native code.
+	 *
+	 * The nativeStreamSubmit function hands a frame to the stream. The result lags a few frames behind the input.
+	 * @param inputBitmap is the new frame, it can be reused when the function returns
+	 * @param outputBitmap receives the result of an older frame
+	 * @return true when outputBitmap holds a result
+	 */
+	private synchronized native boolean nativeStreamSubmit(
+			Bitmap inputBitmap,
+			Bitmap outputBitmap
+			);
+	/*! \brief Connection between Java and Native code.
+	 *
+	 * The nativeStreamFlush function returns the frames that are still in flight after the last submit, one per call.
+	 * @param outputBitmap receives the result of the oldest frame
+	 * @return true when outputBitmap holds a result, false when all frames are returned
+	 */
+	private synchronized native boolean nativeStreamFlush(Bitmap outputBitmap);
+	/*! \brief Connection between Java and Native code.
+	 *
+	 * The nativeStreamSubmitBGR function hands a 3 channel BGR frame, like the frames of FFmpegFrameGrabber, to the stream.
+	 * The conversion to RGBA and back runs on the device, so no cvCvtColor and no bitmap is needed.
+	 * The result is downloaded straight into output, so every frame in flight needs its own output.
+	 * @param input is a direct ByteBuffer with the new frame, it can be reused when the function returns
+	 * @param inputStride is the number of bytes per row of input
+	 * @param output is a direct ByteBuffer that receives the result of this frame, it is not touched until the frame is returned
+	 * @param outputStride is the number of bytes per row of output
+	 * @return STREAM_FRAME_READY when the output of the frame submitted VIDEO_STREAM_SLOTS calls before holds its result,
+	 * STREAM_NO_FRAME when no frame is done yet and STREAM_ERROR when the frame failed
+	 */
+	private synchronized native int nativeStreamSubmitBGR(
+			ByteBuffer input,
+			int inputStride,
+			ByteBuffer output,
+			int outputStride
+			);
+	/*! \brief Connection between Java and Native code.
+	 *
+	 * The nativeStreamFlushBGR function returns the BGR frames that are still in flight after the last submit, one per call.
+	 * @return STREAM_FRAME_READY when the output of the oldest frame holds its result, STREAM_NO_FRAME when all
+	 * frames are returned and STREAM_ERROR when the frame failed
+	 */
+	private synchronized native int nativeStreamFlushBGR();
+	/*! \brief Connection between Java and Native code.
+	 *
+	 * The nativeStreamStop function closes the stream opened by nativeStreamStart.
+	 */
+	private synchronized native void nativeStreamStop();
+	/*! \brief Connection between Java and Native code.
+	 *
+	 * The setSaturatie function sets the saturation of the saturatie kernel for the frames submitted next.
+	 * @param saturatie is a float between 0 and 200
+	 */
+	private synchronized native void setSaturatie(float saturatie);
+	/*! \brief Connection between Java and Native code.
+	 *
+	 * The setPipeline function selects a chain of kernels that runs on the device without copying
+	 * the images in between back to the host. It is used by nativePipelineOpenCL and nativeStreamStart
+	 * until the next initOpenCL call. In Auto and GPU+CPU mode the pipeline runs on the GPU.
+	 * @param kernelNames are the kernels in the order they run
+	 * @param parameters holds the extra argument of each kernel, the saturation in percent for saturatie
+	 * @param dev_type is the device type
+	 * @return true when every kernel is available
+	 */
+	private synchronized native boolean setPipeline(String[] kernelNames, float[] parameters, int dev_type);
+	/*! \brief Connection between Java and Native code.
+	 *
+	 * The nativePipelineOpenCL function runs the pipeline of setPipeline on a bitmap.
+	 * @param inputBitmap is the bitmap to be processed
+	 * @param outputBitmap receives the result of the last kernel
+	 */
+	private synchronized native void nativePipelineOpenCL(Bitmap inputBitmap, Bitmap outputBitmap);
+	/*! \brief Connection between Java and Native code.
+	 *
+	 * The nativeBatchOpenCL function runs the current kernel or pipeline over many bitmaps in one call,
+	 * with the transfers of neighbouring bitmaps overlapping the kernels.
+	 * @param inputBitmaps are the bitmaps to be processed
+	 * @param outputBitmaps receive the results, each with the size of its input
+	 * @return the seconds every bitmap took from its submission until its result was back, or null on error
+	 */
+	private synchronized native float[] nativeBatchOpenCL(Bitmap[] inputBitmaps, Bitmap[] outputBitmaps);
+	/*! \brief Connection between Java and Native code.
+	 *
+	 * The nativePreviewStart function keeps a downsampled copy of the bitmap on the device for the current kernel,
+	 * so interactive filters can be rendered on it for every slider change.
+	 * @param inputBitmap is the full resolution bitmap
+	 * @param maxSide is the longest side of the preview
+	 * @return the width and height of the preview, or null on error
+	 */
+	private synchronized native int[] nativePreviewStart(Bitmap inputBitmap, int maxSide);
+	/*! \brief Connection between Java and Native code.
+	 *
+	 * The nativePinInput function keeps a copy of the bitmap on the device of the current kernel,
+	 * so nativeRerunPinned can run the kernel again without uploading it.
+	 * @param inputBitmap is the bitmap to be processed several times
+	 * @return true when the bitmap is on the device
+	 */
+	private synchronized native boolean nativePinInput(Bitmap inputBitmap);
+	/*! \brief Connection between Java and Native code.
+	 *
+	 * The nativeRerunPinned function sets the arguments of a KernelArgs object and runs the current kernel on the pinned input.
+	 * The arguments are checked against the kernel first, without arguments the ones that are set are kept.
+	 * @param outputBitmap receives the result, with the size of the pinned bitmap
+	 * @param types are the KernelArgs types of the arguments
+	 * @param ints are the values of the int arguments
+	 * @param floats are the values of the float arguments
+	 * @param arrays are the values of the float array arguments
+	 * @return true when outputBitmap was written
+	 */
+	private synchronized native boolean nativeRerunPinned(Bitmap outputBitmap,
+			int[] types, int[] ints, float[] floats, float[][] arrays);
+	/*! \brief Connection between Java and Native code.
+	 *
+	 * The nativeUnpinInput function releases the copy of nativePinInput.
+	 */
+	private synchronized native void nativeUnpinInput();
+	/*! \brief Connection between Java and Native code.
+	 *
+	 * The nativePreviewRender function runs the current kernel, with its current arguments, on the preview.
+	 * @param previewBitmap receives the result, with the size nativePreviewStart returned
+	 * @return true when previewBitmap was written
+	 */
+	private synchronized native boolean nativePreviewRender(Bitmap previewBitmap);
+	/*! \brief Connection between Java and Native code.
+	 *
+	 * The nativePreviewStop function releases the preview of nativePreviewStart.
+	 */
+	private synchronized native void nativePreviewStop();
+	/*! \brief Connection between Java and Native code.
+	 *
+	 * The nativeImage2DOpenCLRegion function runs the current kernel on a rectangle of the bitmap only.
+	 * The output bitmap keeps its pixels outside the rectangle.
+	 * @param inputBitmap is the bitmap to be processed
+	 * @param outputBitmap receives the result in the rectangle, with the size of inputBitmap
+	 * @param x is the left column of the rectangle
+	 * @param y is the top row of the rectangle
+	 * @param width is the width of the rectangle
+	 * @param height is the height of the rectangle
+	 */
+	private synchronized native void nativeImage2DOpenCLRegion(Bitmap inputBitmap, Bitmap outputBitmap, int x, int y, int width, int height);
+	/*! \brief Connection between Java and Native code.
+	 *
+	 * The nativeMedianOpenCL function runs the median filter with a radius, call initOpenCL("mediaan") first.
+	 * @param inputBitmap is the bitmap to be processed
+	 * @param outputBitmap is the result of the median filter
+	 * @param radius is the radius of the square window, from 1 to 127
+	 */
+	private synchronized native void nativeMedianOpenCL(Bitmap inputBitmap, Bitmap outputBitmap, int radius);
+	/*! \brief Connection between Java and Native code.
+	 *
+	 * The nativeImage2DOpenCLArgs function runs the current kernel with the arguments of a KernelArgs object,
+	 * as parallel arrays with one entry per argument. The arguments are checked against the kernel first.
+	 * @param inputBitmap is the bitmap to be processed
+	 * @param outputBitmap is the result of the kernel
+	 * @param types are the KernelArgs types of the arguments
+	 * @param ints are the values of the int arguments
+	 * @param floats are the values of the float arguments
+	 * @param arrays are the values of the float array arguments
+	 * @return false when the arguments do not fit the kernel, the reason is in the console
+	 */
+	private synchronized native boolean nativeImage2DOpenCLArgs(Bitmap inputBitmap, Bitmap outputBitmap,
+			int[] types, int[] ints, float[] floats, float[][] arrays);
+	/*! \brief Connection between Java and Native code.
+	 *
+	 * The ByteBuffer variants of nativeImage2DOpenCL and nativeSaturatieImage2DOpenCL take RGBA pixels
+	 * in direct ByteBuffers, for example IplImage.getByteBuffer(), so no bitmap is needed in between.
+	 * @param inputBuffer is a direct ByteBuffer with the pixels to be processed
+	 * @param outputBuffer is a direct ByteBuffer that receives the result
+	 * @param width is the width of the image
+	 * @param height is the height of the image
+	 * @param stride is the number of bytes per row of both buffers
+	 */
+	private synchronized native void nativeImage2DOpenCLBuffer(
+			ByteBuffer inputBuffer,
+			ByteBuffer outputBuffer,
+			int width,
+			int height,
+			int stride
+			);
+	private synchronized native void nativeSaturatieImage2DOpenCLBuffer(
+			ByteBuffer inputBuffer,
+			ByteBuffer outputBuffer,
+			int width,
+			int height,
+			int stride,
+			float saturatie
+			);
+	/*! \brief Connection between Java and Native code.
+	 *
+	 * The createEngine function creates the native state of this object. Every OpenCL object has its own
+	 * engine with its own sessions, so objects used from different threads do not share kernels or buffers.
+	 * The other native methods are synchronized on the object, like closeOpenCL, so the engine
+	 * can not be destroyed while a native call uses it.
+	 * @return The handle of the engine, kept in the engine field
 	 */
-	private native void shutdownOpenCL ();
+	private native long createEngine ();
+	/*! \brief Connection between Java and Native code.
+	 *
+	 * The destroyEngine function removes all OpenCL allocations of an engine.
+	 * The native sessions keep their context, command queue and compiled kernels between filter calls,
+	 * so this is only called from closeOpenCL and finalize.
+	 * @param handle is the handle returned by createEngine
+	 */
+	private native void destroyEngine (long handle);
+	/*! \brief Connection between Java and Native code.
+	 *
+	 * The setZeroCopy function chooses how pixels reach the device. With zero-copy the device
+	 * works on host-visible memory that is mapped instead of copied. It is on by default for
+	 * devices with unified memory, the native code falls back to copies when the driver can't share memory.
+	 * @param enable is true to use zero-copy transfers
+	 */
+	public synchronized native void setZeroCopy (boolean enable);
+	/*! \brief Connection between Java and Native code.
+	 *
+	 * The setProfiling function switches per-stage profiling on or off. In profiling mode the native code
+	 * times the upload, kernel and download with OpenCL events and calls setProfileFromJNI after every filter.
+	 * @param enable is true to profile
+	 */
+	private synchronized native void setProfiling (boolean enable);
+	/*! \brief Connection between Java and Native code.
+	 *
+	 * The getDeviceList function lists every OpenCL device of every platform with its compute units,
+	 * clock frequency, image support, maximum image size and local memory.
+	 * @return One line per device
+	 */
+	private synchronized native String[] getDeviceList ();
+	/*! \brief Releases the native engine with its OpenCL sessions.
+	 *
+	 * Call this when OpenCL is not needed anymore, for example when the activity is destroyed
+	 * or a video task finished. The object can not run filters afterwards.
+	 */
+	public synchronized void closeOpenCL()
+	{
+		if(engine != 0)
+			destroyEngine(engine);
+		engine = 0;
+		for(int i = 0; i < sessionReady.length; i++)
+			sessionReady[i] = false;
+	}
+	/*! \brief Releases the native engine when the object was never closed.
+	 */
+	@Override
+	protected void finalize() throws Throwable
+	{
+		try {
+			closeOpenCL();
+		} finally {
+			super.finalize();
+		}
+	}
+	/*! \brief Returns the OpenCL devices of the phone, one device per line.
+	 */
+	public String describeDevices()
+	{
+		if(!sfoundLibrary)
+			return "OpenCL library not found";
+		StringBuilder text = new StringBuilder();
+		String[] devices = getDeviceList();
+		if(devices == null)
+			return "OpenCL is closed";
+		for(int i = 0; i < devices.length; i++)
+			text.append(devices[i]).append("\n");
+		return text.toString();
+	}
+	/*! \brief Makes sure the native session of the selected device type holds the bundled filters.
+	 *
+	 * The sources are read from the assets and compiled only once per device type,
+	 * so switching filters afterwards is a table lookup in the native code.
+	 * In auto and GPU+CPU mode they are compiled for the best GPU and the best CPU.
+	 */
+	private void initSession()
+	{
+		setProfiling(mContext.getSharedPreferences("Preferences", 0).getBoolean("profileOpenCL", false));
+		int index = (dev_type >= 1 && dev_type <= 3) ? dev_type : 0;
+		if(sessionReady[index])
+			return;
+		String[] sources = new String[bundledFilters.length];
+		for(int i = 0; i < bundledFilters.length; i++)
+			sources[i] = getFilterCode(bundledFilters[i]);
+		sessionReady[index] = initOpenCLSession(sources, dev_type);
+	}
 	/*! \brief This function will be called when the Edge button is clicked.
 	 *
 	 * It will execute all steps to apply the OpenCL edge filter onto the image, gets the execution time and has a check to make sure the bitmap is valid.
@@ -201,15 +514,14 @@ public class OpenCL extends Object {
 	{
 		if(bmpOrig == null)
 			return;
-		copyFile("edge.cl");
 		String kernelName="edge";
 		long startTime = System.nanoTime(); 
+		initSession();
 		initOpenCL(kernelName,dev_type);
 		nativeImage2DOpenCL(
 				bmpOrig,
 				bmpOpenCL
 				);
-		shutdownOpenCL();
 		long estimatedTime = System.nanoTime() - startTime;
 		estimatedTime = TimeUnit.NANOSECONDS.toMillis(estimatedTime);
 		setTimeToLog(estimatedTime);
@@ -224,15 +536,14 @@ public class OpenCL extends Object {
 	{
 		if(bmpOrig == null)
 			return;
-		copyFile("inverse.cl");
 		String kernelName="inverse";
 		long startTime = System.nanoTime(); 
+		initSession();
 		initOpenCL(kernelName,dev_type);
 		nativeImage2DOpenCL(
 				bmpOrig,
 				bmpOpenCL
 				);
-		shutdownOpenCL();
 		long estimatedTime = System.nanoTime() - startTime;
 		estimatedTime = TimeUnit.NANOSECONDS.toMillis(estimatedTime);
 		setTimeToLog(estimatedTime);
@@ -248,15 +559,14 @@ public class OpenCL extends Object {
 	{
 		if(bmpOrig == null)
 			return;
-		copyFile("sharpen.cl");
 		String kernelName="sharpen";
 		long startTime = System.nanoTime(); 
+		initSession();
 		initOpenCL(kernelName,dev_type);
 		nativeImage2DOpenCL(
 				bmpOrig,
 				bmpOpenCL
 				);
-		shutdownOpenCL();
 		long estimatedTime = System.nanoTime() - startTime;
 		estimatedTime = TimeUnit.NANOSECONDS.toMillis(estimatedTime);
 		setTimeToLog(estimatedTime);
@@ -269,19 +579,31 @@ public class OpenCL extends Object {
 	 * It will execute all steps to apply the OpenCL mediaan filter onto the image, gets the execution time and has a check to make sure the bitmap is valid.
 	 */
 	public void OpenCLMediaan ()
+	{
+		OpenCLMediaan(2);
+	}
+	/*! \brief Applies the OpenCL median filter with a radius onto the image.
+	 *
+	 * Radius 1 and 2 use a sorting network, larger radii a sliding histogram whose cost
+	 * grows with the radius instead of with its square.
+	 * The window has to fit the 16 bit histogram bins of the native code, so the radius is at most 127,
+	 * larger radii are rejected and leave the output bitmap unchanged.
+	 * @param radius is the radius of the square window, from 1 to 127
+	 */
+	public void OpenCLMediaan (int radius)
 	{
 		if(bmpOrig == null)
 			return;
-		copyFile("mediaan.cl");
 		String kernelName="mediaan";
 		long startTime = System.nanoTime(); 
 
+		initSession();
 		initOpenCL(kernelName,dev_type);
-		nativeImage2DOpenCL(
+		nativeMedianOpenCL(
 				bmpOrig,
-				bmpOpenCL
+				bmpOpenCL,
+				radius
 				);
-		shutdownOpenCL();
 		long estimatedTime = System.nanoTime() - startTime;
 		estimatedTime = TimeUnit.NANOSECONDS.toMillis(estimatedTime);
 		setTimeToLog(estimatedTime);
@@ -297,21 +619,213 @@ public class OpenCL extends Object {
 	{
 		if(bmpOrig == null)
 			return;
-		copyFile("blur.cl");
 		String kernelName="blur";
 		long startTime = System.nanoTime(); 
+		initSession();
 		initOpenCL(kernelName,dev_type);
 		nativeImage2DOpenCL(
 				bmpOrig,
 				bmpOpenCL
 				);
-		shutdownOpenCL();
 		long estimatedTime = System.nanoTime() - startTime;
 		estimatedTime = TimeUnit.NANOSECONDS.toMillis(estimatedTime);
 		setTimeToLog(estimatedTime);
 		
         setHistory("Blur",estimatedTime);
 
+	}
+	/*! \brief Returns the parameters setPipeline needs for a chain of filters.
+	 *
+	 * Only saturatie takes a parameter, the current saturation or 100 when none was chosen yet.
+	 */
+	private float[] pipelineParameters(String[] filters)
+	{
+		float[] parameters = new float[filters.length];
+		for(int i = 0; i < filters.length; i++)
+			parameters[i] = filters[i].equals("saturatie") ? (saturatie < 0 ? 100 : saturatie) : 0;
+		return parameters;
+	}
+	/*! \brief Applies a chain of filters onto the image in one pass on the device.
+	 *
+	 * Only the original image is uploaded and only the result of the last filter is read back,
+	 * which is faster than running the filters one by one.
+	 * @param filters are the kernel names of the filters, in the order they are applied
+	 */
+	public void OpenCLPipeline (String[] filters)
+	{
+		if(bmpOrig == null || filters.length == 0)
+			return;
+		long startTime = System.nanoTime();
+		initSession();
+		if(!setPipeline(filters, pipelineParameters(filters), dev_type))
+			return;
+		nativePipelineOpenCL(
+				bmpOrig,
+				bmpOpenCL
+				);
+		long estimatedTime = System.nanoTime() - startTime;
+		estimatedTime = TimeUnit.NANOSECONDS.toMillis(estimatedTime);
+		setTimeToLog(estimatedTime);
+
+		StringBuilder name = new StringBuilder(filters[0]);
+		for(int i = 1; i < filters.length; i++)
+			name.append("+").append(filters[i]);
+        setHistory(name.toString(),estimatedTime);
+	}
+	/*! \brief Selects a filter and keeps the original image on the device for re-runs with other arguments.
+	 *
+	 * @param kernelName is the kernel name of the filter
+	 * @return true when the image is on the device
+	 */
+	public boolean pinInput (String kernelName)
+	{
+		if(bmpOrig == null)
+			return false;
+		initSession();
+		initOpenCL(kernelName,dev_type);
+		return nativePinInput(bmpOrig);
+	}
+	/*! \brief Runs the saturation filter again on the pinned image with another saturation.
+	 *
+	 * Only the argument is set, the kernel runs and the result is read back, so parameter sweeps
+	 * and slider scrubbing skip the upload. Call pinInput("saturatie") first.
+	 * @param saturatie is a float between 0 and 200
+	 * @return true when the result image was updated
+	 */
+	public boolean rerunSaturatie (float saturatie)
+	{
+		if(bmpOrig == null)
+			return false;
+		long startTime = System.nanoTime();
+		setSaturatie(saturatie);
+		boolean done = rerunWithArgs(new KernelArgs());
+		long estimatedTime = System.nanoTime() - startTime;
+		estimatedTime = TimeUnit.NANOSECONDS.toMillis(estimatedTime);
+		setTimeToLog(estimatedTime);
+		if(done)
+			setHistory("Saturation",estimatedTime);
+		return done;
+	}
+	/*! \brief Runs the pinned filter again on the pinned image with other arguments.
+	 *
+	 * Call pinInput first. The arguments follow the input and output image, in the order the kernel takes them.
+	 * @param args are the kernel arguments from the third one on
+	 * @return false when the arguments do not fit the kernel or nothing is pinned
+	 */
+	public boolean rerunPinned (KernelArgs args)
+	{
+		if(bmpOrig == null)
+			return false;
+		long startTime = System.nanoTime();
+		boolean done = rerunWithArgs(args);
+		long estimatedTime = System.nanoTime() - startTime;
+		estimatedTime = TimeUnit.NANOSECONDS.toMillis(estimatedTime);
+		setTimeToLog(estimatedTime);
+		return done;
+	}
+	private boolean rerunWithArgs (KernelArgs args)
+	{
+		return nativeRerunPinned(
+				bmpOpenCL,
+				args.getTypes(),
+				args.getInts(),
+				args.getFloats(),
+				args.getArrays()
+				);
+	}
+	/*! \brief Applies a filter onto a rectangle of the image, for example under a brush stroke.
+	 *
+	 * The original pixels in the rectangle are filtered into the result image, the rest of
+	 * the result stays as it is. The cost is in proportion to the size of the rectangle.
+	 * @param kernelName is the kernel name of the filter
+	 * @param x is the left column of the rectangle
+	 * @param y is the top row of the rectangle
+	 * @param width is the width of the rectangle
+	 * @param height is the height of the rectangle
+	 */
+	public void OpenCLRegion (String kernelName, int x, int y, int width, int height)
+	{
+		if(bmpOrig == null)
+			return;
+		long startTime = System.nanoTime();
+		initSession();
+		initOpenCL(kernelName,dev_type);
+		if(kernelName.equals("saturatie"))
+			setSaturatie(saturatie < 0 ? 100 : saturatie);
+		nativeImage2DOpenCLRegion(
+				bmpOrig,
+				bmpOpenCL,
+				x, y, width, height
+				);
+		long estimatedTime = System.nanoTime() - startTime;
+		estimatedTime = TimeUnit.NANOSECONDS.toMillis(estimatedTime);
+		setTimeToLog(estimatedTime);
+	}
+	/*! \brief Applies a filter with extra kernel arguments.
+	 *
+	 * The arguments follow the input and output image, in the order the kernel takes them.
+	 * @param kernelName is the kernel name of the filter
+	 * @param args are the kernel arguments from the third one on
+	 * @return false when the arguments do not fit the kernel
+	 */
+	public boolean OpenCLWithArgs (String kernelName, KernelArgs args)
+	{
+		if(bmpOrig == null)
+			return false;
+		long startTime = System.nanoTime();
+		initSession();
+		initOpenCL(kernelName,dev_type);
+		boolean done = runWithArgs(args);
+		long estimatedTime = System.nanoTime() - startTime;
+		estimatedTime = TimeUnit.NANOSECONDS.toMillis(estimatedTime);
+		setTimeToLog(estimatedTime);
+		if(done)
+			setHistory(kernelName,estimatedTime);
+		return done;
+	}
+	private boolean runWithArgs (KernelArgs args)
+	{
+		return nativeImage2DOpenCLArgs(
+				bmpOrig,
+				bmpOpenCL,
+				args.getTypes(),
+				args.getInts(),
+				args.getFloats(),
+				args.getArrays()
+				);
+	}
+	/*! \brief Applies a filter, or a chain of filters, onto many bitmaps in one native call.
+	 *
+	 * Meant for galleries and offline jobs: the session is initialised once and the bitmaps
+	 * are processed back to back, instead of one filter call per bitmap.
+	 * @param filters are the kernel names of the filters, in the order they are applied
+	 * @param inputs are the bitmaps to be processed
+	 * @param outputs receive the results, each with the size of its input
+	 * @return the milliseconds every bitmap took, or null on error
+	 */
+	public float[] OpenCLBatch (String[] filters, Bitmap[] inputs, Bitmap[] outputs)
+	{
+		if(filters.length == 0 || inputs.length != outputs.length)
+			return null;
+		long startTime = System.nanoTime();
+		initSession();
+		if(!setPipeline(filters, pipelineParameters(filters), dev_type))
+			return null;
+		float[] itemTimes = nativeBatchOpenCL(inputs, outputs);
+		long estimatedTime = System.nanoTime() - startTime;
+		estimatedTime = TimeUnit.NANOSECONDS.toMillis(estimatedTime);
+		setTimeToLog(estimatedTime);
+		if(itemTimes == null)
+			return null;
+
+		for(int i = 0; i < itemTimes.length; i++)
+			itemTimes[i] *= 1000;
+		StringBuilder name = new StringBuilder("Batch ").append(filters[0]);
+		for(int i = 1; i < filters.length; i++)
+			name.append("+").append(filters[i]);
+		name.append(" x").append(inputs.length);
+        setHistory(name.toString(),estimatedTime);
+		return itemTimes;
 	}
 	/*! \brief This function will be called when the saturatie button is clicked.
 	 *
@@ -327,12 +841,26 @@ public class OpenCL extends Object {
 			final TextView progressView = new TextView(mContext);
 			final SeekBar MySeekBar = new SeekBar(mContext);
 			MySeekBar.setMax(200);
+			/*
+			 * The slider renders a small copy of the image that stays on the device,
+			 * the full resolution image is only filtered when OK is pressed.
+			 */
+			initSession();
+			initOpenCL("saturatie",dev_type);
+			int[] previewSize = nativePreviewStart(bmpOrig, PREVIEW_SIZE);
+			final Bitmap bmpPreview = (previewSize == null) ? null :
+					Bitmap.createBitmap(previewSize[0], previewSize[1], Bitmap.Config.ARGB_8888);
 			MySeekBar.setOnSeekBarChangeListener(new SeekBar.OnSeekBarChangeListener(){ 
 				@Override 
 				public void onProgressChanged(SeekBar seekBar, int progress, 
 						boolean fromUser) { 
 					//  Auto-generated method stub 
 					progressView.setText(String.valueOf(progress)); 
+					if(bmpPreview != null) {
+						setSaturatie(progress);
+						if(nativePreviewRender(bmpPreview))
+							outputButton.setImageBitmap(bmpPreview);
+					}
 				} 
 				@Override 
 				public void onStartTrackingTouch(SeekBar seekBar) { 
@@ -356,6 +884,13 @@ public class OpenCL extends Object {
 			progressView.setGravity(1 | 0x10);
 			// Create the AlertDialog object and return it
 			AlertDialog dialog = builder.create();
+			dialog.setOnDismissListener(new DialogInterface.OnDismissListener() {
+				public void onDismiss(DialogInterface dialog) {
+					// after OK this shows the new result, otherwise the previous one
+					nativePreviewStop();
+					outputButton.setImageBitmap(bmpOpenCL);
+				}
+			});
 			LinearLayout ll=new LinearLayout(mContext);
 			ll.setOrientation(LinearLayout.VERTICAL);
 			ll.addView(MySeekBar);
@@ -372,46 +907,21 @@ public class OpenCL extends Object {
 	 */
 	private void saturate()
 	{
-		copyFile("saturatie.cl");
 		String kernelName="saturatie";
 		long startTime = System.nanoTime(); 
+		initSession();
 		initOpenCL(kernelName,dev_type);
 		nativeSaturatieImage2DOpenCL(
 				bmpOrig,
 				bmpOpenCL,
 				saturatie
 				);
-		shutdownOpenCL();
 		long estimatedTime = System.nanoTime() - startTime;
 		estimatedTime = TimeUnit.NANOSECONDS.toMillis(estimatedTime);
 		setTimeToLog(estimatedTime);   	
 		
         setHistory("Saturation",estimatedTime);
 
-	}
-	/*! \brief This function will copy a file from the assets folder specified by the argument to the execdir of the application.
-	 *
-	 * The argument is the file name and must be located inside the assets folder. It copies the file to make sure the OpenCL code can acces it.
-	 * @param f is the name of the file that has to be copied
-	 */
-	private void copyFile(final String f) {
-		InputStream in;
-		try {
-			in = mContext.getAssets().open(f);
-			final File of = new File(mContext.getDir("execdir",Context.MODE_PRIVATE), f);
-
-			final OutputStream out = new FileOutputStream(of);
-
-			final byte b[] = new byte[65535];
-			int sz = 0;
-			while ((sz = in.read(b)) > 0) {
-				out.write(b, 0, sz);
-			}
-			in.close();
-			out.close();
-		} catch (IOException e) {       
-			e.printStackTrace();
-		}
 	}
 	/*! \brief The setTimeFromJNI function allows the native code to set a value to the GUI in the log window.
 	 *
@@ -435,7 +945,7 @@ public class OpenCL extends Object {
 	{
 		View rootView = ((Activity)mContext).getWindow().getDecorView().findViewById(android.R.id.content);
 		TextView v = (TextView) rootView.findViewById(R.id.timeview);
-		v.setText(String.valueOf(time) + " ms" + "\n" + "Resolution: " + bmpOrig.getWidth() + " x " + bmpOrig.getHeight());
+		v.setText(String.valueOf(time) + " ms" + "\n" + "Resolution: " + bmpOrig.getWidth() + " x " + bmpOrig.getHeight() + profileText);
 	}
 	/*! \brief The setTimeToLog function adds a line with information to the history file
 	 *
@@ -448,7 +958,24 @@ public class OpenCL extends Object {
 		SimpleDateFormat formatter = new SimpleDateFormat("yyMMddHHmmss");
 		Date now = new Date();
 		String fileName = "RenderScript/" + filterName + formatter.format(now);
-		LogFileObject.writeToFile("\n" + Method + " : " + fileName + " : " + String.valueOf(time) + " ms", "LogFile.txt",false);
+		LogFileObject.writeToFile("\n" + Method + " : " + fileName + " : " + String.valueOf(time) + " ms" + profileText.replace("\n", " "), "LogFile.txt",false);
+		profileText = "";
+	}
+	/*! \brief The setProfileFromJNI function allows the native code to pass the stage times of a filter in profiling mode.
+	 *
+	 * The times are shown in the log window by setTimeToLog and added to the history by setHistory.
+	 *@param upload is the time the device spent on the upload in ms
+	 *@param kernel is the time the kernel ran in ms
+	 *@param download is the time the device spent on the download in ms
+	 *@param host is the rest of the native execution time in ms, for example host copies and waiting
+	 */
+	public void setProfileFromJNI(float upload, float kernel, float download, float host)
+	{
+		profileText = "\n" + "Upload: " + String.format("%.2f", upload) + " ms" +
+				"\n" + "Kernel: " + String.format("%.2f", kernel) + " ms" +
+				"\n" + "Download: " + String.format("%.2f", download) + " ms" +
+				"\n" + "Host: " + String.format("%.2f", host) + " ms";
+		Log.i("setProfileFromJNI", profileText);
 	}
 	/*! \brief The setConsoleOutput function allows the native code to set a value to the GUI in the console window.
 	 *
@@ -504,13 +1031,82 @@ public class OpenCL extends Object {
 				bmpOrig,
 				bmpOpenCL
 				);
-		shutdownOpenCL();		
 
 		long estimatedTime = System.nanoTime() - startTime;
 		estimatedTime = TimeUnit.NANOSECONDS.toMillis(estimatedTime);
 		setTimeToLog(estimatedTime);   
         setHistory("Run time compiled",estimatedTime);
 	}
+	/*! \brief Compiles OpenCL code from text input and runs it with extra kernel arguments.
+	 *
+	 *@param code is the OpenCL code that needs to be compiled
+	 *@param args are the kernel arguments from the third one on
+	 *@return false when the arguments do not fit the kernel, the reason is in the console
+	 */
+	public boolean codeFromFile(final String code, KernelArgs args)
+	{
+		long startTime = System.nanoTime();
+		initOpenCLFromInput(code, kernelName,dev_type);
+		boolean done = runWithArgs(args);
+		long estimatedTime = System.nanoTime() - startTime;
+		estimatedTime = TimeUnit.NANOSECONDS.toMillis(estimatedTime);
+		setTimeToLog(estimatedTime);
+		if(done)
+			setHistory("Run time compiled",estimatedTime);
+		return done;
+	}
+	/*! \brief Applies a filter onto RGBA pixels in direct ByteBuffers.
+	 *
+	 * Callers that already hold the pixels, like IplImage.getByteBuffer() of a 4 channel image,
+	 * hand them to the device without a bitmap in between.
+	 * @param kernelName is the kernel name of the filter
+	 * @param input is a direct ByteBuffer with the pixels to be processed
+	 * @param output is a direct ByteBuffer that receives the result
+	 * @param width is the width of the image
+	 * @param height is the height of the image
+	 * @param stride is the number of bytes per row of both buffers
+	 */
+	public void OpenCLBuffer (String kernelName, ByteBuffer input, ByteBuffer output, int width, int height, int stride)
+	{
+		long startTime = System.nanoTime();
+		initSession();
+		initOpenCL(kernelName,dev_type);
+		runOnBuffers(kernelName, input, output, width, height, stride);
+		long estimatedTime = System.nanoTime() - startTime;
+		estimatedTime = TimeUnit.NANOSECONDS.toMillis(estimatedTime);
+		setTimeToLog(estimatedTime);
+	}
+	private void runOnBuffers (String kernelName, ByteBuffer input, ByteBuffer output, int width, int height, int stride)
+	{
+		if(kernelName.equals("saturatie"))
+			nativeSaturatieImage2DOpenCLBuffer(input, output, width, height, stride, saturatie);
+		else
+			nativeImage2DOpenCLBuffer(input, output, width, height, stride);
+	}
+	/*! \brief Filters the video frames one by one, for when the video stream cannot be created.
+	 *
+	 * The kernel has to be initialized already. Every frame goes to the device as RGBA pixels
+	 * straight from the ByteBuffer of the image, so no bitmap is needed in between.
+	 * @return the number of recorded frames
+	 */
+	private int recordFramesOneByOne (FFmpegFrameGrabber grabber, FFmpegFrameRecorder recorder, String kernelName) throws Exception
+	{
+		int counter = 0;
+		IplImage rgba = IplImage.create(grabber.getImageWidth(), grabber.getImageHeight(), IPL_DEPTH_8U, 4);
+		IplImage rgbaResult = IplImage.create(rgba.width(), rgba.height(), IPL_DEPTH_8U, 4);
+		IplImage result = IplImage.create(rgba.width(), rgba.height(), IPL_DEPTH_8U, 3);
+		IplImage image;
+		while((image = grabber.grab()) != null)
+		{
+			opencv_imgproc.cvCvtColor(image, rgba, opencv_imgproc.CV_BGR2RGBA);
+			runOnBuffers(kernelName, rgba.getByteBuffer(), rgbaResult.getByteBuffer(), rgba.width(), rgba.height(), rgba.widthStep());
+			opencv_imgproc.cvCvtColor(rgbaResult, result, opencv_imgproc.CV_RGBA2BGR);
+			recorder.record(result);
+			counter++;
+			mGUIUpdater.updateProcessBar(String.valueOf(counter));
+		}
+		return counter;
+	}
 	public void OpenCLVideo(String[] arg)
 	{
 		int LengthInFrames = 0;
@@ -535,16 +1131,26 @@ public class OpenCL extends Object {
 			recorder.setVideoBitrate(33000);
 			recorder.setFrameRate(grabber.getFrameRate());				
 
-			IplImage image = IplImage.create(grabber.getImageWidth(), grabber.getImageHeight(), IPL_DEPTH_8U, 4);
-			IplImage frame2 = IplImage.create(image.width(), image.height(), IPL_DEPTH_8U, 4);
-			Bitmap MyBitmap = Bitmap.createBitmap(frame2.width(), frame2.height(), Bitmap.Config.ARGB_8888);   
-			Bitmap MyBitmap2 = Bitmap.createBitmap(frame2.width(), frame2.height(), Bitmap.Config.ARGB_8888);   
+			IplImage image = IplImage.create(grabber.getImageWidth(), grabber.getImageHeight(), IPL_DEPTH_8U, 3);
+			// Every frame in flight is downloaded into its own result, one more is recorded meanwhile.
+			IplImage results[] = new IplImage[VIDEO_STREAM_SLOTS + 1];
+			for(int i = 0; i < results.length; i++)
+				results[i] = IplImage.create(image.width(), image.height(), IPL_DEPTH_8U, 3);
+			int submitted = 0;
+			int returned = 0;
 			recorder.start();
 			
 			String kernelName=arg[0];
-			if(!arg[1].equals("runtime"))
+			initSession();
+			if(!arg[1].equals("runtime") && kernelName.contains("+"))
+			{
+				// a chain like "blur+saturatie" runs as one pipeline per frame
+				String[] filters = kernelName.split("\\+");
+				if(!setPipeline(filters, pipelineParameters(filters), dev_type))
+					throw new Exception("Cannot build the filter pipeline " + kernelName);
+			}
+			else if(!arg[1].equals("runtime"))
 			{
-				copyFile( arg[0] +".cl");
 				initOpenCL(kernelName,dev_type);
 			}
 			else
@@ -555,38 +1161,56 @@ public class OpenCL extends Object {
 			}
 	    	
 			grabber.setFrameNumber(0);
-
-			while(true)
-			{					
-				image = grabber.grab();
-				if(image==null)
-				{
-					break;
-				}
-				opencv_imgproc.cvCvtColor(image, frame2, opencv_imgproc.CV_BGR2RGBA);
-				MyBitmap.copyPixelsFromBuffer(frame2.getByteBuffer());
-				if(kernelName.equals("saturatie"))
-				{
-					nativeSaturatieImage2DOpenCL(
-							MyBitmap,
-							MyBitmap2,
-							saturatie
-							);    	
+			if(kernelName.equals("saturatie"))
+				setSaturatie(saturatie);
+			if(!nativeStreamStart(image.width(), image.height(), true))
+			{
+				// a pipeline only runs as a stream, a single kernel still runs frame by frame
+				if(kernelName.contains("+") && !arg[1].equals("runtime"))
+					throw new Exception("Cannot start the OpenCL video stream");
+				counter = recordFramesOneByOne(grabber, recorder, kernelName);
+			}
+			else
+			{
+				/*
+				 * The grabber frames are BGR and go to the device as they are. The stream
+				 * returns the frames in order, each one in the result it was submitted with.
+				 */
+				while(true)
+				{					
+					image = grabber.grab();
+					if(image==null)
+					{
+						break;
+					}
+					IplImage result = results[submitted % results.length];
+					submitted++;
+					int status = nativeStreamSubmitBGR(image.getByteBuffer(), image.widthStep(), result.getByteBuffer(), result.widthStep());
+					if(status == STREAM_ERROR)
+					{
+						nativeStreamStop();
+						throw new Exception("OpenCL failed on video frame " + submitted);
+					}
+					if(status == STREAM_FRAME_READY)
+					{
+						recorder.record(results[returned % results.length]);
+						returned++;
+						counter++;
+						mGUIUpdater.updateProcessBar(String.valueOf(counter));
+					}
 				}
-				else
+				int status;
+				while((status = nativeStreamFlushBGR()) == STREAM_FRAME_READY)
 				{
-					nativeImage2DOpenCL(
-							MyBitmap,
-							MyBitmap2
-							);    	
+					recorder.record(results[returned % results.length]);
+					returned++;
+					counter++;
+					mGUIUpdater.updateProcessBar(String.valueOf(counter));
 				}
-				MyBitmap2.copyPixelsToBuffer(frame2.getByteBuffer());
-				opencv_imgproc.cvCvtColor(frame2, image, opencv_imgproc.CV_RGBA2BGR);		            
-				recorder.record(image);
-				counter++;
-				mGUIUpdater.updateProcessBar(String.valueOf(counter));
+				nativeStreamStop();
+				if(status == STREAM_ERROR)
+					throw new Exception("OpenCL failed on video frame " + (returned + 1));
 			}
-			shutdownOpenCL();		
 			recorder.stop();
 			grabber.stop();	
 			mGUIUpdater.updateProcessBar("Done");
@@ -630,6 +1254,11 @@ public class OpenCL extends Object {
 
 		return code;
 	}
+	/*! \brief Selects the device the filters run on.
+	 *
+	 * @param device is 0 for the GPU, 1 for the CPU, 2 for auto, which runs every filter on the device that measured fastest for it,
+	 * and 3 for GPU+CPU, which splits every image over both devices
+	 */
 	public void setDeviceType(int device)
 	{
 		dev_type = device;
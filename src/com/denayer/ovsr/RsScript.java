@@ -383,10 +383,26 @@ public class RsScript extends Object {
     *  
     */
 	public void RenderScriptMediaan()
+	{
+		RenderScriptMediaan(2);
+	}
+	
+	/*! \brief executes a mediaan Filter with a radius on the input image
+	*
+	* The window has to fit the 16 bit histogram bins of the script, so the radius is at most 127,
+	* other radii are rejected and leave the output bitmap unchanged.
+	* @param radius is the radius of the square window, from 1 to 127
+	*/
+	public void RenderScriptMediaan(int radius)
 	{
 		
 		if(inBitmap == null)
 			return;
+		if(radius < 1 || radius > 127)
+		{
+			Log.e("RsScript", "The median radius " + radius + " is not between 1 and 127");
+			return;
+		}
 				
 		long startTime = System.nanoTime(); 
 		Log.i("koen","inside RenderScriptMediaan");        
@@ -403,7 +419,7 @@ public class RsScript extends Object {
 	    
 	    script.set_width(inBitmap.getWidth());
 	    script.set_height(inBitmap.getHeight());
-	    
+	    script.set_radius(radius);
 	    
 	    script.invoke_filter();	
 	    rs.finish();
@@ -31,7 +31,7 @@ import android.content.Context;
 
 public class SettingsActivity extends Activity {
 	static SharedPreferences settings;
-	static CheckBox checkBox, checkBox2, checkBox3, checkBox4ShowCode;
+	static CheckBox checkBox, checkBox2, checkBox3, checkBox4ShowCode, checkBox5Profile;
 	static EditText ServerIP,ServerPort;
 	static public Button signIn;
 	static public Button signUp;
@@ -121,6 +121,7 @@ public class SettingsActivity extends Activity {
 			checkBox2 = (CheckBox) rootView.findViewById(R.id.rememberUser);
 			checkBox3 = (CheckBox) rootView.findViewById(R.id.UseDefaultServer);
 			checkBox4ShowCode = (CheckBox) rootView.findViewById(R.id.showCodeBox);
+			checkBox5Profile = (CheckBox) rootView.findViewById(R.id.profileOpenCLBox);
 			signUp = (Button) rootView.findViewById(R.id.buttonSignUP2);
 			signIn = (Button) rootView.findViewById(R.id.buttonSignIN2);
 			ServerIP = (EditText) rootView.findViewById(R.id.OVSRServerName);
@@ -163,6 +164,15 @@ public class SettingsActivity extends Activity {
 				checkBox4ShowCode.setChecked(false);
 
 			}
+
+			if(settings.getBoolean("profileOpenCL", false))
+			{
+				checkBox5Profile.setChecked(true);
+			}
+			else
+			{
+				checkBox5Profile.setChecked(false);
+			}
 			checkBox.setOnCheckedChangeListener(new CompoundButton.OnCheckedChangeListener() {
 				@Override
 				public void onCheckedChanged(CompoundButton arg0, boolean arg1) {
@@ -228,6 +238,14 @@ public class SettingsActivity extends Activity {
 					editor.commit();					
 				}
 			});
+			checkBox5Profile.setOnCheckedChangeListener(new CompoundButton.OnCheckedChangeListener() {
+				@Override
+				public void onCheckedChanged(CompoundButton arg0, boolean arg1) {
+					SharedPreferences.Editor editor = settings.edit();
+					editor.putBoolean("profileOpenCL", arg1);
+					editor.commit();					
+				}
+			});
 			signIn.setOnClickListener(new View.OnClickListener() {
 				@Override
 				public void onClick(View v) {
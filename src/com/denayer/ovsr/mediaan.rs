@@ -3,80 +3,120 @@
 
 #include "rs_types.rsh"
 
-static void bubble_sort(float[], float);
+static uchar select_median(uchar list[], int n);
+static uchar histogram_median(const ushort hist[], int rank);
 
 rs_allocation out;
 rs_allocation in;
 rs_script script;
 
 int width,height;
+int radius = 2; // the window is 2 * radius + 1 pixels square, from 1 to 127 so it fits the ushort bins
 
 void init(){
 
 }
 
+/*
+ * Windows of a radius up to 2 hold at most 25 pixels, their median is selected
+ * from a list. Larger windows are counted into one histogram per channel and the
+ * median is found by walking the histogram up to the middle of the window. Both
+ * read every pixel of the window, so the cost still grows with radius^2, but the
+ * histogram avoids sorting it. Clearing and walking the 256 bins costs more than
+ * selecting from a small list, so the histogram only pays off for larger radii.
+ */
 void root(const uchar4* v_in, uchar4* v_out, const void* usrData, uint32_t x,
       uint32_t y)
 {
-	
-	if( x == 0 || x == width - 1 || y == 0 || y == height - 1)
+
+	if(radius < 1 || radius > 127 ||
+			(int)x < radius || (int)x >= width - radius || (int)y < radius || (int)y >= height - radius)
 	{
 		*v_out = *v_in;
 		return;
 	}
-		
-	
-	float4 pixel = { 0, 0, 0, 0 };
-	int counter = 0;
-	float pixelListR[25];
-	float pixelListG[25];
-	float pixelListB[25];
-		
-	for(float i=-2;i<=2;i++)
-	{		
-	
-		for(float j=-2;j<=2;j++)
+
+	int rank = (2*radius+1)*(2*radius+1)/2;
+	uchar4 result;
+	result.a = 255;
+
+	if(radius <= 2)
+	{
+		uchar listR[25];
+		uchar listG[25];
+		uchar listB[25];
+		int counter = 0;
+		for(int i=-radius;i<=radius;i++)
 		{
-			
-		
-			pixel = rsUnpackColor8888(*(uchar4*) rsGetElementAt(in, x+j, y+i));
-			pixel.r *= 255.0f;		
-			pixel.g *= 255.0f;
-			pixel.b *= 255.0f;	
-			
-			pixelListR[counter] = pixel.r;
-			pixelListG[counter] = pixel.g;
-			pixelListB[counter] = pixel.b;				
-			
-			counter++;		
-		
-		}		
-			
-	}	
-	
-	bubble_sort(pixelListR, 25);
-	bubble_sort(pixelListG, 25);
-	bubble_sort(pixelListB, 25);
-
-    *v_out = rsPackColorTo8888(pixelListR[12]/255.0f,pixelListG[12]/255.0f,pixelListB[12]/255.0f);
-    
-  
+			for(int j=-radius;j<=radius;j++)
+			{
+				uchar4 pixel = *(const uchar4*) rsGetElementAt(in, x+j, y+i);
+				listR[counter] = pixel.r;
+				listG[counter] = pixel.g;
+				listB[counter] = pixel.b;
+				counter++;
+			}
+		}
+		result.r = select_median(listR, counter);
+		result.g = select_median(listG, counter);
+		result.b = select_median(listB, counter);
+		*v_out = result;
+		return;
+	}
+
+	ushort histR[256];
+	ushort histG[256];
+	ushort histB[256];
+	for(int v = 0; v < 256; v++)
+	{
+		histR[v] = 0;
+		histG[v] = 0;
+		histB[v] = 0;
+	}
+
+	for(int i=-radius;i<=radius;i++)
+	{
+		for(int j=-radius;j<=radius;j++)
+		{
+			uchar4 pixel = *(const uchar4*) rsGetElementAt(in, x+j, y+i);
+			histR[pixel.r]++;
+			histG[pixel.g]++;
+			histB[pixel.b]++;
+		}
+	}
+
+	result.r = histogram_median(histR, rank);
+	result.g = histogram_median(histG, rank);
+	result.b = histogram_median(histB, rank);
+    *v_out = result;
 }
 
-void bubble_sort(float list[], float n)
+// Selection sort that stops once the middle element is in place
+static uchar select_median(uchar list[], int n)
 {
-  long c, d, t;
-    for (c = 1 ; c <= n - 1; c++) {
-    d = c;
- 	
-    while ( d > 0 && list[d] < list[d-1]) {
-      t          = list[d];
-      list[d]   = list[d-1];
-      list[d-1] = t;
- 
-      d--;
+  int middle = n / 2;
+  for (int c = 0; c <= middle; c++) {
+    int smallest = c;
+    for (int d = c + 1; d < n; d++) {
+      if (list[d] < list[smallest])
+        smallest = d;
     }
-  }  
+    uchar t = list[c];
+    list[c] = list[smallest];
+    list[smallest] = t;
+  }
+  return list[middle];
+}
+
+static uchar histogram_median(const ushort hist[], int rank)
+{
+  int count = 0;
+  for (int v = 0; v < 255; v++) {
+    count += hist[v];
+    if (count > rank)
+      return v;
+  }
+  return 255;
 }
 
 void filter()
@@ -87,5 +127,5 @@ void filter()
     #else
         rsForEach(script, in, out);
     #endif
-    
-}
\ No newline at end of file
+
+}